@@ -3,7 +3,7 @@ _kerpad_long_opt_completions() {
 	COMPREPLY=()
 	cur="${COMP_WORDS[COMP_CWORD]}"
 	prev="${COMP_WORDS[COMP_CWORD-1]}"
-	long_opts="--thickness= --minx=  --maxx= --miny= --maxy= --sleep-time= --name= --always --no-edge-protection --edge-scrolling --vertical-scrolling= --horizontal-scrolling= --scroll-div= --disable-double-tap --list --verbose --help"
+	long_opts="--thickness= --minx=  --maxx= --miny= --maxy= --sleep-time= --name= --all-touchpads --always --no-edge-protection --edge-scrolling --vertical-scrolling= --horizontal-scrolling= --scroll-div= --momentum --grab --disable-double-tap --no-edge-motion --realtime --rt-priority= --cpus= --output= --io= --report-rate= --report-phase= --power-save --frame-sync --simulate= --gestures= --simulation-rate= --simulate-core --replay= --list --verbose --log-rate= --chrome-trace= --startup-report --stats= --flight-recorder= --no-flight-recorder --help"
 
 	if [[ ${prev} == "--list*" ]]
 	then
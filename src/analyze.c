@@ -0,0 +1,509 @@
+/*
+ * kerpad-analyze reads captures of touchpad events and
+ * gives what is needed to choose the options of kerpad for
+ * a touchpad: its report rate and jitter, the size of its
+ * frames, the time spent in each edge zone and the counts
+ * of touches, presses and double taps
+ *
+ * A capture is mapped in memory and its events are read
+ * in a single sequential pass, so it is only limited
+ * by the memory bandwidth, even for huge captures
+ * It can also record a capture from a touchpad
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/input.h>
+
+#include "capture.h"
+#include "core.h"
+#include "touchpad.h"
+#include "util.h"
+
+// gaps longer than this factor times
+// the median interval are outliers
+#define DEFAULT_GAP_FACTOR 3
+// larger frames are counted with this size
+#define MAX_FRAME_SIZE 32
+// intervals between frames are counted by microsecond
+// up to this value, the longer ones are counted with it
+#define MAX_INTERVAL 65536
+// distances to the border are counted up to this value
+#define MAX_DISTANCE 1024
+// number of longest gaps printed
+#define N_OUTLIERS 5
+// thicknesses compared by the report
+#define THICKNESS_STEP 50
+#define MAX_THICKNESS 500
+
+#define N_ZONES 9
+// index of a zone, from the edges of kerpad (-1, 0 or 1)
+#define ZONE(edgex, edgey) (((edgey)+1)*3+(edgex)+1)
+
+static const char *zone_names[N_ZONES] = {
+	"top-left", "top", "top-right",
+	"left", "inside", "right",
+	"bottom-left", "bottom", "bottom-right",
+};
+
+static volatile sig_atomic_t running = true;
+
+static struct option long_options[] = {
+	{"thickness", required_argument, NULL, 't'},
+	{"minx", required_argument, NULL, 'x'},
+	{"maxx", required_argument, NULL, 'X'},
+	{"miny", required_argument, NULL, 'y'},
+	{"maxy", required_argument, NULL, 'Y'},
+	{"device", required_argument, NULL, 'd'},
+	{"gap", required_argument, NULL, 'g'},
+	{"record", required_argument, NULL, 'r'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0},
+};
+
+struct gap {
+	// in microseconds
+	long duration;
+	// time of the frame ending the gap,
+	// since the first frame
+	long time;
+};
+
+struct analysis {
+	// edge limits, as in init_edge_limits
+	int thickness;
+	int minx, maxx, miny, maxy;
+	struct input_absinfo absx, absy;
+	
+	unsigned long events;
+	unsigned long frames;
+	unsigned long dropped;
+	unsigned long frame_sizes[MAX_FRAME_SIZE+1];
+	long first_time;
+	long last_time;
+	
+	// intervals between frames while the finger is down
+	unsigned long intervals[MAX_INTERVAL+1];
+	unsigned long n_intervals;
+	struct gap outliers[N_OUTLIERS];
+	
+	// contact time and moved distance in each zone
+	long zone_time[N_ZONES];
+	double zone_distance[N_ZONES];
+	// contact time by distance to the nearest border
+	long distance_time[MAX_DISTANCE+1];
+	long contact_time;
+	
+	unsigned long touches;
+	unsigned long presses;
+	unsigned long double_taps;
+};
+
+// state of the finger while reading the events
+struct finger {
+	int x, y;
+	int last_x, last_y;
+	// values of the current frame, -1 if not given
+	int touch, press;
+	bool touched, pressed;
+	long last_time;
+	long last_touch_time;
+	int frame_size;
+};
+
+static void handler(int signum) {
+	(void)signum;
+	running = false;
+}
+
+static void print_help(char *argv[]) {
+	printf("Usage: %s [options] CAPTURE...\n", argv[0]);
+	printf("       %s --record=DEVICE CAPTURE\n", argv[0]);
+	printf("Analyze captures of touchpad events.\n\n");
+	printf("    -t, --thickness=T     thickness of the edges (default: %d)\n",
+		   DEFAULT_EDGE_THICKNESS);
+	printf("    -x, --minx=MIN_X      edge limits, as the options of kerpad\n");
+	printf("    -X, --maxx=MAX_X\n");
+	printf("    -y, --miny=MIN_Y\n");
+	printf("    -Y, --maxy=MAX_Y\n");
+	printf("    -d, --device=DEVICE   take the touchpad limits from DEVICE,\n");
+	printf("                          for raw captures without header\n");
+	printf("    -g, --gap=FACTOR      gaps longer than FACTOR times the median\n");
+	printf("                          interval are outliers (default: %d)\n",
+		   DEFAULT_GAP_FACTOR);
+	printf("    -r, --record=DEVICE   record the events of DEVICE in CAPTURE\n");
+	printf("                          until Ctrl+C\n");
+	printf("    -h, --help            display this help and exit\n");
+}
+
+static double now_seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec+now.tv_nsec/1e9;
+}
+
+/**
+ * Read the limits of the touchpad of a device
+ *
+ * Return 0 on success and -1 on error
+ */
+static int read_limits(const char *device, struct input_absinfo *x, struct input_absinfo *y) {
+	int fd = open(device, O_RDONLY);
+	if (msgif(fd == -1, "cannot open %s", device)) return -1;
+	errno = 0;
+	bool failed = ioctl(fd, EVIOCGABS(ABS_X), x) == -1 || ioctl(fd, EVIOCGABS(ABS_Y), y) == -1;
+	close(fd);
+	return msgif(failed, "cannot get the limits of %s", device)? -1: 0;
+}
+
+/**
+ * Record the events of a device in a capture, until SIGINT
+ */
+static int record(const char *device, const char *path) {
+	struct input_absinfo x, y;
+	if (read_limits(device, &x, &y) == -1) return -1;
+	int in = open(device, O_RDONLY);
+	if (msgif(in == -1, "cannot open %s", device)) return -1;
+	int out = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	exitif(out == -1, "cannot open %s", path);
+	exitif(capture_write_header(out, &x, &y) == -1, "cannot write to %s", path);
+	
+	// without SA_RESTART, so SIGINT interrupts the read
+	struct sigaction sig = {
+		.sa_handler = handler,
+	};
+	sigemptyset(&sig.sa_mask);
+	exitif(sigaction(SIGINT, &sig, NULL) == -1, "error on sigaction");
+	exitif(sigaction(SIGTERM, &sig, NULL) == -1, "error on sigaction");
+	
+	fprintf(stderr, "recording %s in %s, press Ctrl+C to stop\n", device, path);
+	unsigned long events = 0;
+	struct input_event buffer[64];
+	while (running) {
+		ssize_t size = read(in, buffer, sizeof(buffer));
+		if (size == -1 && errno == EINTR) continue;
+		exitif(size <= 0, "cannot read from %s", device);
+		exitif(write(out, buffer, size) != size, "cannot write to %s", path);
+		events += size/sizeof(*buffer);
+	}
+	close(in);
+	exitif(close(out) == -1, "cannot write to %s", path);
+	fprintf(stderr, "%lu events recorded\n", events);
+	return 0;
+}
+
+/**
+ * Return the zone of a position
+ */
+static int get_zone(struct analysis *a, int x, int y) {
+	int edgex = x <= a->minx? -1: x >= a->maxx? 1: 0;
+	int edgey = y <= a->miny? -1: y >= a->maxy? 1: 0;
+	return ZONE(edgex, edgey);
+}
+
+/**
+ * Return the distance of a position to the nearest border
+ */
+static int border_distance(struct analysis *a, int x, int y) {
+	int d = x-a->absx.minimum;
+	if (a->absx.maximum-x < d) d = a->absx.maximum-x;
+	if (y-a->absy.minimum < d) d = y-a->absy.minimum;
+	if (a->absy.maximum-y < d) d = a->absy.maximum-y;
+	if (d < 0) return 0;
+	return d > MAX_DISTANCE? MAX_DISTANCE: d;
+}
+
+/**
+ * Keep the longest gaps in a->outliers,
+ * sorted from the longest
+ */
+static void add_outlier(struct analysis *a, long duration, long time) {
+	if (duration <= a->outliers[N_OUTLIERS-1].duration) return;
+	int i = N_OUTLIERS-1;
+	for (; i > 0 && a->outliers[i-1].duration < duration; --i)
+		a->outliers[i] = a->outliers[i-1];
+	a->outliers[i] = (struct gap) {
+		.duration = duration,
+		.time = time-a->first_time,
+	};
+}
+
+/**
+ * Account a frame ending at time
+ */
+static void end_frame(struct analysis *a, struct finger *f, long time) {
+	if (a->frames++ == 0) a->first_time = time;
+	a->last_time = time;
+	++a->frame_sizes[f->frame_size < MAX_FRAME_SIZE? f->frame_size: MAX_FRAME_SIZE];
+	f->frame_size = 0;
+	
+	if (f->touched) {
+		// the finger was down since the previous frame,
+		// where it was at last_x, last_y
+		long interval = time-f->last_time;
+		if (interval < 0) interval = 0;
+		++a->intervals[interval < MAX_INTERVAL? interval: MAX_INTERVAL];
+		++a->n_intervals;
+		add_outlier(a, interval, time);
+		
+		int zone = get_zone(a, f->last_x, f->last_y);
+		a->zone_time[zone] += interval;
+		a->zone_distance[zone] += hypot(f->x-f->last_x, f->y-f->last_y);
+		a->distance_time[border_distance(a, f->last_x, f->last_y)] += interval;
+		a->contact_time += interval;
+	}
+	
+	if (f->touch > 0 && !f->touched) {
+		++a->touches;
+		if (a->touches > 1 && time-f->last_touch_time < CORE_DOUBLE_TAP_TIME*1000L)
+			++a->double_taps;
+		f->last_touch_time = time;
+	}
+	if (f->touch >= 0) f->touched = f->touch;
+	if (f->press > 0 && !f->pressed) ++a->presses;
+	if (f->press >= 0) f->pressed = f->press;
+	f->touch = -1;
+	f->press = -1;
+	f->last_x = f->x;
+	f->last_y = f->y;
+	f->last_time = time;
+}
+
+/**
+ * Read the events in a single pass
+ */
+static void analyze_events(struct analysis *a, const struct input_event *events, size_t count) {
+	struct finger f = {
+		.x = a->absx.minimum,
+		.y = a->absy.minimum,
+		.touch = -1,
+		.press = -1,
+	};
+	for (size_t i = 0; i < count; ++i) {
+		const struct input_event *event = events+i;
+		++f.frame_size;
+		switch (event->type) {
+		case EV_ABS:
+			if (event->code == ABS_X) f.x = event->value;
+			else if (event->code == ABS_Y) f.y = event->value;
+			break;
+		case EV_KEY:
+			if (event->code == BTN_TOUCH) f.touch = event->value;
+			else if (event->code == BTN_LEFT) f.press = event->value;
+			break;
+		case EV_SYN:
+			if (event->code == SYN_REPORT)
+				end_frame(a, &f, event->input_event_sec*1000000L+event->input_event_usec);
+			else if (event->code == SYN_DROPPED)
+				++a->dropped;
+			break;
+		}
+	}
+	a->events += count;
+}
+
+/**
+ * Return the interval below which are
+ * the given part of the intervals
+ */
+static long interval_percentile(struct analysis *a, double part) {
+	unsigned long target = part*(a->n_intervals-1);
+	unsigned long seen = 0;
+	for (long i = 0; i <= MAX_INTERVAL; ++i) {
+		seen += a->intervals[i];
+		if (seen > target) return i;
+	}
+	return MAX_INTERVAL;
+}
+
+static void print_analysis(struct analysis *a, double gap_factor) {
+	double duration = (a->last_time-a->first_time)/1e6;
+	printf("%lu events, %lu frames over %.3fs, %lu SYN_DROPPED\n",
+		   a->events, a->frames, duration, a->dropped);
+	printf("touchpad: x %d..%d, y %d..%d, edge limits: x %d..%d, y %d..%d\n",
+		   a->absx.minimum, a->absx.maximum, a->absy.minimum, a->absy.maximum,
+		   a->minx, a->maxx, a->miny, a->maxy);
+	
+	printf("frame sizes:");
+	for (int i = 0; i <= MAX_FRAME_SIZE; ++i) {
+		if (!a->frame_sizes[i]) continue;
+		printf(" %s%d: %.1f%%", i == MAX_FRAME_SIZE? ">=": "", i,
+			   100.0*a->frame_sizes[i]/a->frames);
+	}
+	printf("\n");
+	
+	if (a->n_intervals) {
+		long median = interval_percentile(a, 0.5);
+		long threshold = median*gap_factor;
+		if (threshold > MAX_INTERVAL) threshold = MAX_INTERVAL;
+		// the jitter is measured without the gaps, which
+		// are pauses of the finger rather than jitter
+		unsigned long regular = 0;
+		double sum = 0;
+		double sum2 = 0;
+		for (long i = 0; i <= threshold; ++i) {
+			regular += a->intervals[i];
+			sum += (double)i*a->intervals[i];
+			sum2 += (double)i*i*a->intervals[i];
+		}
+		double mean = sum/regular;
+		double jitter = sqrt(sum2/regular-mean*mean);
+		printf("report rate: %.1f Hz (median interval %ld us), jitter %.1f us, "
+			   "p1 %ld us, p99 %ld us, max %ld us\n",
+			   median? 1e6/median: 0, median, jitter, interval_percentile(a, 0.01),
+			   interval_percentile(a, 0.99), a->outliers[0].duration);
+		
+		unsigned long gaps = a->n_intervals-regular;
+		printf("gaps over %gx the median: %lu (%.3f%%)", gap_factor, gaps,
+			   100.0*gaps/a->n_intervals);
+		for (int i = 0; i < N_OUTLIERS && a->outliers[i].duration > threshold; ++i) {
+			printf("%s %.1f ms at %.3fs", i? ",": ", longest:",
+				   a->outliers[i].duration/1e3, a->outliers[i].time/1e6);
+		}
+		printf("\n");
+	}
+	printf("touches: %lu, presses: %lu, double taps: %lu\n",
+		   a->touches, a->presses, a->double_taps);
+	if (!a->contact_time) return;
+	
+	printf("contact time: %.3fs\n", a->contact_time/1e6);
+	printf("%-14s %10s %8s %14s\n", "zone", "time (s)", "share", "speed (u/s)");
+	for (int i = 0; i < N_ZONES; ++i) {
+		if (!a->zone_time[i]) continue;
+		printf("%-14s %10.3f %7.2f%% %14.1f\n", zone_names[i], a->zone_time[i]/1e6,
+			   100.0*a->zone_time[i]/a->contact_time,
+			   a->zone_distance[i]*1e6/a->zone_time[i]);
+	}
+	printf("contact time at an edge by thickness:");
+	long at_edge = 0;
+	int distance = 0;
+	for (int thickness = THICKNESS_STEP; thickness <= MAX_THICKNESS;
+		 thickness += THICKNESS_STEP) {
+		for (; distance <= thickness; ++distance) at_edge += a->distance_time[distance];
+		printf(" %d: %.1f%%", thickness, 100.0*at_edge/a->contact_time);
+	}
+	printf("\n");
+}
+
+/**
+ * Map and analyze a capture
+ *
+ * Return 0 on success and -1 on error
+ */
+static int analyze(const char *path, struct analysis *settings, double gap_factor,
+				   bool has_limits) {
+	int fd = open(path, O_RDONLY);
+	if (msgif(fd == -1, "cannot open %s", path)) return -1;
+	struct stat st;
+	exitif(fstat(fd, &st) == -1, "cannot stat %s", path);
+	size_t size = st.st_size;
+	if (size == 0) {
+		close(fd);
+		error_message("%s is empty", path);
+		return -1;
+	}
+	const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	exitif(data == MAP_FAILED, "cannot map %s", path);
+	madvise((void *)data, size, MADV_SEQUENTIAL|MADV_WILLNEED);
+	
+	struct analysis *a = malloc(sizeof(*a));
+	exitif(a == NULL, "cannot allocate the analysis");
+	*a = *settings;
+	const capture_header_t *header = capture_get_header(data, size);
+	size_t offset = 0;
+	if (header) {
+		if (!has_limits) {
+			a->absx = header->x;
+			a->absy = header->y;
+		}
+		offset = sizeof(*header);
+	} else if (!has_limits) {
+		munmap((void *)data, size);
+		free(a);
+		error_message("%s has no header, give the touchpad with --device", path);
+		return -1;
+	}
+	// as init_edge_limits does
+	if (a->minx < 0) a->minx = a->absx.minimum+a->thickness;
+	if (a->maxx < 0) a->maxx = a->absx.maximum-a->thickness;
+	if (a->miny < 0) a->miny = a->absy.minimum+a->thickness;
+	if (a->maxy < 0) a->maxy = a->absy.maximum-a->thickness;
+	
+	size_t count = (size-offset)/sizeof(struct input_event);
+	if ((size-offset)%sizeof(struct input_event))
+		error_message("warning: %s ends with a partial event", path);
+	double start = now_seconds();
+	analyze_events(a, (const struct input_event *)(data+offset), count);
+	double elapsed = now_seconds()-start;
+	
+	printf("%s: ", path);
+	print_analysis(a, gap_factor);
+	printf("read %.1f MB in %.3fs (%.2f GB/s)\n\n", size/1e6, elapsed,
+		   elapsed > 0? size/elapsed/1e9: 0);
+	munmap((void *)data, size);
+	free(a);
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	struct analysis settings = {
+		.thickness = DEFAULT_EDGE_THICKNESS,
+		.minx = -1,
+		.maxx = -1,
+		.miny = -1,
+		.maxy = -1,
+	};
+	double gap_factor = DEFAULT_GAP_FACTOR;
+	const char *device = NULL;
+	const char *recorded = NULL;
+	
+	while (1) {
+		int opt = getopt_long(argc, argv, "t:x:X:y:Y:d:g:r:h", long_options, NULL);
+		if (opt == -1) break;
+		
+		switch (opt) {
+		case 't': settings.thickness = atoi(optarg); break;
+		case 'x': settings.minx = atoi(optarg); break;
+		case 'X': settings.maxx = atoi(optarg); break;
+		case 'y': settings.miny = atoi(optarg); break;
+		case 'Y': settings.maxy = atoi(optarg); break;
+		case 'd': device = optarg; break;
+		case 'g': gap_factor = atof(optarg); break;
+		case 'r': recorded = optarg; break;
+		case 'h':
+			print_help(argv);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv);
+			return EXIT_FAILURE;
+		}
+	}
+	if (settings.thickness < 0 || gap_factor <= 0 || optind == argc
+		|| (recorded && argc-optind != 1)) {
+		print_help(argv);
+		return EXIT_FAILURE;
+	}
+	if (recorded) return record(recorded, argv[optind]) == -1? EXIT_FAILURE: EXIT_SUCCESS;
+	
+	if (device && read_limits(device, &settings.absx, &settings.absy) == -1)
+		return EXIT_FAILURE;
+	int result = EXIT_SUCCESS;
+	for (int i = optind; i < argc; ++i) {
+		if (analyze(argv[i], &settings, gap_factor, device != NULL) == -1)
+			result = EXIT_FAILURE;
+	}
+	return result;
+}
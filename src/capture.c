@@ -0,0 +1,29 @@
+/*
+ * This file is responsible for the format of the
+ * captures of touchpad events: a header giving the
+ * limits of the touchpad, then the raw evdev events
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+_Static_assert(sizeof(capture_header_t)%sizeof(struct input_event) == 0,
+			   "the events of a capture must stay aligned");
+
+int capture_write_header(int fd, const struct input_absinfo *x, const struct input_absinfo *y) {
+	capture_header_t header = {
+		.x = *x,
+		.y = *y,
+	};
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+	return write(fd, &header, sizeof(header)) == sizeof(header)? 0: -1;
+}
+
+const capture_header_t *capture_get_header(const void *data, size_t size) {
+	if (size < sizeof(capture_header_t)) return NULL;
+	const capture_header_t *header = data;
+	if (memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic))) return NULL;
+	return header;
+}
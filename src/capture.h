@@ -0,0 +1,41 @@
+#ifndef __CAPTURE_H__
+#define __CAPTURE_H__
+
+#include <stddef.h>
+#include <linux/input.h>
+
+// first bytes of a capture file
+#define CAPTURE_MAGIC "KPCAPTR1"
+
+/**
+ * Header of a capture file, followed by the
+ * struct input_event read from the touchpad
+ *
+ * Its size is a multiple of the size of an event,
+ * so the events stay aligned in a mapped capture
+ */
+struct capture_header {
+	char magic[8];
+	// limits of the touchpad, given by EVIOCGABS
+	struct input_absinfo x;
+	struct input_absinfo y;
+	char reserved[3*sizeof(struct input_event)-8-2*sizeof(struct input_absinfo)];
+};
+typedef struct capture_header capture_header_t;
+
+/**
+ * Write the header of a capture in fd
+ *
+ * Return 0 on success and -1 on error
+ */
+int capture_write_header(int fd, const struct input_absinfo *x, const struct input_absinfo *y);
+
+/**
+ * Return the header at the beginning of data,
+ * or NULL if data does not start with a header
+ *
+ * size: size of data in bytes
+ */
+const capture_header_t *capture_get_header(const void *data, size_t size);
+
+#endif // !__CAPTURE_H__
@@ -0,0 +1,240 @@
+/*
+ * This file is responsible for timekeeping:
+ * reading the time, sleeping and waiting,
+ * with the real time or with a virtual time
+ * for deterministic simulations
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdatomic.h>
+
+#include "clock.h"
+#include "util.h"
+
+// states of the threads using a virtual clock
+#define THREAD_ABSENT   0
+#define THREAD_RUNNABLE 1
+#define THREAD_SLEEPING 2
+#define THREAD_WAITING  3
+#define THREAD_DONE     4
+
+struct vthread {
+	int state;
+	// wake up time when THREAD_SLEEPING
+	long deadline;
+	// word waited when THREAD_WAITING
+	atomic_int *wait_on;
+	// signaled when the thread can run
+	pthread_cond_t resume;
+};
+
+struct kclock {
+	bool virtual;
+	atomic_ulong wakeups[KCLOCK_MAX_THREADS];
+	
+	// the fields below are only used by a virtual clock
+	// and are protected by lock
+	pthread_mutex_t lock;
+	struct vthread threads[KCLOCK_MAX_THREADS];
+	int expected;
+	int entered;
+	// id of the thread allowed to run, -1 if none
+	int running;
+	atomic_long now;
+};
+
+// id given to kclock_enter by the calling thread
+static _Thread_local int thread_id = -1;
+
+static kclock_t *kclock_init(bool virtual) {
+	kclock_t *clock = malloc(sizeof(*clock));
+	exitif(clock == NULL, "cannot allocate the clock");
+	clock->virtual = virtual;
+	for (int i = 0; i < KCLOCK_MAX_THREADS; ++i) {
+		atomic_init(&clock->wakeups[i], 0);
+		clock->threads[i].state = THREAD_ABSENT;
+		clock->threads[i].wait_on = NULL;
+		pthread_cond_init(&clock->threads[i].resume, NULL);
+	}
+	pthread_mutex_init(&clock->lock, NULL);
+	clock->expected = 0;
+	clock->entered = 0;
+	clock->running = -1;
+	atomic_init(&clock->now, 0);
+	return clock;
+}
+
+kclock_t *kclock_init_real() {
+	return kclock_init(false);
+}
+
+kclock_t *kclock_init_virtual() {
+	return kclock_init(true);
+}
+
+bool kclock_is_virtual(kclock_t *clock) {
+	return clock->virtual;
+}
+
+/**
+ * Give the right to run to the next thread
+ * If no thread is runnable, the time advances
+ * to the next wake up time
+ *
+ * clock->lock must be locked
+ */
+static void schedule(kclock_t *clock) {
+	clock->running = -1;
+	if (clock->entered < clock->expected) return;
+	
+	int next = -1;
+	for (int i = 0; i < KCLOCK_MAX_THREADS && next < 0; ++i) {
+		if (clock->threads[i].state == THREAD_RUNNABLE) next = i;
+	}
+	if (next < 0) {
+		for (int i = 0; i < KCLOCK_MAX_THREADS; ++i) {
+			struct vthread *th = clock->threads+i;
+			if (th->state == THREAD_SLEEPING
+				&& (next < 0 || th->deadline < clock->threads[next].deadline))
+				next = i;
+		}
+		if (next < 0) return; // every thread is waiting or done
+		if (clock->threads[next].deadline > atomic_load(&clock->now))
+			atomic_store(&clock->now, clock->threads[next].deadline);
+		clock->threads[next].state = THREAD_RUNNABLE;
+	}
+	clock->running = next;
+	pthread_cond_signal(&clock->threads[next].resume);
+}
+
+/**
+ * Put the calling thread in the given state,
+ * and wait until it can run again
+ *
+ * clock->lock must be locked
+ */
+static void block(kclock_t *clock, int state) {
+	clock->threads[thread_id].state = state;
+	schedule(clock);
+	while (clock->running != thread_id) {
+		pthread_cond_wait(&clock->threads[thread_id].resume, &clock->lock);
+	}
+}
+
+void kclock_expect(kclock_t *clock, int count) {
+	pthread_mutex_lock(&clock->lock);
+	clock->expected = count;
+	pthread_mutex_unlock(&clock->lock);
+}
+
+void kclock_enter(kclock_t *clock, int id) {
+	thread_id = id;
+	if (!clock->virtual) return;
+	
+	pthread_mutex_lock(&clock->lock);
+	++clock->entered;
+	// the first runnable thread starts
+	// once every thread has entered
+	block(clock, THREAD_RUNNABLE);
+	pthread_mutex_unlock(&clock->lock);
+}
+
+void kclock_leave(kclock_t *clock) {
+	if (!clock->virtual) return;
+	
+	pthread_mutex_lock(&clock->lock);
+	clock->threads[thread_id].state = THREAD_DONE;
+	schedule(clock);
+	pthread_mutex_unlock(&clock->lock);
+}
+
+long kclock_now(kclock_t *clock) {
+	if (clock->virtual) return atomic_load(&clock->now);
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000L+now.tv_nsec/1000;
+}
+
+/**
+ * Count a wake up of the calling thread
+ */
+static void count_wakeup(kclock_t *clock) {
+	if (thread_id >= 0) atomic_fetch_add(&clock->wakeups[thread_id], 1);
+}
+
+void kclock_sleep_until(kclock_t *clock, long time) {
+	if (clock->virtual) {
+		pthread_mutex_lock(&clock->lock);
+		clock->threads[thread_id].deadline = time;
+		block(clock, THREAD_SLEEPING);
+		pthread_mutex_unlock(&clock->lock);
+	} else {
+		struct timespec ts = {
+			.tv_sec = time/1000000,
+			.tv_nsec = time%1000000*1000,
+		};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+	}
+	count_wakeup(clock);
+}
+
+void kclock_sleep(kclock_t *clock, long us) {
+	kclock_sleep_until(clock, kclock_now(clock)+us);
+}
+
+void kclock_wait(kclock_t *clock, atomic_int *word, int val) {
+	if (clock->virtual) {
+		// the value is checked under the lock taken by
+		// kclock_wake, so no wake up is missed
+		pthread_mutex_lock(&clock->lock);
+		if (atomic_load(word) != val) {
+			pthread_mutex_unlock(&clock->lock);
+			return;
+		}
+		clock->threads[thread_id].wait_on = word;
+		block(clock, THREAD_WAITING);
+		pthread_mutex_unlock(&clock->lock);
+	} else {
+		futex_wait(word, val);
+	}
+	count_wakeup(clock);
+}
+
+void kclock_wake(kclock_t *clock, atomic_int *word) {
+	if (!clock->virtual) {
+		futex_wake(word, INT_MAX);
+		return;
+	}
+	
+	pthread_mutex_lock(&clock->lock);
+	for (int i = 0; i < KCLOCK_MAX_THREADS; ++i) {
+		struct vthread *th = clock->threads+i;
+		if (th->state == THREAD_WAITING && th->wait_on == word) {
+			th->state = THREAD_RUNNABLE;
+			th->wait_on = NULL;
+		}
+	}
+	// the wake up may come from a thread that does
+	// not use the clock while every thread is waiting
+	if (clock->running < 0) schedule(clock);
+	pthread_mutex_unlock(&clock->lock);
+}
+
+void kclock_get_stats(kclock_t *clock, kclock_stats_t *stats) {
+	stats->now = kclock_now(clock);
+	for (int i = 0; i < KCLOCK_MAX_THREADS; ++i) {
+		stats->wakeups[i] = atomic_load(&clock->wakeups[i]);
+	}
+}
+
+void kclock_clean(kclock_t *clock) {
+	for (int i = 0; i < KCLOCK_MAX_THREADS; ++i) {
+		pthread_cond_destroy(&clock->threads[i].resume);
+	}
+	pthread_mutex_destroy(&clock->lock);
+	free(clock);
+}
@@ -0,0 +1,104 @@
+#ifndef __CLOCK_H__
+#define __CLOCK_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+// max number of threads using a clock
+#define KCLOCK_MAX_THREADS 8
+
+typedef struct kclock kclock_t;
+
+struct kclock_stats {
+	// current time of the clock in microseconds
+	long now;
+	// number of times each thread woke up
+	// from kclock_sleep or kclock_wait
+	unsigned long wakeups[KCLOCK_MAX_THREADS];
+};
+typedef struct kclock_stats kclock_stats_t;
+
+/**
+ * Init a clock that follows CLOCK_MONOTONIC
+ */
+kclock_t *kclock_init_real();
+
+/**
+ * Init a virtual clock starting at 0
+ *
+ * Threads using a virtual clock run one at a time,
+ * and the time only advances when all of them
+ * are sleeping or waiting, directly to the next
+ * wake up time, so a simulation is deterministic
+ * and does not take real time
+ */
+kclock_t *kclock_init_virtual();
+
+/**
+ * Return true if the clock is virtual
+ */
+bool kclock_is_virtual(kclock_t *clock);
+
+/**
+ * Set the number of threads that will call kclock_enter,
+ * a virtual clock starts when all of them have entered
+ *
+ * Should be called before creating the threads
+ */
+void kclock_expect(kclock_t *clock, int count);
+
+/**
+ * Register the calling thread
+ *
+ * id: unique index of the thread, lower than KCLOCK_MAX_THREADS
+ *     with a virtual clock, runnable threads run
+ *     in the order of their ids
+ */
+void kclock_enter(kclock_t *clock, int id);
+
+/**
+ * Unregister the calling thread
+ */
+void kclock_leave(kclock_t *clock);
+
+/**
+ * Return the current time in microseconds
+ */
+long kclock_now(kclock_t *clock);
+
+/**
+ * Sleep for us microseconds
+ */
+void kclock_sleep(kclock_t *clock, long us);
+
+/**
+ * Sleep until the clock reaches time (in microseconds)
+ */
+void kclock_sleep_until(kclock_t *clock, long time);
+
+/**
+ * Wait until *word is no longer equal to val
+ * and kclock_wake is called on word
+ * Return immediately if *word is not equal to val,
+ * and may return spuriously
+ */
+void kclock_wait(kclock_t *clock, atomic_int *word, int val);
+
+/**
+ * Restart all the threads waiting on word,
+ * word should be modified before
+ */
+void kclock_wake(kclock_t *clock, atomic_int *word);
+
+/**
+ * Write the statistics of the clock in stats
+ */
+void kclock_get_stats(kclock_t *clock, kclock_stats_t *stats);
+
+/**
+ * Clean the clock
+ */
+void kclock_clean(kclock_t *clock);
+
+#endif // !__CLOCK_H__
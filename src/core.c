@@ -0,0 +1,473 @@
+/*
+ * This file is responsible for the edge logic of kerpad
+ * as a pure state machine: touchpad frames in, mouse events out
+ *
+ * Nothing here locks, allocates, reads the time or does
+ * a system call, the memory is given by the caller
+ * and the time comes with the events
+ * It is built as libkerpad.a, the daemon only adds the I/O
+ */
+
+#include <stdlib.h>
+
+#include "core.h"
+
+#define EVENT_TIME_MILLI(event) ((event).input_event_sec*1000L \
+								 +(event).input_event_usec/1000)
+
+#define TOUCH_CODE BTN_TOUCH
+#define PRESS_CODE BTN_MOUSE
+
+static void reset_frame(struct core_frame *frame) {
+	frame->x = -1;
+	frame->y = -1;
+	frame->touched = -1;
+	frame->pressed = -1;
+}
+
+void core_touchpad_init(struct core_touchpad *touchpad) {
+	*touchpad = (struct core_touchpad) {};
+	reset_frame(&touchpad->frame);
+}
+
+int core_touchpad_event(struct core_touchpad *touchpad, const struct input_event *event,
+						bool stale) {
+	struct core_frame *frame = &touchpad->frame;
+	if (event->type == EV_SYN) {
+		if (event->code == SYN_DROPPED) {
+			touchpad->dropped = true;
+		} else if (event->code == SYN_REPORT) {
+			if (touchpad->dropped) {
+				touchpad->dropped = false;
+				return CORE_FRAME_RESYNC;
+			} else if (stale && frame->touched < 0 && frame->pressed < 0) {
+				// the listener is behind, a frame that only
+				// moves is merged with the next one
+				return CORE_FRAME_PENDING;
+			}
+			return CORE_FRAME_READY;
+		}
+	} else if (touchpad->dropped) {
+		// the state will be read at the next SYN_REPORT
+		return CORE_FRAME_PENDING;
+	} else if (event->type == EV_KEY) {
+		switch (event->code) {
+		case TOUCH_CODE: // touched
+			frame->touched = event->value;
+			if (event->value) frame->touch_time = EVENT_TIME_MILLI(*event);
+			break;
+		case PRESS_CODE: // pressed
+			frame->pressed = event->value;
+			break;
+		}
+	} else if (event->type == EV_ABS) {
+		// moved
+		switch (event->code) {
+		case ABS_X:
+			frame->x = event->value;
+			break;
+		case ABS_Y:
+			frame->y = event->value;
+			break;
+		}
+	}
+	return CORE_FRAME_PENDING;
+}
+
+void core_touchpad_resync(struct core_touchpad *touchpad, int x, int y,
+						  bool touched, bool pressed, unsigned long now) {
+	struct core_frame *frame = &touchpad->frame;
+	reset_frame(frame);
+	frame->x = x;
+	frame->y = y;
+	// the finger may have been lifted and put elsewhere
+	// while the events were dropped, its motion starts again
+	// from this position rather than jumping to it
+	touchpad->anchored_x = false;
+	touchpad->anchored_y = false;
+	
+	// only changes are applied, to not detect
+	// a new touch or press that did not occur
+	// touches beyond the edge limits only set edge_touched
+	if (touched != (touchpad->touched || touchpad->edge_touched)) {
+		frame->touched = touched;
+		frame->touch_time = now;
+	}
+	if (pressed != touchpad->pressed) frame->pressed = pressed;
+}
+
+/**
+ * Return false if the touchpad coordinates are
+ * beyond the edge limits
+ */
+static bool dont_touch_borders(const struct core_touchpad *touchpad,
+							   const struct core_limits *limits) {
+	return touchpad->x >= limits->minx
+		&& touchpad->x <= limits->maxx
+		&& touchpad->y >= limits->miny
+		&& touchpad->y <= limits->maxy;
+}
+
+/**
+ * Apply the current frame to the state of the touchpad,
+ * as core_touchpad_apply
+ * The variants give no_edge_protection as a literal
+ */
+static inline int apply_frame(struct core_touchpad *touchpad,
+							  const struct core_limits *limits,
+							  bool no_edge_protection) {
+	int detected = 0;
+	struct core_frame *frame = &touchpad->frame;
+	// the finger moves if it stays on the touchpad, from a
+	// position given after it touched it, the position of the
+	// previous touch may come before the one of the new touch
+	bool moving = frame->touched < 0 && (touchpad->touched || touchpad->edge_touched);
+	if (frame->touched >= 0) {
+		touchpad->anchored_x = false;
+		touchpad->anchored_y = false;
+	}
+	if (frame->x >= 0) {
+		if (moving && touchpad->anchored_x) touchpad->motion_x += frame->x-touchpad->x;
+		touchpad->x = frame->x;
+		touchpad->anchored_x = true;
+		if (frame->x <= limits->minx) touchpad->edgex = -1;
+		else if (frame->x >= limits->maxx) touchpad->edgex = 1;
+		else touchpad->edgex = 0;
+	}
+	if (frame->y >= 0) {
+		if (moving && touchpad->anchored_y) touchpad->motion_y += frame->y-touchpad->y;
+		touchpad->y = frame->y;
+		touchpad->anchored_y = true;
+		if (frame->y <= limits->miny) touchpad->edgey = -1;
+		else if (frame->y >= limits->maxy) touchpad->edgey = 1;
+		else touchpad->edgey = 0;
+	}
+	
+	bool inside = dont_touch_borders(touchpad, limits);
+	if (frame->touched == 0) {
+		touchpad->touched = false;
+		touchpad->double_tapped = false;
+		touchpad->edge_touched = false;
+	} else if (frame->touched > 0) {
+		if (no_edge_protection || inside) {
+			touchpad->touched = true;
+			detected |= CORE_TOUCH;
+			if (frame->touch_time-touchpad->last_touch_time < CORE_DOUBLE_TAP_TIME) {
+				touchpad->double_tapped = true;
+				detected |= CORE_DOUBLE_TAP;
+			}
+			touchpad->last_touch_time = frame->touch_time;
+		}
+		if (!inside) {
+			touchpad->edge_touched = true;
+			detected |= CORE_EDGE_TOUCH;
+		}
+	}
+	
+	if (frame->pressed == 0) {
+		touchpad->pressed = false;
+	} else if (frame->pressed > 0) {
+		if (no_edge_protection || inside) {
+			touchpad->pressed = true;
+			detected |= CORE_PRESS;
+		}
+	}
+	
+	reset_frame(frame);
+	return detected;
+}
+
+#define OPT_EDGE_MOTION        1
+#define OPT_MOVE_TOUCHED       2
+#define OPT_DOUBLE_TAP         4
+#define OPT_EDGE_SCROLLING     8
+#define OPT_NO_EDGE_PROTECTION 16
+#define N_VARIANTS             32
+
+#define VARIANT_PASTE(name, opts) VARIANT_PASTE_(name, opts)
+#define VARIANT_PASTE_(name, opts) name##_##opts
+
+#define VARIANT_OPTS 0
+#include "core_variant.h"
+#define VARIANT_OPTS 1
+#include "core_variant.h"
+#define VARIANT_OPTS 2
+#include "core_variant.h"
+#define VARIANT_OPTS 3
+#include "core_variant.h"
+#define VARIANT_OPTS 4
+#include "core_variant.h"
+#define VARIANT_OPTS 5
+#include "core_variant.h"
+#define VARIANT_OPTS 6
+#include "core_variant.h"
+#define VARIANT_OPTS 7
+#include "core_variant.h"
+#define VARIANT_OPTS 8
+#include "core_variant.h"
+#define VARIANT_OPTS 9
+#include "core_variant.h"
+#define VARIANT_OPTS 10
+#include "core_variant.h"
+#define VARIANT_OPTS 11
+#include "core_variant.h"
+#define VARIANT_OPTS 12
+#include "core_variant.h"
+#define VARIANT_OPTS 13
+#include "core_variant.h"
+#define VARIANT_OPTS 14
+#include "core_variant.h"
+#define VARIANT_OPTS 15
+#include "core_variant.h"
+#define VARIANT_OPTS 16
+#include "core_variant.h"
+#define VARIANT_OPTS 17
+#include "core_variant.h"
+#define VARIANT_OPTS 18
+#include "core_variant.h"
+#define VARIANT_OPTS 19
+#include "core_variant.h"
+#define VARIANT_OPTS 20
+#include "core_variant.h"
+#define VARIANT_OPTS 21
+#include "core_variant.h"
+#define VARIANT_OPTS 22
+#include "core_variant.h"
+#define VARIANT_OPTS 23
+#include "core_variant.h"
+#define VARIANT_OPTS 24
+#include "core_variant.h"
+#define VARIANT_OPTS 25
+#include "core_variant.h"
+#define VARIANT_OPTS 26
+#include "core_variant.h"
+#define VARIANT_OPTS 27
+#include "core_variant.h"
+#define VARIANT_OPTS 28
+#include "core_variant.h"
+#define VARIANT_OPTS 29
+#include "core_variant.h"
+#define VARIANT_OPTS 30
+#include "core_variant.h"
+#define VARIANT_OPTS 31
+#include "core_variant.h"
+
+// apply only depends on OPT_NO_EDGE_PROTECTION, and
+// motion_active on OPT_MOVE_TOUCHED and OPT_DOUBLE_TAP
+static const core_apply_fn apply_variants[] = {
+	[0] = apply_0,
+	[OPT_NO_EDGE_PROTECTION] = apply_16,
+};
+static const core_motion_active_fn motion_active_variants[] = {
+	[0] = motion_active_0,
+	[OPT_MOVE_TOUCHED] = motion_active_2,
+	[OPT_DOUBLE_TAP] = motion_active_4,
+	[OPT_MOVE_TOUCHED|OPT_DOUBLE_TAP] = motion_active_6,
+};
+static const core_feed_fn feed_variants[N_VARIANTS] = {
+	feed_0, feed_1, feed_2, feed_3, feed_4, feed_5, feed_6, feed_7,
+	feed_8, feed_9, feed_10, feed_11, feed_12, feed_13, feed_14, feed_15,
+	feed_16, feed_17, feed_18, feed_19, feed_20, feed_21, feed_22, feed_23,
+	feed_24, feed_25, feed_26, feed_27, feed_28, feed_29, feed_30, feed_31,
+};
+
+/**
+ * Return the combination of OPT_* flags
+ * that select the variant of the settings
+ */
+static int variant_options(const core_settings_t *settings) {
+	int opts = 0;
+	if (settings->edge_motion) opts |= OPT_EDGE_MOTION;
+	if (settings->move_touched) opts |= OPT_MOVE_TOUCHED;
+	if (!settings->disable_double_tap) opts |= OPT_DOUBLE_TAP;
+	if (settings->edge_scrolling) opts |= OPT_EDGE_SCROLLING;
+	if (settings->limits.no_edge_protection) opts |= OPT_NO_EDGE_PROTECTION;
+	return opts;
+}
+
+core_apply_fn core_select_apply(const struct core_limits *limits) {
+	return apply_variants[limits->no_edge_protection? OPT_NO_EDGE_PROTECTION: 0];
+}
+
+core_motion_active_fn core_select_motion_active(const core_settings_t *settings) {
+	return motion_active_variants[variant_options(settings)
+								  &(OPT_MOVE_TOUCHED|OPT_DOUBLE_TAP)];
+}
+
+int core_touchpad_apply(struct core_touchpad *touchpad, const struct core_limits *limits) {
+	return apply_frame(touchpad, limits, limits->no_edge_protection);
+}
+
+bool core_motion_active(const core_settings_t *settings, const struct core_touchpad *touchpad) {
+	return touchpad->pressed
+		|| (!settings->disable_double_tap && touchpad->double_tapped)
+		|| (settings->move_touched && touchpad->touched);
+}
+
+long core_motion_time(const core_settings_t *settings, int edgex, int edgey) {
+	// sqrt(2) times longer in a corner
+	return (!edgex || !edgey)? settings->sleep_time: settings->sleep_time*1414/1000;
+}
+
+int core_motion_step(const core_settings_t *settings, int edgex, int edgey,
+					 long elapsed, long *carry) {
+	if (!edgex && !edgey) {
+		*carry = 0;
+		return 0;
+	}
+	long time = core_motion_time(settings, edgex, edgey);
+	*carry += settings->speed*elapsed;
+	int step = *carry/time;
+	*carry %= time;
+	return step;
+}
+
+void core_scroll_reset(struct core_scroll *scroll) {
+	scroll->last_x = -1;
+	scroll->last_y = -1;
+}
+
+void core_scroll_step(const core_settings_t *settings, struct core_scroll *scroll,
+					  const struct core_touchpad *touchpad, int device,
+					  int *wheel, int *hwheel) {
+	*wheel = 0;
+	*hwheel = 0;
+	if (device != scroll->last_device) {
+		// another touchpad is used
+		core_scroll_reset(scroll);
+		scroll->last_device = device;
+	}
+	if (scroll->last_x < 0) scroll->last_x = touchpad->x;
+	if (scroll->last_y < 0) scroll->last_y = touchpad->y;
+	
+	if ((settings->left_scrolling && touchpad->edgex < 0)
+		|| (settings->right_scrolling && touchpad->edgex > 0)) {
+		*wheel = (touchpad->y-scroll->last_y)*120/settings->scroll_div;
+	} else if ((settings->top_scrolling && touchpad->edgey < 0)
+			   || (settings->bottom_scrolling && touchpad->edgey > 0)) {
+		*hwheel = -(touchpad->x-scroll->last_x)*120/settings->scroll_div;
+	}
+	
+	scroll->last_x = touchpad->x;
+	scroll->last_y = touchpad->y;
+}
+
+void core_momentum_stop(struct core_momentum *momentum) {
+	*momentum = (struct core_momentum) {};
+}
+
+bool core_momentum_start(const core_settings_t *settings, struct core_momentum *momentum,
+						 const struct core_sample *samples, int count, long now) {
+	core_momentum_stop(momentum);
+	
+	// last frame at the edge, it must be
+	// recent to not scroll after a pause
+	int last = count-1;
+	while (last >= 0 && !samples[last].edge_touched) --last;
+	if (last < 0 || now-samples[last].time > CORE_MOMENTUM_WINDOW) return false;
+	const struct core_sample *end = samples+last;
+	
+	int first = last;
+	while (first > 0 && samples[first-1].edge_touched
+		   && end->time-samples[first-1].time <= CORE_MOMENTUM_WINDOW) --first;
+	const struct core_sample *begin = samples+first;
+	long elapsed = end->time-begin->time;
+	if (elapsed <= 0) return false;
+	
+	// same scale as core_scroll_step
+	if ((settings->left_scrolling && end->edgex < 0)
+		|| (settings->right_scrolling && end->edgex > 0)) {
+		momentum->wheel_speed = (end->y-begin->y)*120L*1000000
+			/settings->scroll_div/elapsed;
+	} else if ((settings->top_scrolling && end->edgey < 0)
+			   || (settings->bottom_scrolling && end->edgey > 0)) {
+		momentum->hwheel_speed = -(end->x-begin->x)*120L*1000000
+			/settings->scroll_div/elapsed;
+	}
+	if (labs(momentum->wheel_speed) < CORE_MOMENTUM_MIN_SPEED
+		&& labs(momentum->hwheel_speed) < CORE_MOMENTUM_MIN_SPEED) {
+		core_momentum_stop(momentum);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Scroll of speed during elapsed microseconds,
+ * and slow speed down
+ *
+ * Return the scrolled hi-res units
+ */
+static int momentum_axis(const core_settings_t *settings, long *speed, long *carry,
+						 long elapsed) {
+	*carry += *speed*elapsed;
+	int units = *carry/1000000;
+	*carry %= 1000000;
+	// exponential decay, one step of a first order filter
+	*speed = *speed*settings->momentum/(settings->momentum+elapsed);
+	if (labs(*speed) < CORE_MOMENTUM_MIN_SPEED) {
+		*speed = 0;
+		*carry = 0;
+	}
+	return units;
+}
+
+bool core_momentum_step(const core_settings_t *settings, struct core_momentum *momentum,
+						long elapsed, int *wheel, int *hwheel) {
+	*wheel = momentum_axis(settings, &momentum->wheel_speed, &momentum->wheel_carry, elapsed);
+	*hwheel = momentum_axis(settings, &momentum->hwheel_speed, &momentum->hwheel_carry,
+							elapsed);
+	return momentum->wheel_speed || momentum->hwheel_speed;
+}
+
+void core_init(core_t *core, const core_settings_t *settings) {
+	core->settings = *settings;
+	core_touchpad_init(&core->touchpad);
+	core->next_motion = -1;
+	core->carry = 0;
+	core->next_scroll = -1;
+	core->scroll.last_device = 0;
+	core_scroll_reset(&core->scroll);
+	core->feed = feed_variants[variant_options(settings)];
+}
+
+static void add_event(struct input_event *out, int *count, int type, int code, int value) {
+	out[(*count)++] = (struct input_event) {
+		.type = type,
+		.code = code,
+		.value = value,
+	};
+}
+
+int core_feed(core_t *core, const struct input_event *events, int count,
+			  long now, struct input_event *out) {
+	return core->feed(core, events, count, now, out);
+}
+
+int core_run(core_t *core, long now, struct input_event *out) {
+	int count = 0;
+	struct core_touchpad *tp = &core->touchpad;
+	if (core->next_motion >= 0 && core->next_motion <= now) {
+		// one step per tick, as the daemon
+		long time = core_motion_time(&core->settings, tp->edgex, tp->edgey);
+		int step = core_motion_step(&core->settings, tp->edgex, tp->edgey, time, &core->carry);
+		if (step && tp->edgex) add_event(out, &count, EV_REL, REL_X, tp->edgex*step);
+		if (step && tp->edgey) add_event(out, &count, EV_REL, REL_Y, tp->edgey*step);
+		core->next_motion = now+time;
+	}
+	if (core->next_scroll >= 0 && core->next_scroll <= now) {
+		int wheel, hwheel;
+		core_scroll_step(&core->settings, &core->scroll, tp, 0, &wheel, &hwheel);
+		if (wheel) add_event(out, &count, EV_REL, REL_WHEEL_HI_RES, wheel);
+		if (hwheel) add_event(out, &count, EV_REL, REL_HWHEEL_HI_RES, hwheel);
+		core->next_scroll = now+core->settings.scroll_sleep_time;
+	}
+	if (count) add_event(out, &count, EV_SYN, SYN_REPORT, 0);
+	return count;
+}
+
+long core_deadline(core_t *core) {
+	if (core->next_motion < 0) return core->next_scroll;
+	if (core->next_scroll < 0) return core->next_motion;
+	return core->next_motion < core->next_scroll? core->next_motion: core->next_scroll;
+}
@@ -0,0 +1,349 @@
+#ifndef __CORE_H__
+#define __CORE_H__
+
+#include <stdbool.h>
+#include <linux/input.h>
+
+// delay max between to touch
+// to be a double tap, in milliseconds
+#define CORE_DOUBLE_TAP_TIME 250
+
+// events detected by core_touchpad_apply
+// touched within the edge limits
+#define CORE_TOUCH      1
+// double tapped within the edge limits
+#define CORE_DOUBLE_TAP 2
+// pressed within the edge limits
+#define CORE_PRESS      4
+// touched beyond the edge limits
+#define CORE_EDGE_TOUCH 8
+
+// results of core_touchpad_event
+// the frame is not complete
+#define CORE_FRAME_PENDING 0
+// the frame is complete and can be applied
+#define CORE_FRAME_READY   1
+// the frame is complete but events were dropped,
+// the state of the device should be given to
+// core_touchpad_resync before applying it
+#define CORE_FRAME_RESYNC  2
+
+// max number of events written by one call to core_run
+#define CORE_MAX_OUTPUT 4
+
+// the release velocity of the momentum is measured
+// on this duration before the finger left the edge,
+// in microseconds
+#define CORE_MOMENTUM_WINDOW 100000
+// time between two momentum steps, in microseconds
+#define CORE_MOMENTUM_TICK 16000
+// the momentum stops below this speed,
+// in hi-res units per second
+#define CORE_MOMENTUM_MIN_SPEED 120
+
+// events of the frame being read
+struct core_frame {
+	// values are ignored if < 0
+	int x;
+	int y;
+	int touched;
+	int pressed;
+	// time of the touch in milliseconds
+	unsigned long touch_time;
+};
+
+// edge limits of a touchpad
+struct core_limits {
+	int minx;
+	int maxx;
+	int miny;
+	int maxy;
+	// if true, touches and presses beyond
+	// the limits are not ignored
+	bool no_edge_protection;
+};
+
+// state of a touchpad
+struct core_touchpad {
+	int x;
+	int y;
+	// -1: touching the left edge
+	//  1: touching the right edge
+	int edgex;
+	// -1: touching the top edge
+	//  1: touching the bottom edge
+	int edgey;
+	// touched within the limits
+	bool touched;
+	// touched beyond the limits
+	bool edge_touched;
+	// pressed within the limits
+	bool pressed;
+	// double tapped within the limits
+	bool double_tapped;
+	
+	// time of the last touch in milliseconds
+	unsigned long last_touch_time;
+	struct core_frame frame;
+	// true after a SYN_DROPPED, events are
+	// ignored until the next SYN_REPORT
+	bool dropped;
+	
+	// distance moved by the finger in the applied
+	// frames, to be reset by the user
+	int motion_x;
+	int motion_y;
+	// true if x (or y) was given since the finger touched the
+	// touchpad, or since a resync, the motion is counted from it
+	bool anchored_x;
+	bool anchored_y;
+};
+
+struct core_settings {
+	struct core_limits limits;
+	
+	bool edge_motion;
+	// if true, edge motion works while touching,
+	// else only while pressing or double tapping
+	bool move_touched;
+	bool disable_double_tap;
+	// time to move of speed pixels, in microseconds
+	long sleep_time;
+	int speed;
+	
+	bool edge_scrolling;
+	bool left_scrolling;
+	bool right_scrolling;
+	bool top_scrolling;
+	bool bottom_scrolling;
+	// the scrolled distance is divided by this value
+	int scroll_div;
+	// time between two scroll steps, in microseconds
+	long scroll_sleep_time;
+	// time constant of the decay of the scrolling
+	// after the finger left the edge, in microseconds,
+	// 0 to stop the scrolling with the finger
+	long momentum;
+};
+typedef struct core_settings core_settings_t;
+
+// state of a touchpad after a frame,
+// kept in a history of the recent frames
+struct core_sample {
+	// time of the frame in microseconds
+	long time;
+	int x;
+	int y;
+	int edgex;
+	int edgey;
+	bool touched;
+	bool edge_touched;
+	bool pressed;
+};
+
+// scrolling that continues after
+// the finger left the edge
+struct core_momentum {
+	// hi-res units per second, 0 if stopped
+	long wheel_speed;
+	long hwheel_speed;
+	// fraction of unit not scrolled yet,
+	// in units times microseconds
+	long wheel_carry;
+	long hwheel_carry;
+};
+
+// position of the finger at the previous scroll step
+struct core_scroll {
+	int last_x;
+	int last_y;
+	int last_device;
+};
+
+// the whole edge logic of one touchpad
+struct core {
+	core_settings_t settings;
+	struct core_touchpad touchpad;
+	
+	// time of the next motion step in microseconds,
+	// -1 if the edge motion is not active
+	long next_motion;
+	// fraction of pixel not moved yet
+	long carry;
+	
+	// time of the next scroll step in microseconds,
+	// -1 if the edge scrolling is not active
+	long next_scroll;
+	struct core_scroll scroll;
+	
+	// variant of core_feed specialized for the settings
+	int (*feed)(struct core *core, const struct input_event *events, int count,
+				long now, struct input_event *out);
+};
+typedef struct core core_t;
+
+// signatures of the functions that have
+// variants specialized for the options
+typedef int (*core_apply_fn)(struct core_touchpad *touchpad, const struct core_limits *limits);
+typedef bool (*core_motion_active_fn)(const core_settings_t *settings,
+									  const struct core_touchpad *touchpad);
+typedef int (*core_feed_fn)(core_t *core, const struct input_event *events, int count,
+							long now, struct input_event *out);
+
+/**
+ * Init the state of a touchpad, with no finger on it
+ */
+void core_touchpad_init(struct core_touchpad *touchpad);
+
+/**
+ * Add an event of the touchpad to the current frame
+ *
+ * stale: true if a more recent complete frame is known,
+ *        a stale frame that only moves is merged with the next one
+ *
+ * Return CORE_FRAME_PENDING, CORE_FRAME_READY or CORE_FRAME_RESYNC
+ */
+int core_touchpad_event(struct core_touchpad *touchpad, const struct input_event *event,
+						bool stale);
+
+/**
+ * Replace the current frame by the differences between
+ * the known state and the real state of the device,
+ * after events were dropped
+ *
+ * now: current time in milliseconds
+ */
+void core_touchpad_resync(struct core_touchpad *touchpad, int x, int y,
+						  bool touched, bool pressed, unsigned long now);
+
+/**
+ * Apply the current frame to the state of the touchpad
+ *
+ * Return the detected events, a combination of
+ * CORE_TOUCH, CORE_DOUBLE_TAP, CORE_PRESS and CORE_EDGE_TOUCH
+ * The options are tested at each frame, the variant of
+ * core_select_apply gives the same result
+ */
+int core_touchpad_apply(struct core_touchpad *touchpad, const struct core_limits *limits);
+
+/**
+ * Return the variant of core_touchpad_apply specialized for the limits,
+ * to be selected once rather than testing the options at each frame
+ */
+core_apply_fn core_select_apply(const struct core_limits *limits);
+
+/**
+ * Return true if the edge motion is active
+ * The options are tested at each call, the variant of
+ * core_select_motion_active gives the same result
+ */
+bool core_motion_active(const core_settings_t *settings, const struct core_touchpad *touchpad);
+
+/**
+ * Return the variant of core_motion_active specialized for the settings,
+ * to be selected once rather than testing the options at each call
+ */
+core_motion_active_fn core_select_motion_active(const core_settings_t *settings);
+
+/**
+ * Return the time the cursor takes to move of speed
+ * pixels on each axis, longer in a corner
+ */
+long core_motion_time(const core_settings_t *settings, int edgex, int edgey);
+
+/**
+ * Return the number of pixels to move on each axis
+ * after elapsed microseconds at the edge
+ *
+ * carry: fraction of pixel not moved yet,
+ *        should be 0 when the motion starts
+ */
+int core_motion_step(const core_settings_t *settings, int edgex, int edgey,
+					 long elapsed, long *carry);
+
+/**
+ * Forget the previous position of the finger
+ */
+void core_scroll_reset(struct core_scroll *scroll);
+
+/**
+ * Compute the scroll of the distance moved at
+ * the edge since the previous step
+ *
+ * device: index of the touchpad, the position
+ *         is forgotten when it changes
+ * wheel, hwheel: hi-res vertical and horizontal scroll
+ */
+void core_scroll_step(const core_settings_t *settings, struct core_scroll *scroll,
+					  const struct core_touchpad *touchpad, int device,
+					  int *wheel, int *hwheel);
+
+/**
+ * Start the momentum with the release velocity of the finger
+ * The momentum is stopped if the finger did not
+ * scroll just before leaving the edge
+ *
+ * samples: count recent states of the touchpad, the oldest first
+ * now: current time in microseconds
+ *
+ * Return true if the momentum started
+ */
+bool core_momentum_start(const core_settings_t *settings, struct core_momentum *momentum,
+						 const struct core_sample *samples, int count, long now);
+
+/**
+ * Compute the scroll of the momentum after elapsed
+ * microseconds, and slow it down
+ *
+ * wheel, hwheel: hi-res vertical and horizontal scroll
+ *
+ * Return false once the momentum is stopped
+ */
+bool core_momentum_step(const core_settings_t *settings, struct core_momentum *momentum,
+						long elapsed, int *wheel, int *hwheel);
+
+/**
+ * Stop the momentum
+ */
+void core_momentum_stop(struct core_momentum *momentum);
+
+/**
+ * Init the edge logic of a touchpad
+ *
+ * The settings are copied, and the variant of core_feed
+ * specialized for them is selected
+ */
+void core_init(core_t *core, const core_settings_t *settings);
+
+/**
+ * Handle count events of the touchpad and run the steps
+ * that are due, the output events are written in out
+ *
+ * As the device cannot be read, the state is
+ * kept after events were dropped
+ *
+ * now: current time in microseconds
+ * out: room for at least CORE_MAX_OUTPUT events
+ *
+ * Return the number of output events
+ */
+int core_feed(core_t *core, const struct input_event *events, int count,
+			  long now, struct input_event *out);
+
+/**
+ * Run the steps that are due, the output events are written in out
+ *
+ * now: current time in microseconds
+ * out: room for at least CORE_MAX_OUTPUT events
+ *
+ * Return the number of output events
+ */
+int core_run(core_t *core, long now, struct input_event *out);
+
+/**
+ * Return the time of the next step in microseconds,
+ * -1 if nothing happens until the next events
+ */
+long core_deadline(core_t *core);
+
+#endif // !__CORE_H__
@@ -0,0 +1,90 @@
+/*
+ * Per-frame path of the edge logic, specialized for
+ * one combination of options
+ *
+ * This file is included by core.c once per variant, with
+ * VARIANT_OPTS defined as a literal combination of the
+ * OPT_* flags, so the tests of the options are folded
+ * by the compiler, even without optimizations
+ * It defines feed_N, where N is VARIANT_OPTS, and apply_N and
+ * motion_active_N only for the combinations of the options they
+ * test, the feed_N use the ones of their options, defined before
+ * apply_N gives its option as a literal to apply_frame, the body
+ * it shares with core_touchpad_apply, the test is folded where
+ * the compiler inlines it
+ */
+
+#define VARIANT_NAME(name) VARIANT_PASTE(name, VARIANT_OPTS)
+
+#if !(VARIANT_OPTS&OPT_NO_EDGE_PROTECTION)
+#define VARIANT_APPLY apply_0
+#else
+#define VARIANT_APPLY apply_16
+#endif
+
+#if !(VARIANT_OPTS&(OPT_MOVE_TOUCHED|OPT_DOUBLE_TAP))
+#define VARIANT_MOTION_ACTIVE motion_active_0
+#elif !(VARIANT_OPTS&OPT_DOUBLE_TAP)
+#define VARIANT_MOTION_ACTIVE motion_active_2
+#elif !(VARIANT_OPTS&OPT_MOVE_TOUCHED)
+#define VARIANT_MOTION_ACTIVE motion_active_4
+#else
+#define VARIANT_MOTION_ACTIVE motion_active_6
+#endif
+
+#if !(VARIANT_OPTS&~OPT_NO_EDGE_PROTECTION)
+static int VARIANT_NAME(apply)(struct core_touchpad *touchpad,
+							   const struct core_limits *limits) {
+	return apply_frame(touchpad, limits, VARIANT_OPTS&OPT_NO_EDGE_PROTECTION);
+}
+#endif
+
+#if !(VARIANT_OPTS&~(OPT_MOVE_TOUCHED|OPT_DOUBLE_TAP))
+static bool VARIANT_NAME(motion_active)(const core_settings_t *settings,
+										const struct core_touchpad *touchpad) {
+	(void)settings;
+	return touchpad->pressed
+		|| ((VARIANT_OPTS&OPT_DOUBLE_TAP) && touchpad->double_tapped)
+		|| ((VARIANT_OPTS&OPT_MOVE_TOUCHED) && touchpad->touched);
+}
+#endif
+
+static int VARIANT_NAME(feed)(core_t *core, const struct input_event *events, int count,
+							  long now, struct input_event *out) {
+	// frames before the last complete one are stale
+	int last_report = -1;
+	for (int i = 0; i < count; ++i) {
+		if (events[i].type == EV_SYN && events[i].code == SYN_REPORT)
+			last_report = i;
+	}
+	for (int i = 0; i < count; ++i) {
+		int res = core_touchpad_event(&core->touchpad, events+i, i < last_report);
+		if (res != CORE_FRAME_PENDING)
+			VARIANT_APPLY(&core->touchpad, &core->settings.limits);
+	}
+	
+	// start or stop the steps according
+	// to the state of the touchpad
+	if (VARIANT_OPTS&OPT_EDGE_MOTION) {
+		if (!VARIANT_MOTION_ACTIVE(&core->settings, &core->touchpad)) {
+			core->next_motion = -1;
+			core->carry = 0;
+		} else if (core->next_motion < 0) {
+			core->next_motion = now;
+		}
+	}
+	if (VARIANT_OPTS&OPT_EDGE_SCROLLING) {
+		if (!core->touchpad.edge_touched) {
+			core->next_scroll = -1;
+			core_scroll_reset(&core->scroll);
+		} else if (core->next_scroll < 0) {
+			core->next_scroll = now;
+		}
+	}
+	return core_run(core, now, out);
+}
+
+#undef VARIANT_NAME
+#undef VARIANT_APPLY
+#undef VARIANT_MOTION_ACTIVE
+#undef VARIANT_OPTS
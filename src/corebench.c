@@ -0,0 +1,155 @@
+/*
+ * kerpad-corebench measures the edge logic of libkerpad alone:
+ * frames of simulated gestures are generated in memory first,
+ * then fed to the core as fast as possible
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "core.h"
+#include "gesture.h"
+#include "util.h"
+
+#define DEFAULT_FRAMES 10000000
+#define DEFAULT_RATE 125
+// number of different frames, fed in a loop
+#define GENERATED_FRAMES (1<<16)
+
+static struct option long_options[] = {
+	{"frames", required_argument, NULL, 'n'},
+	{"rate", required_argument, NULL, 'r'},
+	{"scenario", required_argument, NULL, 's'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0},
+};
+
+static void print_help(char *argv[]) {
+	printf("Usage: %s [options]\n", argv[0]);
+	printf("Measure the frames handled per second by the edge logic.\n\n");
+	printf("    -n, --frames=N        frames fed to the core (default: %d)\n",
+		   DEFAULT_FRAMES);
+	printf("    -r, --rate=RATE       frames per second of the gestures (default: %d)\n",
+		   DEFAULT_RATE);
+	printf("    -s, --scenario=NAME   edge-dwell, edge-scroll, double-tap or random\n");
+	printf("                          (default: random)\n");
+	printf("    -h, --help            display this help and exit\n");
+}
+
+static double now_seconds() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec+now.tv_nsec/1e9;
+}
+
+int main(int argc, char *argv[]) {
+	long n_frames = DEFAULT_FRAMES;
+	const char *scenario = "random";
+	gesture_settings_t gs = {
+		.minx = 0,
+		.maxx = GESTURE_DEFAULT_MAXX,
+		.miny = 0,
+		.maxy = GESTURE_DEFAULT_MAXY,
+		.rate = DEFAULT_RATE,
+		.loop = true,
+		.seed = 1,
+	};
+	
+	while (1) {
+		int opt = getopt_long(argc, argv, "n:r:s:h", long_options, NULL);
+		if (opt == -1) break;
+		
+		switch (opt) {
+		case 'n': n_frames = atol(optarg); break;
+		case 'r': gs.rate = atoi(optarg); break;
+		case 's': scenario = optarg; break;
+		case 'h':
+			print_help(argv);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv);
+			return EXIT_FAILURE;
+		}
+	}
+	if (n_frames <= 0 || gs.rate <= 0) {
+		error_message("invalid options");
+		return EXIT_FAILURE;
+	}
+	
+	char *script = NULL;
+	gs.random = !strcmp(scenario, "random");
+	if (!gs.random) {
+		script = gesture_scenario(scenario, &gs);
+		if (!script) {
+			error_message("unknown scenario: %s", scenario);
+			return EXIT_FAILURE;
+		}
+	}
+	gs.script = script;
+	gesture_t *gesture = gesture_init(&gs);
+	free(script);
+	if (!gesture) return EXIT_FAILURE;
+	
+	// frames are stored one after the other
+	struct input_event *events = malloc(GENERATED_FRAMES*GESTURE_FRAME_SIZE*sizeof(*events));
+	int *counts = malloc(GENERATED_FRAMES*sizeof(*counts));
+	long *times = malloc(GENERATED_FRAMES*sizeof(*times));
+	exitif(!events || !counts || !times, "cannot allocate the frames");
+	int n_events = 0;
+	for (int i = 0; i < GENERATED_FRAMES; ++i) {
+		counts[i] = gesture_next_frame(gesture, events+n_events);
+		times[i] = gesture_time(gesture);
+		n_events += counts[i];
+	}
+	long span = gesture_time(gesture)+1000000/gs.rate;
+	gesture_clean(gesture);
+	
+	core_settings_t settings = {
+		.limits = {
+			.minx = 100,
+			.maxx = GESTURE_DEFAULT_MAXX-100,
+			.miny = 100,
+			.maxy = GESTURE_DEFAULT_MAXY-100,
+		},
+		.edge_motion = true,
+		.move_touched = true,
+		.sleep_time = 3000,
+		.speed = 1,
+		.edge_scrolling = true,
+		.right_scrolling = true,
+		.bottom_scrolling = true,
+		.scroll_div = 50,
+		.scroll_sleep_time = 5000,
+	};
+	core_t core;
+	core_init(&core, &settings);
+	
+	unsigned long output = 0;
+	int frame = 0;
+	int offset = 0;
+	long cycle = 0;
+	double start = now_seconds();
+	for (long i = 0; i < n_frames; ++i) {
+		struct input_event out[CORE_MAX_OUTPUT];
+		output += core_feed(&core, events+offset, counts[frame],
+							cycle+times[frame], out);
+		offset += counts[frame];
+		if (++frame == GENERATED_FRAMES) {
+			frame = 0;
+			offset = 0;
+			cycle += span;
+		}
+	}
+	double elapsed = now_seconds()-start;
+	
+	printf("%ld frames in %.3fs: %.1f million frames/s, %.1f ns/frame, "
+		   "%lu output events\n",
+		   n_frames, elapsed, n_frames/elapsed/1e6, elapsed*1e9/n_frames, output);
+	free(events);
+	free(counts);
+	free(times);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+/*
+ * kerpad-corecheck checks the edge logic of libkerpad:
+ * the variants selected for the options must behave
+ * as the generic functions, on random frames, and the
+ * motion of the finger given to the grab mode must not
+ * jump when it touches the touchpad or crosses the edge limits
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "core.h"
+#include "util.h"
+
+#define MAXX 1000
+#define MAXY 700
+#define N_FRAMES 100000
+#define SEED 1
+
+/**
+ * Return a random value in [min, max]
+ */
+static int random_between(int min, int max) {
+	return min+rand()%(max-min+1);
+}
+
+/**
+ * Fill the frame with random events, each one may be absent,
+ * and the coordinates may be beyond the edge limits
+ *
+ * time: time of the previous touch, advanced if the frame touches
+ */
+static void random_frame(struct core_frame *frame, unsigned long *time) {
+	frame->x = random_between(-1, MAXX);
+	frame->y = random_between(-1, MAXY);
+	frame->touched = random_between(-1, 1);
+	frame->pressed = random_between(-1, 1);
+	if (frame->touched > 0) *time += random_between(0, 2*CORE_DOUBLE_TAP_TIME);
+	frame->touch_time = *time;
+}
+
+/**
+ * Return true if both touchpads are in the same state
+ */
+static bool same_touchpad(const struct core_touchpad *a, const struct core_touchpad *b) {
+	return a->x == b->x && a->y == b->y
+		&& a->edgex == b->edgex && a->edgey == b->edgey
+		&& a->touched == b->touched && a->edge_touched == b->edge_touched
+		&& a->pressed == b->pressed && a->double_tapped == b->double_tapped
+		&& a->last_touch_time == b->last_touch_time
+		&& a->motion_x == b->motion_x && a->motion_y == b->motion_y
+		&& a->anchored_x == b->anchored_x && a->anchored_y == b->anchored_y
+		&& a->frame.x == b->frame.x && a->frame.y == b->frame.y
+		&& a->frame.touched == b->frame.touched && a->frame.pressed == b->frame.pressed;
+}
+
+/**
+ * Check that the variant of core_select_apply
+ * behaves as core_touchpad_apply
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int check_apply() {
+	for (int protection = 0; protection < 2; ++protection) {
+		struct core_limits limits = {
+			.minx = 100,
+			.maxx = MAXX-100,
+			.miny = 100,
+			.maxy = MAXY-100,
+			.no_edge_protection = !protection,
+		};
+		core_apply_fn apply = core_select_apply(&limits);
+		struct core_touchpad variant;
+		struct core_touchpad generic;
+		core_touchpad_init(&variant);
+		core_touchpad_init(&generic);
+		unsigned long time = 0;
+		for (int i = 0; i < N_FRAMES; ++i) {
+			random_frame(&variant.frame, &time);
+			generic.frame = variant.frame;
+			int variant_detected = apply(&variant, &limits);
+			int generic_detected = core_touchpad_apply(&generic, &limits);
+			if (variant_detected != generic_detected || !same_touchpad(&variant, &generic)) {
+				error_message("apply variant differs at frame %d "
+							  "(no edge protection: %d)", i, !protection);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Check that the variant of core_select_motion_active behaves
+ * as core_motion_active, for all the options and states
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int check_motion_active() {
+	for (int opts = 0; opts < 32; ++opts) {
+		core_settings_t settings = {
+			.limits.no_edge_protection = opts&1,
+			.edge_motion = opts&2,
+			.move_touched = opts&4,
+			.disable_double_tap = opts&8,
+			.edge_scrolling = opts&16,
+		};
+		core_motion_active_fn motion_active = core_select_motion_active(&settings);
+		for (int state = 0; state < 16; ++state) {
+			struct core_touchpad touchpad;
+			core_touchpad_init(&touchpad);
+			touchpad.touched = state&1;
+			touchpad.edge_touched = state&2;
+			touchpad.pressed = state&4;
+			touchpad.double_tapped = state&8;
+			if (motion_active(&settings, &touchpad)
+				!= core_motion_active(&settings, &touchpad)) {
+				error_message("motion_active variant differs "
+							  "(options %d, state %d)", opts, state);
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * Give a frame to the touchpad and apply it
+ *
+ * x, y, touched: value of the events, not given if < 0
+ */
+static void feed_frame(struct core_touchpad *touchpad, core_apply_fn apply,
+					   const struct core_limits *limits, int x, int y, int touched) {
+	struct input_event events[4];
+	int n = 0;
+	if (touched >= 0) events[n++] = (struct input_event) {.type = EV_KEY, .code = BTN_TOUCH,
+														  .value = touched};
+	if (x >= 0) events[n++] = (struct input_event) {.type = EV_ABS, .code = ABS_X, .value = x};
+	if (y >= 0) events[n++] = (struct input_event) {.type = EV_ABS, .code = ABS_Y, .value = y};
+	events[n++] = (struct input_event) {.type = EV_SYN, .code = SYN_REPORT};
+	for (int i = 0; i < n; ++i) {
+		if (core_touchpad_event(touchpad, events+i, false) != CORE_FRAME_PENDING)
+			apply(touchpad, limits);
+	}
+}
+
+/**
+ * Check that the motion of the last frames is dx, dy, and reset it
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int expect_motion(struct core_touchpad *touchpad, int dx, int dy, const char *what) {
+	int motion_x = touchpad->motion_x;
+	int motion_y = touchpad->motion_y;
+	touchpad->motion_x = 0;
+	touchpad->motion_y = 0;
+	if (motion_x == dx && motion_y == dy) return 0;
+	error_message("%s: motion %d %d instead of %d %d", what, motion_x, motion_y, dx, dy);
+	return -1;
+}
+
+/**
+ * Check the motion of the finger when it touches the touchpad,
+ * crosses the edge limits and after dropped events
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int check_grab_motion(core_apply_fn apply, const struct core_limits *limits) {
+	struct core_touchpad tp;
+	core_touchpad_init(&tp);
+	int err = 0;
+	
+	feed_frame(&tp, apply, limits, 500, 300, 1);
+	err |= expect_motion(&tp, 0, 0, "first touch");
+	feed_frame(&tp, apply, limits, 510, 305, -1);
+	err |= expect_motion(&tp, 10, 5, "move");
+	feed_frame(&tp, apply, limits, -1, -1, 0);
+	feed_frame(&tp, apply, limits, 200, 400, 1);
+	err |= expect_motion(&tp, 0, 0, "touch elsewhere");
+	feed_frame(&tp, apply, limits, 203, -1, -1);
+	err |= expect_motion(&tp, 3, 0, "move after the touch");
+	
+	// the position of the new touch comes after the touch
+	feed_frame(&tp, apply, limits, -1, -1, 0);
+	feed_frame(&tp, apply, limits, -1, -1, 1);
+	feed_frame(&tp, apply, limits, 700, 500, -1);
+	err |= expect_motion(&tp, 0, 0, "touch without position");
+	feed_frame(&tp, apply, limits, 705, 498, -1);
+	err |= expect_motion(&tp, 5, -2, "move after the position");
+	
+	// from inside to beyond the right edge limit, and back
+	feed_frame(&tp, apply, limits, -1, -1, 0);
+	feed_frame(&tp, apply, limits, limits->maxx-50, 300, 1);
+	for (int x = limits->maxx-30; x <= limits->maxx+50; x += 20) {
+		feed_frame(&tp, apply, limits, x, -1, -1);
+		err |= expect_motion(&tp, 20, 0, "crossing the edge limit");
+	}
+	for (int x = limits->maxx+30; x >= limits->maxx-50; x -= 20) {
+		feed_frame(&tp, apply, limits, x, -1, -1);
+		err |= expect_motion(&tp, -20, 0, "crossing back the edge limit");
+	}
+	
+	// from beyond the left edge limit to inside
+	feed_frame(&tp, apply, limits, -1, -1, 0);
+	feed_frame(&tp, apply, limits, limits->minx-40, 300, 1);
+	err |= expect_motion(&tp, 0, 0, "touch beyond the edge limit");
+	for (int x = limits->minx-15; x <= limits->minx+60; x += 25) {
+		feed_frame(&tp, apply, limits, x, -1, -1);
+		err |= expect_motion(&tp, 25, 0, "entering from the edge");
+	}
+	
+	// the finger was lifted and put elsewhere during the dropped events
+	struct input_event dropped = {.type = EV_SYN, .code = SYN_DROPPED};
+	struct input_event report = {.type = EV_SYN, .code = SYN_REPORT};
+	core_touchpad_event(&tp, &dropped, false);
+	if (core_touchpad_event(&tp, &report, false) == CORE_FRAME_RESYNC) {
+		core_touchpad_resync(&tp, 800, 500, true, false, 0);
+		apply(&tp, limits);
+	}
+	err |= expect_motion(&tp, 0, 0, "resync");
+	feed_frame(&tp, apply, limits, 806, 500, -1);
+	err |= expect_motion(&tp, 6, 0, "move after the resync");
+	return err? -1: 0;
+}
+
+int main() {
+	srand(SEED);
+	if (check_apply() == -1 || check_motion_active() == -1) return EXIT_FAILURE;
+	printf("corecheck: the variants behave as the generic functions\n");
+	
+	for (int protection = 0; protection < 2; ++protection) {
+		struct core_limits limits = {
+			.minx = 100,
+			.maxx = MAXX-100,
+			.miny = 100,
+			.maxy = MAXY-100,
+			.no_edge_protection = !protection,
+		};
+		if (check_grab_motion(core_touchpad_apply, &limits) == -1
+			|| check_grab_motion(core_select_apply(&limits), &limits) == -1)
+			return EXIT_FAILURE;
+	}
+	printf("corecheck: the motion of the finger does not jump\n");
+	return EXIT_SUCCESS;
+}
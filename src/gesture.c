@@ -0,0 +1,398 @@
+/*
+ * This file is responsible for generating
+ * the events of a simulated touchpad,
+ * from a script or randomly
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gesture.h"
+#include "util.h"
+
+#define STEP_TOUCH   0
+#define STEP_MOVE    1
+#define STEP_WAIT    2
+#define STEP_PRESS   3
+#define STEP_RELEASE 4
+#define STEP_LIFT    5
+
+// distance to the border of the points
+// used by the gestures at the edge
+#define EDGE_DISTANCE 60
+
+#define SCENARIO_SIZE 512
+// max number of steps of a random gesture
+#define RANDOM_STEPS 16
+
+struct step {
+	int type;
+	int x;
+	int y;
+	long duration;
+};
+
+struct gesture {
+	gesture_settings_t settings;
+	
+	struct step *steps;
+	int n_steps;
+	int steps_cap;
+	// index of the current step
+	int current;
+	bool step_started;
+	long step_start;
+	
+	// time of the last frame in microseconds
+	long time;
+	long period;
+	
+	// state of the simulated finger
+	int x;
+	int y;
+	int from_x;
+	int from_y;
+	bool touching;
+	bool pressing;
+	
+	// last state written in a frame
+	int sent_x;
+	int sent_y;
+	bool sent_touching;
+	bool sent_pressing;
+	int tracking_id;
+	
+	unsigned int seed;
+	bool done;
+};
+
+static void add_step(gesture_t *gesture, int type, int x, int y, long duration) {
+	if (gesture->n_steps == gesture->steps_cap) {
+		gesture->steps_cap = gesture->steps_cap? 2*gesture->steps_cap: 16;
+		gesture->steps = realloc(gesture->steps,
+								 gesture->steps_cap*sizeof(*gesture->steps));
+		exitif(gesture->steps == NULL, "cannot allocate gesture steps");
+	}
+	gesture->steps[gesture->n_steps++] = (struct step) {
+		.type = type,
+		.x = x,
+		.y = y,
+		.duration = duration,
+	};
+}
+
+/**
+ * Parse the script and add its steps
+ *
+ * Return 0 on success and -1 if the script is invalid
+ */
+static int parse_script(gesture_t *gesture, const char *script) {
+	int line_number = 0;
+	while (*script) {
+		const char *end = strchr(script, '\n');
+		int len = end? end-script: (int)strlen(script);
+		char line[255] = {};
+		if (len >= (int)sizeof(line)) len = sizeof(line)-1;
+		memcpy(line, script, len);
+		script += end? len+1: len;
+		++line_number;
+		
+		char cmd[16] = {};
+		int x, y, ms;
+		char extra;
+		if (sscanf(line, " %15s", cmd) != 1 || cmd[0] == '#') continue;
+		
+		if (!strcmp(cmd, "touch") && sscanf(line, " touch %d %d %c", &x, &y, &extra) == 2) {
+			add_step(gesture, STEP_TOUCH, x, y, 0);
+		} else if (!strcmp(cmd, "move")
+				   && sscanf(line, " move %d %d %d %c", &x, &y, &ms, &extra) == 3
+				   && ms >= 0) {
+			add_step(gesture, STEP_MOVE, x, y, ms*1000L);
+		} else if (!strcmp(cmd, "wait") && sscanf(line, " wait %d %c", &ms, &extra) == 1
+				   && ms >= 0) {
+			add_step(gesture, STEP_WAIT, 0, 0, ms*1000L);
+		} else if (!strcmp(cmd, "press") && sscanf(line, " press %c", &extra) != 1) {
+			add_step(gesture, STEP_PRESS, 0, 0, 0);
+		} else if (!strcmp(cmd, "release") && sscanf(line, " release %c", &extra) != 1) {
+			add_step(gesture, STEP_RELEASE, 0, 0, 0);
+		} else if (!strcmp(cmd, "lift") && sscanf(line, " lift %c", &extra) != 1) {
+			add_step(gesture, STEP_LIFT, 0, 0, 0);
+		} else {
+			error_message("invalid gesture at line %d: %s", line_number, line);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int random_between(gesture_t *gesture, int min, int max) {
+	return min+rand_r(&gesture->seed)%(max-min+1);
+}
+
+/**
+ * Write in x and y a random point
+ * at the edge of the touchpad
+ */
+static void random_edge_point(gesture_t *gesture, int *x, int *y) {
+	gesture_settings_t *gs = &gesture->settings;
+	*x = random_between(gesture, gs->minx, gs->maxx);
+	*y = random_between(gesture, gs->miny, gs->maxy);
+	switch (random_between(gesture, 0, 3)) {
+	case 0: *x = gs->minx+EDGE_DISTANCE; break;
+	case 1: *x = gs->maxx-EDGE_DISTANCE; break;
+	case 2: *y = gs->miny+EDGE_DISTANCE; break;
+	case 3: *y = gs->maxy-EDGE_DISTANCE; break;
+	}
+}
+
+/**
+ * Add the steps of a random gesture
+ */
+static void add_random_steps(gesture_t *gesture) {
+	gesture_settings_t *gs = &gesture->settings;
+	int width = gs->maxx-gs->minx;
+	int height = gs->maxy-gs->miny;
+	int cx = random_between(gesture, gs->minx+width/4, gs->maxx-width/4);
+	int cy = random_between(gesture, gs->miny+height/4, gs->maxy-height/4);
+	int ex, ey;
+	random_edge_point(gesture, &ex, &ey);
+	
+	switch (random_between(gesture, 0, 3)) {
+	case 0: // edge dwell
+		add_step(gesture, STEP_TOUCH, cx, cy, 0);
+		add_step(gesture, STEP_MOVE, ex, ey, random_between(gesture, 200, 600)*1000L);
+		add_step(gesture, STEP_PRESS, 0, 0, 0);
+		add_step(gesture, STEP_WAIT, 0, 0, random_between(gesture, 300, 1500)*1000L);
+		add_step(gesture, STEP_RELEASE, 0, 0, 0);
+		add_step(gesture, STEP_LIFT, 0, 0, 0);
+		break;
+	case 1: // edge scrolling
+		add_step(gesture, STEP_TOUCH, gs->maxx-EDGE_DISTANCE, cy, 0);
+		add_step(gesture, STEP_MOVE, gs->maxx-EDGE_DISTANCE,
+				 random_between(gesture, gs->miny, gs->maxy),
+				 random_between(gesture, 300, 800)*1000L);
+		add_step(gesture, STEP_LIFT, 0, 0, 0);
+		break;
+	case 2: // double tap then edge motion
+		add_step(gesture, STEP_TOUCH, cx, cy, 0);
+		add_step(gesture, STEP_WAIT, 0, 0, random_between(gesture, 30, 80)*1000L);
+		add_step(gesture, STEP_LIFT, 0, 0, 0);
+		add_step(gesture, STEP_WAIT, 0, 0, random_between(gesture, 50, 120)*1000L);
+		add_step(gesture, STEP_TOUCH, cx, cy, 0);
+		add_step(gesture, STEP_MOVE, ex, ey, random_between(gesture, 200, 500)*1000L);
+		add_step(gesture, STEP_WAIT, 0, 0, random_between(gesture, 200, 1000)*1000L);
+		add_step(gesture, STEP_LIFT, 0, 0, 0);
+		break;
+	case 3: // simple move
+		add_step(gesture, STEP_TOUCH, cx, cy, 0);
+		add_step(gesture, STEP_MOVE, random_between(gesture, gs->minx, gs->maxx),
+				 random_between(gesture, gs->miny, gs->maxy),
+				 random_between(gesture, 100, 500)*1000L);
+		add_step(gesture, STEP_LIFT, 0, 0, 0);
+		break;
+	}
+	add_step(gesture, STEP_WAIT, 0, 0, random_between(gesture, 100, 500)*1000L);
+}
+
+char *gesture_scenario(const char *name, gesture_settings_t *settings) {
+	int cx = (settings->minx+settings->maxx)/2;
+	int cy = (settings->miny+settings->maxy)/2;
+	int right = settings->maxx-EDGE_DISTANCE;
+	int bottom = settings->maxy-EDGE_DISTANCE;
+	char *script = malloc(SCENARIO_SIZE);
+	exitif(script == NULL, "cannot allocate a scenario");
+	
+	if (!strcmp(name, "edge-dwell")) {
+		snprintf(script, SCENARIO_SIZE,
+				 "touch %d %d\nmove %d %d 300\npress\nwait 1000\n"
+				 "move %d %d 200\nwait 1000\nrelease\nlift\nwait 300\n",
+				 cx, cy, right, cy, right, bottom);
+	} else if (!strcmp(name, "edge-scroll")) {
+		snprintf(script, SCENARIO_SIZE,
+				 "touch %d %d\nmove %d %d 600\nmove %d %d 600\nlift\n"
+				 "touch %d %d\nmove %d %d 600\nlift\nwait 300\n",
+				 right, cy, right, bottom, right, settings->miny,
+				 cx, bottom, settings->minx, bottom);
+	} else if (!strcmp(name, "double-tap")) {
+		snprintf(script, SCENARIO_SIZE,
+				 "touch %d %d\nwait 50\nlift\nwait 80\n"
+				 "touch %d %d\nmove %d %d 300\nwait 1000\nlift\nwait 300\n",
+				 cx, cy, cx, cy, right, cy);
+	} else {
+		free(script);
+		return NULL;
+	}
+	return script;
+}
+
+char *gesture_read_script(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (msgif(file == NULL, "cannot open %s", path)) return NULL;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	rewind(file);
+	char *content = malloc(size+1);
+	exitif(content == NULL, "cannot allocate %s content", path);
+	content[fread(content, 1, size, file)] = 0;
+	fclose(file);
+	return content;
+}
+
+gesture_t *gesture_init(gesture_settings_t *settings) {
+	gesture_t *gesture = calloc(1, sizeof(*gesture));
+	exitif(gesture == NULL, "cannot allocate the gesture generator");
+	gesture->settings = *settings;
+	gesture->seed = settings->seed;
+	gesture->period = 1000000L/settings->rate;
+	gesture->time = -gesture->period;
+	gesture->x = gesture->sent_x = settings->minx;
+	gesture->y = gesture->sent_y = settings->miny;
+	
+	if (settings->script && parse_script(gesture, settings->script) == -1) {
+		gesture_clean(gesture);
+		return NULL;
+	}
+	if (!settings->script && settings->random) {
+		// room for any random gesture, so
+		// generating them does not allocate
+		gesture->steps_cap = RANDOM_STEPS;
+		gesture->steps = malloc(RANDOM_STEPS*sizeof(*gesture->steps));
+		exitif(gesture->steps == NULL, "cannot allocate gesture steps");
+	}
+	return gesture;
+}
+
+/**
+ * Apply the steps that happen during the current frame
+ */
+static void advance_steps(gesture_t *gesture) {
+	bool restarted = false;
+	while (true) {
+		if (gesture->current == gesture->n_steps) {
+			if (gesture->settings.script && gesture->settings.loop && gesture->n_steps) {
+				// a script that takes no time cannot
+				// be restarted twice in the same frame
+				if (restarted) return;
+				restarted = true;
+				gesture->current = 0;
+			} else if (!gesture->settings.script && gesture->settings.random) {
+				// the steps are done, their room is reused
+				gesture->n_steps = 0;
+				gesture->current = 0;
+				add_random_steps(gesture);
+			} else {
+				gesture->done = true;
+				return;
+			}
+		}
+		
+		struct step *step = gesture->steps+gesture->current;
+		if (!gesture->step_started) {
+			gesture->step_started = true;
+			gesture->step_start = gesture->time;
+			gesture->from_x = gesture->x;
+			gesture->from_y = gesture->y;
+		}
+		long elapsed = gesture->time-gesture->step_start;
+		bool instantaneous = true;
+		
+		switch (step->type) {
+		case STEP_TOUCH:
+			gesture->x = step->x;
+			gesture->y = step->y;
+			gesture->touching = true;
+			break;
+		case STEP_PRESS:
+			gesture->pressing = true;
+			break;
+		case STEP_RELEASE:
+			gesture->pressing = false;
+			break;
+		case STEP_LIFT:
+			gesture->pressing = false;
+			gesture->touching = false;
+			break;
+		case STEP_MOVE:
+			instantaneous = false;
+			if (elapsed < step->duration) {
+				gesture->x = gesture->from_x
+					+(step->x-gesture->from_x)*elapsed/step->duration;
+				gesture->y = gesture->from_y
+					+(step->y-gesture->from_y)*elapsed/step->duration;
+				return;
+			}
+			gesture->x = step->x;
+			gesture->y = step->y;
+			break;
+		case STEP_WAIT:
+			instantaneous = false;
+			if (elapsed < step->duration) return;
+			break;
+		}
+		
+		++gesture->current;
+		gesture->step_started = false;
+		// only one instantaneous step per frame,
+		// so a touch and a lift are never merged
+		if (instantaneous) return;
+	}
+}
+
+static void set_event(struct input_event *event, long time, int type, int code, int value) {
+	event->input_event_sec = time/1000000;
+	event->input_event_usec = time%1000000;
+	event->type = type;
+	event->code = code;
+	event->value = value;
+}
+
+int gesture_next_frame(gesture_t *gesture, struct input_event *events) {
+	gesture->time += gesture->period;
+	if (gesture->done) return 0;
+	advance_steps(gesture);
+	
+	long t = gesture->time;
+	bool mt = gesture->settings.mt;
+	bool moved_x = gesture->touching && gesture->x != gesture->sent_x;
+	bool moved_y = gesture->touching && gesture->y != gesture->sent_y;
+	int n = 0;
+	
+	if (mt && gesture->touching != gesture->sent_touching) {
+		if (gesture->touching) ++gesture->tracking_id;
+		set_event(events+n++, t, EV_ABS, ABS_MT_TRACKING_ID,
+				  gesture->touching? gesture->tracking_id: -1);
+	}
+	if (mt && moved_x) set_event(events+n++, t, EV_ABS, ABS_MT_POSITION_X, gesture->x);
+	if (mt && moved_y) set_event(events+n++, t, EV_ABS, ABS_MT_POSITION_Y, gesture->y);
+	if (gesture->touching != gesture->sent_touching) {
+		set_event(events+n++, t, EV_KEY, BTN_TOUCH, gesture->touching);
+		set_event(events+n++, t, EV_KEY, BTN_TOOL_FINGER, gesture->touching);
+	}
+	if (moved_x) set_event(events+n++, t, EV_ABS, ABS_X, gesture->x);
+	if (moved_y) set_event(events+n++, t, EV_ABS, ABS_Y, gesture->y);
+	if (gesture->pressing != gesture->sent_pressing) {
+		set_event(events+n++, t, EV_KEY, BTN_MOUSE, gesture->pressing);
+	}
+	if (n == 0) return 0;
+	set_event(events+n++, t, EV_SYN, SYN_REPORT, 0);
+	
+	gesture->sent_x = gesture->x;
+	gesture->sent_y = gesture->y;
+	gesture->sent_touching = gesture->touching;
+	gesture->sent_pressing = gesture->pressing;
+	return n;
+}
+
+long gesture_time(gesture_t *gesture) {
+	return gesture->time;
+}
+
+bool gesture_done(gesture_t *gesture) {
+	return gesture->done;
+}
+
+void gesture_clean(gesture_t *gesture) {
+	free(gesture->steps);
+	free(gesture);
+}
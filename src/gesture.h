@@ -0,0 +1,100 @@
+#ifndef __GESTURE_H__
+#define __GESTURE_H__
+
+#include <stdbool.h>
+#include <linux/input.h>
+
+// max number of events in a frame
+#define GESTURE_FRAME_SIZE 12
+
+// default size of a simulated touchpad
+#define GESTURE_DEFAULT_MAXX 4000
+#define GESTURE_DEFAULT_MAXY 2500
+
+typedef struct gesture gesture_t;
+
+struct gesture_settings {
+	// limits of the simulated touchpad
+	int minx;
+	int maxx;
+	int miny;
+	int maxy;
+	
+	// number of frames per second
+	int rate;
+	
+	// if non null, gestures are read from this script
+	// each line is one of:
+	//   touch X Y      put the finger on the touchpad at X Y
+	//   move X Y MS    move the finger to X Y in MS milliseconds
+	//   wait MS        keep the current state for MS milliseconds
+	//   press          press the touchpad
+	//   release        release the touchpad
+	//   lift           lift the finger (and release)
+	// empty lines and lines starting with # are ignored
+	const char *script;
+	
+	// if true, the script is restarted when it ends
+	bool loop;
+	
+	// if true and script is null, endless random gestures
+	// are generated
+	bool random;
+	unsigned int seed;
+	
+	// if true, multi-touch events (slot 0)
+	// are generated with the single-touch ones
+	bool mt;
+};
+typedef struct gesture_settings gesture_settings_t;
+
+/**
+ * Return a script for a built-in scenario:
+ * edge-dwell, edge-scroll or double-tap
+ * The script uses the limits of the settings
+ *
+ * Return NULL if the scenario does not exist
+ * The returned script must be freed
+ */
+char *gesture_scenario(const char *name, gesture_settings_t *settings);
+
+/**
+ * Return the content of a script file,
+ * or NULL on error
+ * The returned script must be freed
+ */
+char *gesture_read_script(const char *path);
+
+/**
+ * Init a gesture generator
+ *
+ * Return NULL if the script is invalid
+ */
+gesture_t *gesture_init(gesture_settings_t *settings);
+
+/**
+ * Compute the next frame, 1/rate seconds after the previous one
+ *
+ * Write its events in events (at most GESTURE_FRAME_SIZE events),
+ * SYN_REPORT included, and return their number
+ * Return 0 if nothing changed during this frame
+ */
+int gesture_next_frame(gesture_t *gesture, struct input_event *events);
+
+/**
+ * Return the time of the last computed frame,
+ * in microseconds since the start of the gestures
+ */
+long gesture_time(gesture_t *gesture);
+
+/**
+ * Return true if all the gestures are done
+ */
+bool gesture_done(gesture_t *gesture);
+
+/**
+ * Clean the gesture generator
+ */
+void gesture_clean(gesture_t *gesture);
+
+#endif // !__GESTURE_H__
@@ -0,0 +1,208 @@
+/*
+ * This file is responsible for checking that the steady
+ * state of kerpad does not allocate, and stays within
+ * a budget of system calls per frame
+ *
+ * In the guard build, the allocation functions and the system
+ * calls used by kerpad are wrapped by the linker (--wrap), so
+ * every call made by the sources of kerpad is counted here
+ * The calls made by the C library itself are not seen
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "guard.h"
+#include "util.h"
+
+#ifdef KERPAD_GUARD
+
+static struct {
+	atomic_bool armed;
+	atomic_ulong allocations;
+	atomic_ulong syscalls;
+	// caller of the first allocation while armed
+	_Atomic(void *) first_caller;
+} guard;
+
+/**
+ * Count an allocation or a free made by caller
+ */
+static void count_allocation(void *caller) {
+	if (!atomic_load_explicit(&guard.armed, memory_order_relaxed)) return;
+	void *none = NULL;
+	atomic_compare_exchange_strong(&guard.first_caller, &none, caller);
+	atomic_fetch_add_explicit(&guard.allocations, 1, memory_order_relaxed);
+}
+
+static void count_syscall() {
+	if (!atomic_load_explicit(&guard.armed, memory_order_relaxed)) return;
+	atomic_fetch_add_explicit(&guard.syscalls, 1, memory_order_relaxed);
+}
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+	count_allocation(__builtin_return_address(0));
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+	count_allocation(__builtin_return_address(0));
+	return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	count_allocation(__builtin_return_address(0));
+	return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+	count_allocation(__builtin_return_address(0));
+	return __real_aligned_alloc(alignment, size);
+}
+
+void __wrap_free(void *ptr) {
+	if (ptr) count_allocation(__builtin_return_address(0));
+	__real_free(ptr);
+}
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+int __real_ioctl(int fd, unsigned long request, ...);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+int __real_nanosleep(const struct timespec *req, struct timespec *rem);
+int __real_clock_nanosleep(clockid_t clock, int flags, const struct timespec *req,
+						   struct timespec *rem);
+long __real_syscall(long number, ...);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count) {
+	count_syscall();
+	return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count) {
+	count_syscall();
+	return __real_write(fd, buf, count);
+}
+
+int __wrap_ioctl(int fd, unsigned long request, ...) {
+	va_list args;
+	va_start(args, request);
+	void *arg = va_arg(args, void *);
+	va_end(args);
+	count_syscall();
+	return __real_ioctl(fd, request, arg);
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+	count_syscall();
+	return __real_poll(fds, nfds, timeout);
+}
+
+int __wrap_nanosleep(const struct timespec *req, struct timespec *rem) {
+	count_syscall();
+	return __real_nanosleep(req, rem);
+}
+
+int __wrap_clock_nanosleep(clockid_t clock, int flags, const struct timespec *req,
+						   struct timespec *rem) {
+	count_syscall();
+	return __real_clock_nanosleep(clock, flags, req, rem);
+}
+
+/**
+ * Return the number of arguments given by kerpad
+ * to the system call number, -1 if kerpad does not use it
+ */
+static int syscall_arguments(long number) {
+	switch (number) {
+	case SYS_gettid:
+		return 0;
+	case SYS_futex:
+		return 6;
+#ifdef HAVE_IO_URING
+	case SYS_io_uring_setup:
+		return 2;
+	case SYS_io_uring_register:
+		return 4;
+	case SYS_io_uring_enter:
+		return 6;
+#endif // HAVE_IO_URING
+	default:
+		return -1;
+	}
+}
+
+/**
+ * Used by kerpad for the futexes, io_uring and gettid
+ * Only the arguments given by the caller are read,
+ * the others are forwarded as 0 and ignored by the kernel
+ */
+long __wrap_syscall(long number, ...) {
+	int n = syscall_arguments(number);
+	if (n == -1) {
+		error_message("guard: unexpected system call %ld, "
+					  "its arguments are not known", number);
+		exit(EXIT_FAILURE);
+	}
+	va_list args;
+	va_start(args, number);
+	long a[6] = {0};
+	for (int i = 0; i < n; ++i) a[i] = va_arg(args, long);
+	va_end(args);
+	count_syscall();
+	return __real_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+void guard_arm() {
+	atomic_store(&guard.allocations, 0);
+	atomic_store(&guard.syscalls, 0);
+	atomic_store(&guard.first_caller, NULL);
+	atomic_store(&guard.armed, true);
+}
+
+int guard_check(unsigned long frames) {
+	atomic_store(&guard.armed, false);
+	unsigned long allocations = atomic_load(&guard.allocations);
+	unsigned long syscalls = atomic_load(&guard.syscalls);
+	double per_frame = frames? (double)syscalls/frames: syscalls;
+	const char *max_env = getenv(GUARD_SYSCALLS_ENV);
+	int max = max_env? atoi(max_env): GUARD_MAX_SYSCALLS;
+	
+	fprintf(stderr, "guard: %lu allocations after init", allocations);
+	if (allocations) fprintf(stderr, " (first from %p)", atomic_load(&guard.first_caller));
+	fprintf(stderr, ", %lu system calls for %lu frames (%.2f per frame, max %d)\n",
+			syscalls, frames, per_frame, max);
+	if (allocations) {
+		error_message("the steady state allocated memory");
+		return -1;
+	}
+	if (per_frame > max) {
+		error_message("the steady state made more than %d system calls per frame", max);
+		return -1;
+	}
+	return 0;
+}
+
+#else // !KERPAD_GUARD
+
+void guard_arm() {}
+
+int guard_check(unsigned long frames) {
+	(void)frames;
+	return 0;
+}
+
+#endif // KERPAD_GUARD
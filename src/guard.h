@@ -0,0 +1,36 @@
+#ifndef __GUARD_H__
+#define __GUARD_H__
+
+// max number of system calls per written frame
+// allowed by guard_check, can be set at build time
+#ifndef GUARD_MAX_SYSCALLS
+#define GUARD_MAX_SYSCALLS 3
+#endif
+// environment variable replacing GUARD_MAX_SYSCALLS at run time,
+// for the runs with the real clock, where the sleeps and the
+// futexes between the threads are real system calls
+#define GUARD_SYSCALLS_ENV "KERPAD_GUARD_SYSCALLS"
+
+/**
+ * Start counting the allocations and the system calls
+ * made by kerpad, should be called once the init is done
+ *
+ * Only the guard build (kerpad-guard, built with KERPAD_GUARD
+ * and the wrappers of guard.c) counts them, in the other
+ * builds the guard functions do nothing
+ */
+void guard_arm();
+
+/**
+ * Stop counting, and print the allocations and
+ * the system calls made since guard_arm
+ *
+ * frames: number of frames written since guard_arm
+ *
+ * Return -1 if kerpad allocated or freed memory, or made more than
+ * GUARD_MAX_SYSCALLS (or GUARD_SYSCALLS_ENV) system calls per frame,
+ * and 0 otherwise
+ */
+int guard_check(unsigned long frames);
+
+#endif // !__GUARD_H__
@@ -0,0 +1,335 @@
+/*
+ * kerpad-iobench compares the I/O backends of kerpad:
+ * the reads of the touchpads and the writes of the events
+ *
+ * Touchpads are replaced by sequenced packet sockets,
+ * which keep the frames whole like evdev files,
+ * and are read the way touchpad.c reads them
+ * The writes go through a sink, as in kerpad
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <linux/input.h>
+
+#include "uring.h"
+#include "sink.h"
+#include "clock.h"
+#include "util.h"
+
+#define MAX_DEVICES 8
+#define EVENT_BATCH_SIZE 64
+
+#define DEFAULT_FRAMES 20000
+#define DEFAULT_DEVICES 2
+// time between two frames in microseconds
+#define DEFAULT_PERIOD 100
+#define DEFAULT_OUTPUT "/dev/null"
+// frames written between two flushes of the sink,
+// as the mouse writer does for a button and a move
+#define WRITES_PER_WAKEUP 2
+
+static struct option long_options[] = {
+	{"frames", required_argument, NULL, 'n'},
+	{"devices", required_argument, NULL, 'd'},
+	{"period", required_argument, NULL, 'p'},
+	{"output", required_argument, NULL, 'o'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0},
+};
+
+struct bench {
+	int io;
+	int n_frames;
+	int n_devices;
+	long period;
+	// [i][0] is read by kerpad, [i][1] written by the producer
+	int sockets[MAX_DEVICES][2];
+	
+	// latencies of the frames in microseconds
+	long *latencies;
+	int n_latencies;
+	unsigned long syscalls;
+};
+
+static void print_help(char *argv[]) {
+	printf("Usage: %s [options]\n", argv[0]);
+	printf("Compare the blocking and io_uring I/O backends of kerpad.\n\n");
+	printf("    -n, --frames=N        frames read and written (default: %d)\n",
+		   DEFAULT_FRAMES);
+	printf("    -d, --devices=N       simulated touchpads (default: %d)\n",
+		   DEFAULT_DEVICES);
+	printf("    -p, --period=US       microseconds between two frames (default: %d)\n",
+		   DEFAULT_PERIOD);
+	printf("    -o, --output=PATH     file written with the trace-bin sink\n");
+	printf("                          (default: "DEFAULT_OUTPUT")\n");
+	printf("    -h, --help            display this help and exit\n");
+}
+
+static long now_us() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000L+now.tv_nsec/1000;
+}
+
+/**
+ * Thread writing the frames in the sockets,
+ * stamped with the time they are sent
+ */
+static void *producer_thread(void *arg) {
+	struct bench *bench = arg;
+	long next = now_us();
+	for (int i = 0; i < bench->n_frames; ++i) {
+		next += bench->period;
+		struct timespec ts = {
+			.tv_sec = next/1000000,
+			.tv_nsec = next%1000000*1000,
+		};
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		
+		long sent = now_us();
+		struct input_event frame[3] = {
+			{.type = EV_ABS, .code = ABS_X, .value = i},
+			{.type = EV_ABS, .code = ABS_Y, .value = i},
+			{.type = EV_SYN, .code = SYN_REPORT},
+		};
+		for (int j = 0; j < 3; ++j) {
+			frame[j].input_event_sec = sent/1000000;
+			frame[j].input_event_usec = sent%1000000;
+		}
+		exitif(write(bench->sockets[i%bench->n_devices][1], frame, sizeof(frame)) == -1,
+			   "cannot write a frame");
+	}
+	return NULL;
+}
+
+/**
+ * Record the latency of the frames of count events
+ */
+static void handle_events(struct bench *bench, struct input_event *events, int count) {
+	long now = now_us();
+	for (int i = 0; i < count; ++i) {
+		if (events[i].type != EV_SYN) continue;
+		bench->latencies[bench->n_latencies++] = now
+			-(events[i].input_event_sec*1000000L+events[i].input_event_usec);
+	}
+}
+
+/**
+ * Read the frames with poll and read, as touchpad.c does
+ */
+static void read_blocking(struct bench *bench) {
+	struct pollfd fds[MAX_DEVICES];
+	for (int i = 0; i < bench->n_devices; ++i) {
+		fds[i] = (struct pollfd) {
+			.fd = bench->sockets[i][0],
+			.events = POLLIN,
+		};
+	}
+	struct input_event events[EVENT_BATCH_SIZE];
+	while (bench->n_latencies < bench->n_frames) {
+		if (bench->n_devices == 1) {
+			ssize_t size = read(fds[0].fd, events, sizeof(events));
+			exitif(size == -1, "cannot read a frame");
+			++bench->syscalls;
+			handle_events(bench, events, size/sizeof(*events));
+			continue;
+		}
+		
+		int ready = poll(fds, bench->n_devices, -1);
+		exitif(ready == -1, "cannot poll the sockets");
+		++bench->syscalls;
+		for (int i = 0; i < bench->n_devices && ready > 0; ++i) {
+			if (!fds[i].revents) continue;
+			--ready;
+			ssize_t size = read(fds[i].fd, events, sizeof(events));
+			exitif(size == -1, "cannot read a frame");
+			++bench->syscalls;
+			handle_events(bench, events, size/sizeof(*events));
+		}
+	}
+}
+
+/**
+ * Read the frames with reads kept queued
+ * in an io_uring, as touchpad.c does
+ */
+static void read_uring(struct bench *bench) {
+	static struct input_event buffers[MAX_DEVICES][EVENT_BATCH_SIZE];
+	int fds[MAX_DEVICES];
+	struct iovec iovs[MAX_DEVICES];
+	for (int i = 0; i < bench->n_devices; ++i) {
+		fds[i] = bench->sockets[i][0];
+		iovs[i] = (struct iovec) {
+			.iov_base = buffers[i],
+			.iov_len = sizeof(buffers[i]),
+		};
+	}
+	uring_t *uring = uring_init(2*MAX_DEVICES);
+	exitif(uring == NULL, "cannot init the io_uring");
+	exitif(uring_register_files(uring, fds, bench->n_devices) == -1,
+		   "cannot register the sockets");
+	exitif(uring_register_buffers(uring, iovs, bench->n_devices) == -1,
+		   "cannot register the buffers");
+	for (int i = 0; i < bench->n_devices; ++i) {
+		uring_read(uring, i, buffers[i], sizeof(buffers[i]), i, i);
+	}
+	
+	while (bench->n_latencies < bench->n_frames) {
+		uring_completion_t completions[MAX_DEVICES];
+		int count = uring_wait(uring, 1, completions, MAX_DEVICES);
+		++bench->syscalls;
+		for (int i = 0; i < count; ++i) {
+			int device = completions[i].data;
+			errno = -completions[i].res;
+			exitif(completions[i].res < 0, "cannot read a frame");
+			handle_events(bench, buffers[device],
+						  completions[i].res/sizeof(struct input_event));
+			uring_read(uring, device, buffers[device], sizeof(buffers[device]),
+					   device, device);
+		}
+	}
+	uring_clean(uring);
+}
+
+static int compare_long(const void *a, const void *b) {
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+	return (x > y)-(x < y);
+}
+
+static double cpu_time() {
+	struct rusage usage;
+	getrusage(RUSAGE_THREAD, &usage);
+	return usage.ru_utime.tv_sec+usage.ru_stime.tv_sec
+		+(usage.ru_utime.tv_usec+usage.ru_stime.tv_usec)/1e6;
+}
+
+/**
+ * Benchmark the reads with a backend
+ */
+static void bench_reads(struct bench *bench) {
+	for (int i = 0; i < bench->n_devices; ++i) {
+		exitif(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, bench->sockets[i]) == -1,
+			   "cannot create a socket pair");
+	}
+	bench->n_latencies = 0;
+	bench->syscalls = 0;
+	
+	pthread_t producer;
+	pthread_create(&producer, NULL, producer_thread, bench);
+	double cpu = cpu_time();
+	if (bench->io == IO_URING) read_uring(bench);
+	else read_blocking(bench);
+	cpu = cpu_time()-cpu;
+	pthread_join(producer, NULL);
+	for (int i = 0; i < bench->n_devices; ++i) {
+		close(bench->sockets[i][0]);
+		close(bench->sockets[i][1]);
+	}
+	
+	qsort(bench->latencies, bench->n_latencies, sizeof(long), compare_long);
+	long *lat = bench->latencies;
+	int n = bench->n_latencies;
+	printf("  reads:  latency p50 %ld us, p99 %ld us, max %ld us, "
+		   "%.2f syscalls/frame, %.1f us cpu/frame\n",
+		   lat[n/2], lat[n*99/100], lat[n-1],
+		   (double)bench->syscalls/n, cpu*1e6/n);
+}
+
+/**
+ * Benchmark the writes of a sink with a backend
+ */
+static void bench_writes(struct bench *bench, const char *output) {
+	kclock_t *clock = kclock_init_real();
+	sink_settings_t settings = {
+		.type = SINK_TRACE_BIN,
+		.path = (char *)output,
+		.io = bench->io,
+	};
+	sink_t *sink = sink_init(&settings, "Kerpad Iobench", clock);
+	struct input_event frame[3] = {
+		{.type = EV_REL, .code = REL_X, .value = 1},
+		{.type = EV_REL, .code = REL_Y, .value = 1},
+		{.type = EV_SYN, .code = SYN_REPORT},
+	};
+	
+	double cpu = cpu_time();
+	long start = now_us();
+	// flushed as by the mouse writer before it sleeps
+	for (int i = 0; i < bench->n_frames; ++i) {
+		sink_write(sink, frame, 3);
+		if (i%WRITES_PER_WAKEUP == WRITES_PER_WAKEUP-1) sink_flush(sink);
+	}
+	sink_flush(sink);
+	long elapsed = now_us()-start;
+	cpu = cpu_time()-cpu;
+	printf("  writes: %.2f us/frame, %.2f us cpu/frame\n",
+		   (double)elapsed/bench->n_frames, cpu*1e6/bench->n_frames);
+	sink_clean(sink);
+	kclock_clean(clock);
+}
+
+int main(int argc, char *argv[]) {
+	struct bench bench = {
+		.n_frames = DEFAULT_FRAMES,
+		.n_devices = DEFAULT_DEVICES,
+		.period = DEFAULT_PERIOD,
+	};
+	const char *output = DEFAULT_OUTPUT;
+	
+	while (1) {
+		int opt = getopt_long(argc, argv, "n:d:p:o:h", long_options, NULL);
+		if (opt == -1) break;
+		
+		switch (opt) {
+		case 'n': bench.n_frames = atoi(optarg); break;
+		case 'd': bench.n_devices = atoi(optarg); break;
+		case 'p': bench.period = atol(optarg); break;
+		case 'o': output = optarg; break;
+		case 'h':
+			print_help(argv);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bench.n_frames <= 0 || bench.n_devices <= 0
+		|| bench.n_devices > MAX_DEVICES || bench.period < 0) {
+		error_message("invalid options");
+		return EXIT_FAILURE;
+	}
+	bench.latencies = malloc(bench.n_frames*sizeof(long));
+	exitif(bench.latencies == NULL, "cannot allocate the latencies");
+	
+	printf("%d frames, %d devices, one frame every %ld us\n",
+		   bench.n_frames, bench.n_devices, bench.period);
+	const char *names[] = {"blocking", "uring"};
+	for (int io = IO_BLOCKING; io <= IO_URING; ++io) {
+		bench.io = io;
+		printf("%s:\n", names[io]);
+		if (io == IO_URING) {
+			uring_t *uring = uring_init(1);
+			if (uring == NULL) {
+				printf("  io_uring is not supported\n");
+				continue;
+			}
+			uring_clean(uring);
+		}
+		bench_reads(&bench);
+		bench_writes(&bench, output);
+	}
+	free(bench.latencies);
+	return EXIT_SUCCESS;
+}
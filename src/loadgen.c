@@ -0,0 +1,293 @@
+/*
+ * kerpad-loadgen creates a virtual touchpad
+ * and drives it with scripted or random gestures,
+ * to stress kerpad without a finger
+ *
+ * The gestures can also be written in a capture file,
+ * as fast as possible, to be read by kerpad-analyze
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <time.h>
+#include <linux/uinput.h>
+
+#include "gesture.h"
+#include "capture.h"
+#include "util.h"
+
+#define DEFAULT_NAME "Kerpad Loadgen Touchpad"
+#define DEFAULT_RATE 125
+// units per millimeter
+#define RESOLUTION 40
+
+#define MT_OPTION   256
+#define SEED_OPTION 257
+
+static volatile sig_atomic_t running = true;
+
+static struct option long_options[] = {
+	{"name", required_argument, NULL, 'n'},
+	{"rate", required_argument, NULL, 'r'},
+	{"scenario", required_argument, NULL, 's'},
+	{"file", required_argument, NULL, 'f'},
+	{"loop", no_argument, NULL, 'l'},
+	{"duration", required_argument, NULL, 'd'},
+	{"maxx", required_argument, NULL, 'X'},
+	{"maxy", required_argument, NULL, 'Y'},
+	{"capture", required_argument, NULL, 'c'},
+	{"mt", no_argument, NULL, MT_OPTION},
+	{"seed", required_argument, NULL, SEED_OPTION},
+	{"verbose", no_argument, NULL, 'v'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0},
+};
+
+static void handler(int signum) {
+	(void)signum;
+	running = false;
+}
+
+static void print_help(char *argv[]) {
+	printf("Usage: %s [options]\n", argv[0]);
+	printf("Create a virtual touchpad and drive it with gestures.\n\n");
+	printf("    -n, --name=NAME       name of the touchpad (default: "DEFAULT_NAME")\n");
+	printf("    -r, --rate=RATE       frames per second (default: %d)\n", DEFAULT_RATE);
+	printf("    -s, --scenario=NAME   edge-dwell, edge-scroll, double-tap or random\n");
+	printf("                          (default: random)\n");
+	printf("    -f, --file=FILE       read the gestures from FILE, each line is one of:\n");
+	printf("                            touch X Y, move X Y MS, wait MS,\n");
+	printf("                            press, release, lift\n");
+	printf("    -l, --loop            restart the gestures when they end\n");
+	printf("    -d, --duration=SEC    stop after SEC seconds\n");
+	printf("    -X, --maxx=MAX_X      max x of the touchpad (default: %d)\n", GESTURE_DEFAULT_MAXX);
+	printf("    -Y, --maxy=MAX_Y      max y of the touchpad (default: %d)\n", GESTURE_DEFAULT_MAXY);
+	printf("    -c, --capture=FILE    write the events in the capture FILE, without\n");
+	printf("                          waiting, instead of creating a touchpad\n");
+	printf("        --mt              also generate multi-touch events\n");
+	printf("        --seed=SEED       seed of the random gestures\n");
+	printf("    -v, --verbose         print statistics at the end\n");
+	printf("    -h, --help            display this help and exit\n");
+}
+
+static void set_abs(int fd, int code, int max, int resolution) {
+	struct uinput_abs_setup abs = {
+		.code = code,
+		.absinfo = {
+			.minimum = 0,
+			.maximum = max,
+			.resolution = resolution,
+		},
+	};
+	exitif(ioctl(fd, UI_SET_ABSBIT, code) == -1, "ioctl set absbit");
+	exitif(ioctl(fd, UI_ABS_SETUP, &abs) == -1, "ioctl abs setup");
+}
+
+/**
+ * Create the virtual touchpad and return its file descriptor
+ */
+static int create_touchpad(const char *name, gesture_settings_t *settings) {
+	int fd = open("/dev/uinput", O_WRONLY);
+	exitif(fd == -1, "cannot open /dev/uinput");
+	
+	exitif(ioctl(fd, UI_SET_EVBIT, EV_KEY) == -1, "ioctl set evbit");
+	ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH);
+	ioctl(fd, UI_SET_KEYBIT, BTN_TOOL_FINGER);
+	ioctl(fd, UI_SET_KEYBIT, BTN_MOUSE);
+	
+	exitif(ioctl(fd, UI_SET_EVBIT, EV_ABS) == -1, "ioctl set evbit");
+	set_abs(fd, ABS_X, settings->maxx, RESOLUTION);
+	set_abs(fd, ABS_Y, settings->maxy, RESOLUTION);
+	if (settings->mt) {
+		set_abs(fd, ABS_MT_SLOT, 0, 0);
+		set_abs(fd, ABS_MT_TRACKING_ID, 65535, 0);
+		set_abs(fd, ABS_MT_POSITION_X, settings->maxx, RESOLUTION);
+		set_abs(fd, ABS_MT_POSITION_Y, settings->maxy, RESOLUTION);
+	}
+	ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_POINTER);
+	
+	struct uinput_setup usetup = {};
+	usetup.id.bustype = BUS_VIRTUAL;
+	usetup.id.vendor = 0x1234;
+	usetup.id.product = 0x5679;
+	strncpy(usetup.name, name, UINPUT_MAX_NAME_SIZE-1);
+	exitif(ioctl(fd, UI_DEV_SETUP, &usetup) == -1, "ioctl dev setup");
+	exitif(ioctl(fd, UI_DEV_CREATE) == -1, "ioctl dev create");
+	// let the listeners find the device
+	sleep(1);
+	return fd;
+}
+
+/**
+ * Write the gestures in a capture file, with the time
+ * of the gestures as the time of the events
+ */
+static void write_capture(const char *path, gesture_t *gesture,
+						  gesture_settings_t *settings, double duration, bool verbose) {
+	int fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	exitif(fd == -1, "cannot open %s", path);
+	struct input_absinfo x = {
+		.minimum = settings->minx,
+		.maximum = settings->maxx,
+		.resolution = RESOLUTION,
+	};
+	struct input_absinfo y = {
+		.minimum = settings->miny,
+		.maximum = settings->maxy,
+		.resolution = RESOLUTION,
+	};
+	exitif(capture_write_header(fd, &x, &y) == -1, "cannot write to %s", path);
+	FILE *file = fdopen(fd, "w");
+	exitif(file == NULL, "cannot write to %s", path);
+	
+	unsigned long frames = 0;
+	unsigned long events = 0;
+	while (running && !gesture_done(gesture)) {
+		struct input_event frame[GESTURE_FRAME_SIZE];
+		int n = gesture_next_frame(gesture, frame);
+		if (duration > 0 && gesture_time(gesture) >= duration*1000000) break;
+		if (n == 0) continue;
+		exitif(fwrite(frame, sizeof(*frame), n, file) != (size_t)n, "cannot write to %s", path);
+		++frames;
+		events += n;
+	}
+	exitif(fclose(file) == EOF, "cannot write to %s", path);
+	if (verbose) {
+		printf("%lu frames, %lu events, %.3fs of gestures written to %s\n",
+			   frames, events, gesture_time(gesture)/1e6, path);
+	}
+}
+
+static long timespec_us(struct timespec *ts) {
+	return ts->tv_sec*1000000L+ts->tv_nsec/1000;
+}
+
+int main(int argc, char *argv[]) {
+	const char *name = DEFAULT_NAME;
+	const char *scenario = "random";
+	const char *file = NULL;
+	const char *capture = NULL;
+	double duration = 0;
+	bool verbose = false;
+	gesture_settings_t settings = {
+		.minx = 0,
+		.maxx = GESTURE_DEFAULT_MAXX,
+		.miny = 0,
+		.maxy = GESTURE_DEFAULT_MAXY,
+		.rate = DEFAULT_RATE,
+		.seed = time(NULL),
+	};
+	
+	while (1) {
+		int opt = getopt_long(argc, argv, "n:r:s:f:ld:X:Y:c:vh", long_options, NULL);
+		if (opt == -1) break;
+		
+		switch (opt) {
+		case 'n': name = optarg; break;
+		case 'r': settings.rate = atoi(optarg); break;
+		case 's': scenario = optarg; break;
+		case 'f': file = optarg; break;
+		case 'l': settings.loop = true; break;
+		case 'd': duration = atof(optarg); break;
+		case 'X': settings.maxx = atoi(optarg); break;
+		case 'Y': settings.maxy = atoi(optarg); break;
+		case 'c': capture = optarg; break;
+		case MT_OPTION: settings.mt = true; break;
+		case SEED_OPTION: settings.seed = strtoul(optarg, NULL, 10); break;
+		case 'v': verbose = true; break;
+		case 'h':
+			print_help(argv);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv);
+			return EXIT_FAILURE;
+		}
+	}
+	if (settings.rate <= 0 || settings.rate > 1000000) {
+		error_message("invalid rate: %d", settings.rate);
+		return EXIT_FAILURE;
+	}
+	
+	char *script = NULL;
+	if (file) {
+		script = gesture_read_script(file);
+		if (!script) return EXIT_FAILURE;
+	} else if (strcmp(scenario, "random")) {
+		script = gesture_scenario(scenario, &settings);
+		if (!script) {
+			error_message("unknown scenario: %s", scenario);
+			return EXIT_FAILURE;
+		}
+	}
+	settings.script = script;
+	settings.random = !script;
+	gesture_t *gesture = gesture_init(&settings);
+	if (!gesture) return EXIT_FAILURE;
+	
+	struct sigaction sig = {
+		.sa_handler = handler,
+	};
+	sigemptyset(&sig.sa_mask);
+	exitif(sigaction(SIGINT, &sig, NULL) == -1, "error on sigaction");
+	exitif(sigaction(SIGTERM, &sig, NULL) == -1, "error on sigaction");
+	
+	if (capture) {
+		if (duration <= 0 && (settings.random || settings.loop)) {
+			error_message("endless gestures cannot be captured without --duration");
+			return EXIT_FAILURE;
+		}
+		write_capture(capture, gesture, &settings, duration, verbose);
+		gesture_clean(gesture);
+		free(script);
+		return EXIT_SUCCESS;
+	}
+	
+	int fd = create_touchpad(name, &settings);
+	
+	unsigned long frames = 0;
+	unsigned long events = 0;
+	long max_late = 0;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (running && !gesture_done(gesture)) {
+		struct input_event frame[GESTURE_FRAME_SIZE];
+		int n = gesture_next_frame(gesture, frame);
+		long frame_time = gesture_time(gesture);
+		if (duration > 0 && frame_time >= duration*1000000) break;
+		
+		long deadline = timespec_us(&start)+frame_time;
+		struct timespec ts = {
+			.tv_sec = deadline/1000000,
+			.tv_nsec = deadline%1000000*1000,
+		};
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		if (n == 0) continue;
+		
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_us(&now)-deadline > max_late) max_late = timespec_us(&now)-deadline;
+		exitif(write(fd, frame, n*sizeof(*frame)) == -1, "cannot write to /dev/uinput");
+		++frames;
+		events += n;
+	}
+	
+	if (verbose) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double elapsed = (timespec_us(&now)-timespec_us(&start))/1e6;
+		printf("%lu frames, %lu events in %.3fs (%.1f frames/s), max lateness %ldus\n",
+			   frames, events, elapsed, frames/elapsed, max_late);
+	}
+	
+	ioctl(fd, UI_DEV_DESTROY);
+	close(fd);
+	gesture_clean(gesture);
+	free(script);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,211 @@
+/*
+ * This file is responsible for printing
+ * diagnostics without slowing the threads
+ * that produce them
+ *
+ * Each thread pushes fixed-size records in its own
+ * single-producer/single-consumer queue, and a low-priority
+ * thread formats and prints them periodically
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+
+#include "logger.h"
+#include "util.h"
+
+#define LOGGER_MAX_THREADS 8
+// must be a power of 2
+#define LOGGER_QUEUE_SIZE 256
+// time between two prints in microseconds
+#define LOGGER_FLUSH_INTERVAL 20000
+#define LOGGER_NICE 19
+// the prints can be delayed to be grouped
+// with other wake ups, in nanoseconds
+#define LOGGER_TIMER_SLACK 10000000
+
+#define CACHE_LINE_SIZE 64
+
+struct record {
+	int category;
+	const char *format;
+	long args[LOG_MAX_ARGS];
+};
+
+struct logger_queue {
+	// written by the producer only
+	_Alignas(CACHE_LINE_SIZE) atomic_uint head;
+	// written by the logger thread only
+	_Alignas(CACHE_LINE_SIZE) atomic_uint tail;
+	struct record records[LOGGER_QUEUE_SIZE];
+};
+
+struct category {
+	atomic_bool enabled;
+	// second of the current rate limit window
+	atomic_long window;
+	// records pushed during the window
+	atomic_int count;
+	atomic_ulong printed;
+	atomic_ulong dropped;
+	atomic_ulong limited;
+};
+
+static const char *category_names[LOG_N_CATEGORIES] = {
+	"motion", "scroll", "resync",
+};
+
+static struct {
+	struct logger_queue queues[LOGGER_MAX_THREADS];
+	atomic_int n_queues;
+	struct category categories[LOG_N_CATEGORIES];
+	
+	kclock_t *clock;
+	int rate;
+	pthread_t thread;
+	atomic_bool stopped;
+	bool started;
+} logger;
+
+// queue of the calling thread, -1 if none
+static _Thread_local int thread_queue = -1;
+
+/**
+ * Print the pending records of all queues
+ */
+static void flush_queues() {
+	int n_queues = atomic_load(&logger.n_queues);
+	if (n_queues > LOGGER_MAX_THREADS) n_queues = LOGGER_MAX_THREADS;
+	for (int i = 0; i < n_queues; ++i) {
+		struct logger_queue *queue = logger.queues+i;
+		unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+		for (; tail != head; ++tail) {
+			struct record *record = queue->records+(tail&(LOGGER_QUEUE_SIZE-1));
+			printf(record->format, record->args[0], record->args[1], record->args[2]);
+			printf("\n");
+			atomic_fetch_add(&logger.categories[record->category].printed, 1);
+		}
+		atomic_store_explicit(&queue->tail, tail, memory_order_release);
+	}
+	fflush(stdout);
+}
+
+/**
+ * Thread responsible for printing the records
+ */
+static void *logger_thread(void *arg) {
+	(void)arg;
+	// the diagnostics must not delay the other threads
+	setpriority(PRIO_PROCESS, syscall(SYS_gettid), LOGGER_NICE);
+	prctl(PR_SET_TIMERSLACK, LOGGER_TIMER_SLACK);
+	
+	while (!atomic_load(&logger.stopped)) {
+		flush_queues();
+		struct timespec ts = {
+			.tv_sec = 0,
+			.tv_nsec = LOGGER_FLUSH_INTERVAL*1000L,
+		};
+		nanosleep(&ts, NULL);
+	}
+	flush_queues();
+	return NULL;
+}
+
+void logger_init(kclock_t *clock, int rate) {
+	for (int i = 0; i < LOGGER_MAX_THREADS; ++i) {
+		atomic_init(&logger.queues[i].head, 0);
+		atomic_init(&logger.queues[i].tail, 0);
+	}
+	atomic_init(&logger.n_queues, 0);
+	for (int i = 0; i < LOG_N_CATEGORIES; ++i) {
+		struct category *cat = logger.categories+i;
+		atomic_init(&cat->enabled, false);
+		atomic_init(&cat->window, -1);
+		atomic_init(&cat->count, 0);
+		atomic_init(&cat->printed, 0);
+		atomic_init(&cat->dropped, 0);
+		atomic_init(&cat->limited, 0);
+	}
+	logger.clock = clock;
+	logger.rate = rate;
+	atomic_init(&logger.stopped, false);
+	exitif(pthread_create(&logger.thread, NULL, logger_thread, NULL) != 0,
+		   "cannot create the logger thread");
+	logger.started = true;
+}
+
+void logger_enable(int category) {
+	atomic_store(&logger.categories[category].enabled, true);
+}
+
+/**
+ * Return false if the rate limit
+ * of the category is reached
+ */
+static bool within_rate(struct category *cat) {
+	long second = kclock_now(logger.clock)/1000000;
+	long window = atomic_load_explicit(&cat->window, memory_order_relaxed);
+	if (window != second
+		&& atomic_compare_exchange_strong(&cat->window, &window, second))
+		atomic_store(&cat->count, 0);
+	return atomic_fetch_add(&cat->count, 1) < logger.rate;
+}
+
+void logger_push_args(int category, const char *format, long args[LOG_MAX_ARGS]) {
+	struct category *cat = logger.categories+category;
+	if (!atomic_load_explicit(&cat->enabled, memory_order_relaxed)) return;
+	if (!within_rate(cat)) {
+		atomic_fetch_add_explicit(&cat->limited, 1, memory_order_relaxed);
+		return;
+	}
+	
+	if (thread_queue < 0) thread_queue = atomic_fetch_add(&logger.n_queues, 1);
+	if (thread_queue >= LOGGER_MAX_THREADS) {
+		// too many threads
+		atomic_fetch_add_explicit(&cat->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	
+	struct logger_queue *queue = logger.queues+thread_queue;
+	unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	if (head-atomic_load_explicit(&queue->tail, memory_order_acquire) == LOGGER_QUEUE_SIZE) {
+		atomic_fetch_add_explicit(&cat->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	struct record *record = queue->records+(head&(LOGGER_QUEUE_SIZE-1));
+	record->category = category;
+	record->format = format;
+	memcpy(record->args, args, sizeof(record->args));
+	atomic_store_explicit(&queue->head, head+1, memory_order_release);
+}
+
+void logger_get_stats(int category, logger_stats_t *stats) {
+	struct category *cat = logger.categories+category;
+	stats->printed = atomic_load(&cat->printed);
+	stats->dropped = atomic_load(&cat->dropped);
+	stats->limited = atomic_load(&cat->limited);
+}
+
+void logger_clean() {
+	if (!logger.started) return;
+	atomic_store(&logger.stopped, true);
+	pthread_join(logger.thread, NULL);
+	logger.started = false;
+	
+	for (int i = 0; i < LOG_N_CATEGORIES; ++i) {
+		logger_stats_t stats;
+		logger_get_stats(i, &stats);
+		if (stats.dropped || stats.limited)
+			fprintf(stderr, "log %s: %lu printed, %lu dropped, %lu rate limited\n",
+					category_names[i], stats.printed, stats.dropped, stats.limited);
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef __LOGGER_H__
+#define __LOGGER_H__
+
+#include <stdbool.h>
+
+#include "clock.h"
+
+// coordinates while moving the mouse at the edge
+#define LOG_MOTION 0
+// scrolled values
+#define LOG_SCROLL 1
+// recovery after the kernel dropped touchpad events
+#define LOG_RESYNC 2
+#define LOG_N_CATEGORIES 3
+
+#define LOG_MAX_ARGS 3
+
+// default number of records
+// printed per category per second
+#define DEFAULT_LOG_RATE 50
+
+struct logger_stats {
+	// records printed
+	unsigned long printed;
+	// records dropped because a queue was full
+	unsigned long dropped;
+	// records dropped by the rate limit
+	unsigned long limited;
+};
+typedef struct logger_stats logger_stats_t;
+
+/**
+ * Init the logger and start its thread
+ * All categories are disabled
+ *
+ * clock: gives the time used by the rate limits
+ * rate: max number of records printed per category per second
+ */
+void logger_init(kclock_t *clock, int rate);
+
+/**
+ * Enable a category
+ */
+void logger_enable(int category);
+
+/**
+ * Push a record in the queue of the calling thread,
+ * it will be printed on the standard output by the logger thread
+ *
+ * This function does not lock, allocate nor do any syscall
+ * The record is dropped if the category is disabled,
+ * if its rate limit is reached or if the queue is full
+ *
+ * format: string literal with at most LOG_MAX_ARGS
+ *         %ld conversions
+ */
+#define logger_push(category, format, ...) \
+	logger_push_args(category, format, (long[LOG_MAX_ARGS]){__VA_ARGS__})
+
+void logger_push_args(int category, const char *format, long args[LOG_MAX_ARGS]);
+
+/**
+ * Write the statistics of a category in stats
+ */
+void logger_get_stats(int category, logger_stats_t *stats);
+
+/**
+ * Print the pending records, stop the logger thread
+ * and print the drop counters if records were dropped
+ */
+void logger_clean();
+
+#endif // !__LOGGER_H__
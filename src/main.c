@@ -6,19 +6,63 @@
 #include <string.h>
 #include <getopt.h>
 #include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
 
 #include "touchpad.h"
 #include "mouse.h"
+#include "sink.h"
 #include "util.h"
+#include "realtime.h"
+#include "clock.h"
+#include "gesture.h"
+#include "logger.h"
+#include "tracer.h"
+#include "recorder.h"
+#include "startup.h"
+#include "guard.h"
+#include "uring.h"
+#include "core.h"
 
 #define UNUSED(x) ((void)x);
 
 #define DEFAULT_SLEEP_TIME 3000
-#define CORNER_SLEEP_TIME(time) (time*1414/1000)
 #define CURSOR_SPEED 1
 
 #define DEFAULT_SCROLL_SLEEP_TIME 5000
 #define DEFAULT_SCROLL_DIV 50
+// default time constant of the momentum, in milliseconds
+#define DEFAULT_MOMENTUM 300
+// default divisor of the pointer movements
+// of the grabbed touchpads
+#define DEFAULT_POINTER_DIV 2
+
+// default max number of wake ups per second
+// of the edge thread in power save mode
+#define DEFAULT_POWER_SAVE_BUDGET 60
+// the timer slack is the tick period divided by this value
+#define POWER_SAVE_SLACK_DIV 4
+
+// report period of the touchpads assumed by --frame-sync
+// before it is measured, in microseconds
+#define FRAME_SYNC_PERIOD 10000
+// longer intervals between frames are pauses
+// of the finger, not the report period
+#define FRAME_SYNC_MAX_PERIOD 50000
+// the timer moves the cursor when no frame
+// came for this number of report periods
+#define FRAME_SYNC_TIMEOUT 2
+
+#define DEFAULT_SIMULATION_RATE 100
+#define SIMULATION_SEED 1
+
+// ids of the threads for the clock
+#define LISTENING_THREAD_ID      0
+#define EDGE_MOTION_THREAD_ID    1
+#define EDGE_SCROLLING_THREAD_ID 2
 
 // ANSI escapes
 #define WHITE        "\e[00m"
@@ -39,47 +83,140 @@
 #define HORIZONTAL_SCROLLING_OPTION 260
 #define SCROLL_DIV_OPTION           261
 #define NO_EDGE_MOTION_OPTION       262
+#define REALTIME_OPTION             263
+#define RT_PRIORITY_OPTION          264
+#define CPUS_OPTION                 265
+#define ALL_TOUCHPADS_OPTION        266
+#define OUTPUT_OPTION               267
+#define SIMULATE_OPTION             268
+#define GESTURES_OPTION             269
+#define SIMULATION_RATE_OPTION      270
+#define LOG_RATE_OPTION             271
+#define IO_OPTION                   272
+#define POWER_SAVE_OPTION           273
+#define REPORT_RATE_OPTION          274
+#define REPORT_PHASE_OPTION         275
+#define CHROME_TRACE_OPTION         276
+#define MOMENTUM_OPTION             277
+#define GRAB_OPTION                 278
+#define STARTUP_REPORT_OPTION       279
+#define FRAME_SYNC_OPTION           280
+#define STATS_OPTION                281
+#define FLIGHT_RECORDER_OPTION      282
+#define NO_FLIGHT_RECORDER_OPTION   283
+#define REPLAY_OPTION               284
+#define SIMULATE_CORE_OPTION        285
 
 static bool running = true;
 // To concurently access running
 static pthread_mutex_t running_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static mouse_t *mouse = NULL;
+static sink_t *sink = NULL;
+static kclock_t *kclock = NULL;
 static touchpad_t *touchpad = NULL;
 
 static bool edge_motion = true;
 
-static int minx = -1;
-static int miny = -1;
+// settings of the devices found without the -n option
+// and initial settings of the devices given with -n
+static touchpad_settings_t default_settings = {
+	.device_name = NULL,
+	.all = false,
+	.minx = -1,
+	.maxx = -1,
+	.miny = -1,
+	.maxy = -1,
+	.edge_thickness = -1,
+	.no_edge_protection = false,
+};
+
+// settings of the devices given with -n
+static touchpad_settings_t device_settings[MAX_TOUCHPADS];
+static int n_devices = 0;
 
-static int maxx = -1;
-static int maxy = -1;
+// settings changed by the edge limits options:
+// the ones of the last device given with -n,
+// or default_settings if -n was not used yet
+static touchpad_settings_t *current_settings = &default_settings;
 
-static int edge_thickness = -1;
+// if true, it will listen to every device
+// that looks like a touchpad
+static bool all_touchpads = false;
 
 static int sleep_time = DEFAULT_SLEEP_TIME;
 static int scroll_sleep_time = DEFAULT_SCROLL_SLEEP_TIME;
 
-static bool no_edge_protection = false;
 static bool disable_double_tap = false;
 
 static int list = LIST_NO;
 
-// if non null,
-// it will listen to a device
-// with this name
-static char *device_name = NULL;
-
 // if non null,
 // it will display coordinates
 static bool verbose = false;
+// max number of verbose lines per category per second
+static int log_rate = DEFAULT_LOG_RATE;
+// if non null, a timeline of the threads
+// is written in this file when kerpad stops
+static char *chrome_trace = NULL;
+// if true, the time taken by each
+// phase of the startup is printed
+static bool startup_report_enabled = false;
+// if positive, the statistics of the frames are
+// printed every stats_interval seconds
+static int stats_interval = 0;
+// set to 1 when kerpad stops, wakes up the
+// main thread that prints the statistics
+static atomic_int stats_stopped = 0;
+// directory of the dumps of the flight recorder,
+// NULL if it is disabled
+static const char *recorder_dir = DEFAULT_RECORDER_DIR;
 
 static bool edge_scrolling = false;
 
+// if positive, the edge motion and the edge scrolling
+// share one thread woken up at most power_save times per second
+static int power_save = 0;
+
+// if true, the edge motion steps are done by the listening
+// thread when frames are applied, and by the edge motion
+// thread only when the frames stop
+static bool frame_sync = false;
+// state of the edge motion with --frame-sync, shared by
+// the listening thread and the edge motion thread
+static struct {
+	pthread_mutex_t mutex;
+	// estimated report period of the touchpad
+	long period;
+	// time of the last applied frame, and of the last frame
+	// that moved the cursor, -1 if none
+	long last_frame;
+	long last_frame_step;
+	// time of the last step, -1 if the motion is stopped
+	long last_step;
+	long carry;
+} frame_state = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.period = FRAME_SYNC_PERIOD,
+	.last_frame = -1,
+	.last_frame_step = -1,
+	.last_step = -1,
+	.carry = 0,
+};
+
 // When edge scrolling is applied
 // the scrolling value will be devided by this variable
 static int scroll_div = DEFAULT_SCROLL_DIV;
 
+// if positive, the edge scrolling continues after the finger
+// left the edge, and slows down with this time constant in ms
+static int momentum = 0;
+
+// if positive, the touchpads are grabbed and kerpad
+// moves the pointer itself, by the finger movements
+// divided by this value
+static int grab = 0;
+
 static bool left_edge_scrolling = false;
 static bool right_edge_scrolling = true;
 static bool top_edge_scrolling = false;
@@ -92,6 +229,56 @@ static bool bottom_edge_scrolling = true;
 // or double tapping it
 static bool move_touched = false;
 
+// where the mouse events are written
+static sink_settings_t output = {
+	.type = SINK_UINPUT,
+	.path = NULL,
+};
+static bool output_given = false;
+// IO_BLOCKING or IO_URING, used to read
+// the touchpads and to write the events
+static int io = IO_BLOCKING;
+// report rate and phase of the written frames
+static mouse_settings_t report = {
+	.report_rate = 0,
+	.report_phase = 0,
+};
+
+// if positive, kerpad runs a simulation
+// of this number of seconds with a virtual clock
+static double simulation_time = 0;
+// built-in scenario, random or script file
+// used for the simulation
+static char *gestures = "random";
+static int simulation_rate = DEFAULT_SIMULATION_RATE;
+static gesture_t *gesture = NULL;
+// if true, the simulated gestures are given to libkerpad
+// in one thread, instead of the threads of kerpad
+static bool simulate_core = false;
+// if positive, the gestures are replayed during this number
+// of seconds in a socket read as a touchpad, with the real clock
+static double replay_time = 0;
+// process writing the replayed frames
+static pid_t replay_pid = -1;
+
+// settings of the edge logic, given by the options
+static core_settings_t core_settings;
+// core_motion_active specialized for core_settings
+static core_motion_active_fn core_motion_active_variant;
+
+// time spent moving the mouse at the edge, and the moved distance,
+// only written by the edge motion thread
+static long motion_active_time = 0;
+static double motion_distance = 0;
+
+// low-latency mode of the listening
+// and edge motion threads
+static realtime_settings_t realtime = {
+	.policy = RT_POLICY_NONE,
+	.priority = -1,
+	.cpus = NULL,
+};
+
 static struct option long_options[] = {
 	{"thickness", required_argument, NULL, 't'},
 	
@@ -104,6 +291,7 @@ static struct option long_options[] = {
 	{"sleep-time", required_argument, NULL, 's'},
 	
 	{"name", required_argument, NULL, 'n'},
+	{"all-touchpads", no_argument, NULL, ALL_TOUCHPADS_OPTION},
 	{"always", no_argument, NULL, 'a'},
 	{"no-edge-protection", no_argument, NULL, NO_EDGE_PROTECTION_OPTION},
 	{"disable-double-tap", no_argument, NULL, DISABLE_DOUBLE_TAP_OPTION},
@@ -111,37 +299,81 @@ static struct option long_options[] = {
 	{"vertical-scrolling", required_argument, NULL, VERTICAL_SCROLLING_OPTION},
 	{"horizontal-scrolling", required_argument, NULL, HORIZONTAL_SCROLLING_OPTION},
 	{"scroll-div", required_argument, NULL, SCROLL_DIV_OPTION},
+	{"momentum", optional_argument, NULL, MOMENTUM_OPTION},
+	{"grab", optional_argument, NULL, GRAB_OPTION},
 	{"no-edge-motion", no_argument, NULL, NO_EDGE_MOTION_OPTION},
+	{"realtime", optional_argument, NULL, REALTIME_OPTION},
+	{"rt-priority", required_argument, NULL, RT_PRIORITY_OPTION},
+	{"cpus", required_argument, NULL, CPUS_OPTION},
+	{"output", required_argument, NULL, OUTPUT_OPTION},
+	{"io", required_argument, NULL, IO_OPTION},
+	{"report-rate", required_argument, NULL, REPORT_RATE_OPTION},
+	{"report-phase", required_argument, NULL, REPORT_PHASE_OPTION},
+	{"power-save", optional_argument, NULL, POWER_SAVE_OPTION},
+	{"frame-sync", no_argument, NULL, FRAME_SYNC_OPTION},
+	{"simulate", required_argument, NULL, SIMULATE_OPTION},
+	{"gestures", required_argument, NULL, GESTURES_OPTION},
+	{"simulation-rate", required_argument, NULL, SIMULATION_RATE_OPTION},
+	{"simulate-core", no_argument, NULL, SIMULATE_CORE_OPTION},
+	{"replay", required_argument, NULL, REPLAY_OPTION},
 	{"list", optional_argument, NULL, 'l'},
 	{"verbose", no_argument, NULL, 'v'},
+	{"log-rate", required_argument, NULL, LOG_RATE_OPTION},
+	{"chrome-trace", required_argument, NULL, CHROME_TRACE_OPTION},
+	{"startup-report", no_argument, NULL, STARTUP_REPORT_OPTION},
+	{"stats", required_argument, NULL, STATS_OPTION},
+	{"flight-recorder", required_argument, NULL, FLIGHT_RECORDER_OPTION},
+	{"no-flight-recorder", no_argument, NULL, NO_FLIGHT_RECORDER_OPTION},
 	{"help", no_argument, NULL, 'h'},
 	
 	{"hey", optional_argument, NULL, '\n'},
 	{0, 0, 0, 0},
 };
 
+/**
+ * Stop the printing of the statistics
+ * Can be called by a signal handler
+ */
+static void stop_stats() {
+	atomic_store(&stats_stopped, 1);
+	futex_wake(&stats_stopped, 1);
+}
+
 static void handler(int signum) {
 	UNUSED(signum);
 	pthread_mutex_lock(&running_mutex);
 	running = false;
 	pthread_mutex_unlock(&running_mutex);
 	touchpad_stop(touchpad);
+	stop_stats();
+}
+
+static void dump_handler(int signum) {
+	UNUSED(signum);
+	recorder_anomaly(RECORDER_REQUEST, 0);
 }
 
+/**
+ * Block SIGINT and SIGTERM, the threads created
+ * afterwards keep them blocked, so handler only
+ * runs in the main thread
+ */
 static void block_sigint() {
 	sigset_t set;
 	sigemptyset(&set);
 	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
 	exitif(sigprocmask(SIG_BLOCK, &set, NULL) == -1,
-			"error while blocking SIGINT");
+			"error while blocking SIGINT and SIGTERM");
 }
 
 static void unblock_sigint() {
 	sigset_t set;
 	sigemptyset(&set);
 	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
 	exitif(sigprocmask(SIG_UNBLOCK, &set, NULL) == -1,
-			"error while unblocking SIGINT");
+			"error while unblocking SIGINT and SIGTERM");
 }
 
 static void init_sighanlder() {
@@ -154,6 +386,51 @@ static void init_sighanlder() {
 			"error on sigemptyset");
 	exitif(sigaction(SIGINT, &new_sig, &old_sig) == -1,
 			"error on sigaction");
+	// so the statistics and the trace are also
+	// written when kerpad is stopped by a service manager
+	exitif(sigaction(SIGTERM, &new_sig, &old_sig) == -1,
+			"error on sigaction");
+	// dumps the flight records on demand
+	new_sig.sa_handler = dump_handler;
+	exitif(sigaction(SIGUSR1, &new_sig, &old_sig) == -1,
+			"error on sigaction");
+}
+
+/**
+ * Move the pointer by the movements of the grabbed
+ * touchpads, and write their buttons
+ *
+ * carry: remainders of the divisions by grab,
+ * kept between the calls
+ */
+static void pointer_step(int carry[2]) {
+	touchpad_pointer_t pointer;
+	touchpad_get_pointer(touchpad, &pointer);
+	if (pointer.dx || pointer.dy) {
+		carry[0] += pointer.dx;
+		carry[1] += pointer.dy;
+		int dx = carry[0]/grab;
+		int dy = carry[1]/grab;
+		carry[0] -= dx*grab;
+		carry[1] -= dy*grab;
+		if (dx || dy) {
+			mouse_move(mouse, dx, dy);
+			recorder_motion(dx, dy);
+		}
+	}
+	for (int i = 0; i < pointer.n_buttons; ++i)
+		mouse_button(mouse, pointer.buttons[i].code, pointer.buttons[i].value);
+}
+
+static void frame_step();
+
+/**
+ * Sleep until the next tick of the calling thread,
+ * and record its wake up in the flight recorder
+ */
+static void tick_sleep_until(long time) {
+	kclock_sleep_until(kclock, time);
+	recorder_wakeup(time);
 }
 
 /**
@@ -161,23 +438,251 @@ static void init_sighanlder() {
  */
 static void *touchpad_listening_thread(void *arg) {
 	UNUSED(arg);
+	realtime_apply_thread(&realtime, "listening");
+	tracer_thread("listening");
+	recorder_thread("listening");
+	kclock_enter(kclock, LISTENING_THREAD_ID);
+	int carry[2] = {0, 0};
 	
 	pthread_mutex_lock(&running_mutex);
 	while (running) {
 		pthread_mutex_unlock(&running_mutex);
 		touchpad_read_next_event(touchpad);
+		if (grab) pointer_step(carry);
+		if (frame_sync && edge_motion) frame_step();
+		pthread_mutex_lock(&running_mutex);
+	}
+	pthread_mutex_unlock(&running_mutex);
+	
+	kclock_leave(kclock);
+	return NULL;
+}
+
+/**
+ * Thread responsible for giving simulated
+ * touchpad events, at their virtual time
+ */
+static void *simulated_listening_thread(void *arg) {
+	UNUSED(arg);
+	tracer_thread("listening");
+	recorder_thread("listening");
+	kclock_enter(kclock, LISTENING_THREAD_ID);
+	int carry[2] = {0, 0};
+	
+	pthread_mutex_lock(&running_mutex);
+	while (running) {
+		pthread_mutex_unlock(&running_mutex);
+		struct input_event frame[GESTURE_FRAME_SIZE];
+		int n = gesture_next_frame(gesture, frame);
+		long time = gesture_time(gesture);
+		if (gesture_done(gesture) || time >= simulation_time*1000000) break;
+		if (n) {
+			kclock_sleep_until(kclock, time);
+			touchpad_feed_events(touchpad, frame, n);
+			if (grab) pointer_step(carry);
+			if (frame_sync && edge_motion) frame_step();
+		}
 		pthread_mutex_lock(&running_mutex);
 	}
 	pthread_mutex_unlock(&running_mutex);
 	
+	// the simulation is over
+	pthread_mutex_lock(&running_mutex);
+	running = false;
+	pthread_mutex_unlock(&running_mutex);
+	touchpad_stop(touchpad);
+	stop_stats();
+	
+	kclock_leave(kclock);
 	return NULL;
 }
 
+/**
+ * Write the events of core_feed or core_run
+ * with the mouse, as the threads of kerpad do
+ */
+static void write_core_events(const struct input_event *events, int count) {
+	int dx = 0, dy = 0, wheel = 0, hwheel = 0;
+	for (int i = 0; i < count; ++i) {
+		if (events[i].type != EV_REL) continue;
+		switch (events[i].code) {
+		case REL_X: dx = events[i].value; break;
+		case REL_Y: dy = events[i].value; break;
+		case REL_WHEEL_HI_RES: wheel = events[i].value; break;
+		case REL_HWHEEL_HI_RES: hwheel = events[i].value; break;
+		}
+	}
+	if (dx && dy) mouse_move(mouse, dx, dy);
+	else if (dx) mouse_move_x(mouse, dx);
+	else if (dy) mouse_move_y(mouse, dy);
+	if (wheel) mouse_scroll_y(mouse, wheel);
+	if (hwheel) mouse_scroll_x(mouse, hwheel);
+}
+
+/**
+ * Thread giving the simulated gestures to libkerpad with
+ * --simulate-core, in place of all the threads of kerpad
+ *
+ * The steps are run at the deadlines of the core, so
+ * the events can be compared with the ones of the threads
+ */
+static void *core_simulation_thread(void *arg) {
+	UNUSED(arg);
+	kclock_enter(kclock, LISTENING_THREAD_ID);
+	core_settings_t settings = core_settings;
+	touchpad_get_limits(touchpad, 0, &settings.limits);
+	core_t core;
+	core_init(&core, &settings);
+	
+	for (;;) {
+		struct input_event frame[GESTURE_FRAME_SIZE];
+		int n = gesture_next_frame(gesture, frame);
+		long time = gesture_time(gesture);
+		if (gesture_done(gesture) || time >= simulation_time*1000000) break;
+		if (!n) continue;
+		struct input_event out[CORE_MAX_OUTPUT];
+		// the steps due before the frame, the ones
+		// due with it are run by core_feed
+		long deadline;
+		while ((deadline = core_deadline(&core)) >= 0 && deadline < time) {
+			kclock_sleep_until(kclock, deadline);
+			write_core_events(out, core_run(&core, deadline, out));
+		}
+		kclock_sleep_until(kclock, time);
+		write_core_events(out, core_feed(&core, frame, n, time, out));
+	}
+	
+	pthread_mutex_lock(&running_mutex);
+	running = false;
+	pthread_mutex_unlock(&running_mutex);
+	touchpad_stop(touchpad);
+	stop_stats();
+	
+	kclock_leave(kclock);
+	return NULL;
+}
+
+/**
+ * Return the core state of the touchpad given by info
+ */
+static struct core_touchpad info_core(touchpad_info_t *info) {
+	return (struct core_touchpad) {
+		.x = info->x,
+		.y = info->y,
+		.edgex = info->edgex,
+		.edgey = info->edgey,
+		.touched = info->touched,
+		.edge_touched = info->edge_touched,
+		.pressed = info->pressed,
+		.double_tapped = info->double_tapped,
+	};
+}
+
+/**
+ * Return true if the edge motion
+ * is active according to info
+ */
+static bool motion_active(touchpad_info_t *info) {
+	struct core_touchpad state = info_core(info);
+	return core_motion_active_variant(&core_settings, &state);
+}
+
+/**
+ * Move the mouse according to info, as
+ * if elapsed microseconds have passed
+ *
+ * carry: fraction of pixel not moved yet,
+ *        in pixels times microseconds
+ */
+static void motion_step(touchpad_info_t *info, long elapsed, long *carry) {
+	logger_push(LOG_MOTION, "x:%ld y:%ld", info->x, info->y);
+	int step = core_motion_step(&core_settings, info->edgex, info->edgey, elapsed, carry);
+	if (!info->edgex && !info->edgey) return;
+	
+	long begin = tracer_begin();
+	if (info->edgex && info->edgey) {
+		mouse_move(mouse, info->edgex*step, info->edgey*step);
+	} else if (info->edgex) {
+		mouse_move_x(mouse, info->edgex*step);
+	} else {
+		mouse_move_y(mouse, info->edgey*step);
+	}
+	recorder_motion(info->edgex*step, info->edgey*step);
+	motion_distance += (info->edgex && info->edgey)? step*1.414: step;
+	motion_active_time += elapsed;
+	tracer_end(TRACE_MOTION, begin, step);
+}
+
+/**
+ * Move the cursor with --frame-sync, after
+ * the listening thread applied frames
+ *
+ * It also measures the report period of the touchpad
+ */
+static void frame_step() {
+	long now = kclock_now(kclock);
+	touchpad_info_t info = {};
+	touchpad_get_info(touchpad, &info);
+	pthread_mutex_lock(&frame_state.mutex);
+	long interval = now-frame_state.last_frame;
+	if (frame_state.last_frame >= 0 && interval < FRAME_SYNC_MAX_PERIOD)
+		frame_state.period += (interval-frame_state.period)/8;
+	frame_state.last_frame = now;
+	
+	if (motion_active(&info)) {
+		// the first step moves as much as a regular tick
+		long elapsed = frame_state.last_step < 0?
+			core_motion_time(&core_settings, info.edgex, info.edgey):
+			now-frame_state.last_step;
+		motion_step(&info, elapsed, &frame_state.carry);
+		frame_state.last_step = now;
+		frame_state.last_frame_step = now;
+	} else {
+		frame_state.last_step = -1;
+		frame_state.carry = 0;
+	}
+	pthread_mutex_unlock(&frame_state.mutex);
+}
+
+/**
+ * Move the cursor with --frame-sync if the frames stopped,
+ * while the finger stays still at the edge
+ *
+ * Return the time at which it should be called again
+ */
+static long frame_timeout_step(touchpad_info_t *info) {
+	long now = kclock_now(kclock);
+	pthread_mutex_lock(&frame_state.mutex);
+	long next = frame_state.last_frame_step+FRAME_SYNC_TIMEOUT*frame_state.period;
+	if (frame_state.last_frame_step < 0 || now >= next) {
+		long tick = core_motion_time(&core_settings, info->edgex, info->edgey);
+		long elapsed = frame_state.last_step < 0? tick: now-frame_state.last_step;
+		motion_step(info, elapsed, &frame_state.carry);
+		frame_state.last_step = now;
+		next = now+tick;
+	}
+	pthread_mutex_unlock(&frame_state.mutex);
+	return next;
+}
+
+/**
+ * Wait for the edge motion to be activated
+ * after info was given
+ */
+static void motion_wait(touchpad_info_t *info) {
+	if (!move_touched) touchpad_wait_press(touchpad, info);
+	else touchpad_wait_touch_or_press(touchpad, info);
+}
+
 /**
  * Thread responsible for taking care of edge motion
  */
 static void *edge_motion_thread(void *arg) {
 	UNUSED(arg);
+	realtime_apply_thread(&realtime, "edge motion");
+	tracer_thread("edge motion");
+	recorder_thread("edge motion");
+	kclock_enter(kclock, EDGE_MOTION_THREAD_ID);
 	
 	pthread_mutex_lock(&running_mutex);
 	while (running) {
@@ -185,42 +690,100 @@ static void *edge_motion_thread(void *arg) {
 		touchpad_info_t info = {};
 		touchpad_get_info(touchpad, &info);
 		
-		bool active = info.pressed
-			|| (!disable_double_tap && info.double_tapped)
-			|| (move_touched && info.touched);
-		if (active) {
-			if (verbose) printf("x:%d y:%d\n", info.x, info.y);
-			
-			if (info.edgex && info.edgey) {
-				mouse_move(mouse, info.edgex*CURSOR_SPEED, info.edgey*CURSOR_SPEED);
-			} else if (info.edgex) {
-				mouse_move_x(mouse, info.edgex*CURSOR_SPEED);
-			} else if (info.edgey) {
-				mouse_move_y(mouse, info.edgey*CURSOR_SPEED);
-			}
+		if (!motion_active(&info)) {
+			motion_wait(&info);
+		} else if (frame_sync) {
+			tick_sleep_until(frame_timeout_step(&info));
+		} else {
+			// one step of CURSOR_SPEED pixels per tick
+			long time = core_motion_time(&core_settings, info.edgex, info.edgey);
+			long carry = 0;
+			motion_step(&info, time, &carry);
+			tick_sleep_until(kclock_now(kclock)+time);
 		}
 		
-		if (!active) {
-			if (!move_touched) touchpad_wait_press(touchpad);
-			else touchpad_wait_touch_or_press(touchpad);
-		} else if (!info.edgex || !info.edgey) usleep(sleep_time);
-		else usleep(CORNER_SLEEP_TIME(sleep_time));
-		
 		pthread_mutex_lock(&running_mutex);
 	}
 	pthread_mutex_unlock(&running_mutex);
 	
+	kclock_leave(kclock);
 	return NULL;
 }
 
+/**
+ * Scroll of the distance moved at the edge
+ * since the previous tick
+ */
+static void scroll_step(touchpad_info_t *info, struct core_scroll *state) {
+	long begin = tracer_begin();
+	struct core_touchpad core = info_core(info);
+	int wheel, hwheel;
+	core_scroll_step(&core_settings, state, &core, info->device, &wheel, &hwheel);
+	if (wheel) {
+		mouse_scroll_y(mouse, wheel);
+		logger_push(LOG_SCROLL, "scroll y:%ld", wheel);
+	}
+	if (hwheel) {
+		mouse_scroll_x(mouse, hwheel);
+		logger_push(LOG_SCROLL, "scroll x:%ld", hwheel);
+	}
+	if (wheel || hwheel) recorder_scroll(wheel, hwheel);
+	tracer_end(TRACE_SCROLL, begin, info->device);
+}
+
+/**
+ * Start the momentum after the finger left the edge,
+ * with its velocity in the recent frames of the device
+ *
+ * Return true if the momentum started
+ */
+static bool momentum_start(touchpad_info_t *info, struct core_momentum *state) {
+	struct core_sample samples[TOUCHPAD_HISTORY_SIZE];
+	int count = touchpad_get_history(touchpad, info->device, samples, TOUCHPAD_HISTORY_SIZE);
+	return core_momentum_start(&core_settings, state, samples, count, kclock_now(kclock));
+}
+
+/**
+ * Scroll of one tick of the momentum
+ *
+ * Return false once the momentum is stopped
+ */
+static bool momentum_step(struct core_momentum *state) {
+	long begin = tracer_begin();
+	int wheel, hwheel;
+	bool moving = core_momentum_step(&core_settings, state, CORE_MOMENTUM_TICK,
+									 &wheel, &hwheel);
+	if (wheel) {
+		mouse_scroll_y(mouse, wheel);
+		logger_push(LOG_SCROLL, "momentum y:%ld", wheel);
+	}
+	if (hwheel) {
+		mouse_scroll_x(mouse, hwheel);
+		logger_push(LOG_SCROLL, "momentum x:%ld", hwheel);
+	}
+	if (wheel || hwheel) recorder_scroll(wheel, hwheel);
+	tracer_end(TRACE_SCROLL, begin, -1);
+	return moving;
+}
+
 /**
  * Thread responsible for taking care of edge scrolling
  */
 static void *edge_scrolling_thread(void *arg) {
 	UNUSED(arg);
 	
-	int last_x = -1;
-	int last_y = -1;
+	struct core_scroll state = {
+		.last_device = -1,
+	};
+	core_scroll_reset(&state);
+	struct core_momentum momentum_state = {};
+	bool momentum_active = false;
+	// true if the finger is or was at the edge
+	// since the last scroll reset
+	bool scrolled = false;
+	tracer_thread("edge scrolling");
+	recorder_thread("edge scrolling");
+	kclock_enter(kclock, EDGE_SCROLLING_THREAD_ID);
 	
 	pthread_mutex_lock(&running_mutex);
 	while (running) {
@@ -228,37 +791,106 @@ static void *edge_scrolling_thread(void *arg) {
 		touchpad_info_t info = {};
 		touchpad_get_info(touchpad, &info);
 		
-		bool active = info.edge_touched;
-		if (active) {
-			if (last_x < 0) last_x = info.x;
-			if (last_y < 0) last_y = info.y;
-			
-			if ((left_edge_scrolling && info.edgex < 0)
-				|| (right_edge_scrolling && info.edgex > 0)) {
-				// scroll y
-				int diff = info.y-last_y;
-				if (diff) mouse_scroll_y(mouse, diff*120/scroll_div);
-			} else if ((top_edge_scrolling && info.edgey < 0)
-				|| (bottom_edge_scrolling && info.edgey > 0)) {
-				// scroll x
-				int diff = info.x-last_x;
-				if (diff) mouse_scroll_x(mouse, -diff*120/scroll_div);
-			}
-			
-			last_x = info.x;
-			last_y = info.y;
+		if (info.edge_touched) {
+			momentum_active = false;
+			scroll_step(&info, &state);
+			scrolled = true;
+			tick_sleep_until(kclock_now(kclock)+scroll_sleep_time);
+		} else if (scrolled) {
+			// the finger has just left the edge
+			scrolled = false;
+			core_scroll_reset(&state);
+			if (momentum) momentum_active = momentum_start(&info, &momentum_state);
+		} else if (momentum_active && !info.touched && !info.pressed) {
+			momentum_active = momentum_step(&momentum_state);
+			tick_sleep_until(kclock_now(kclock)+CORE_MOMENTUM_TICK);
+		} else {
+			momentum_active = false;
+			core_scroll_reset(&state);
+			touchpad_wait_edge_touch(touchpad, &info);
+		}
+		
+		pthread_mutex_lock(&running_mutex);
+	}
+	pthread_mutex_unlock(&running_mutex);
+	
+	kclock_leave(kclock);
+	return NULL;
+}
+
+/**
+ * Return the tick period of the power save mode in microseconds
+ */
+static long power_save_period() {
+	long period = 1000000/power_save;
+	return period > sleep_time? period: sleep_time;
+}
+
+/**
+ * Thread responsible for the edge motion and
+ * the edge scrolling in power save mode
+ *
+ * Both share one timer, whose period respects the
+ * wakeup budget, and the moves are scaled
+ * to the time elapsed since the previous tick
+ * so the cursor speed does not change
+ */
+static void *power_save_thread(void *arg) {
+	UNUSED(arg);
+	long period = power_save_period();
+	// wake ups can be delayed to be grouped with
+	// others, the moves take the delay into account
+	msgif(prctl(PR_SET_TIMERSLACK, period*1000/POWER_SAVE_SLACK_DIV) == -1,
+		  "warning: cannot set the timer slack");
+	
+	long carry = 0;
+	struct core_scroll state = {
+		.last_device = -1,
+	};
+	core_scroll_reset(&state);
+	tracer_thread("power save");
+	recorder_thread("power save");
+	kclock_enter(kclock, EDGE_MOTION_THREAD_ID);
+	long last_tick = kclock_now(kclock)-period;
+	
+	pthread_mutex_lock(&running_mutex);
+	while (running) {
+		pthread_mutex_unlock(&running_mutex);
+		long now = kclock_now(kclock);
+		if (now-last_tick < period) {
+			// woken up by the touchpad too early
+			// for the budget
+			tick_sleep_until(last_tick+period);
+			now = kclock_now(kclock);
 		}
+		long elapsed = now-last_tick;
+		// after an inactive period, the first tick
+		// moves as much as a regular one
+		if (elapsed > 2*period) elapsed = period;
+		last_tick = now;
 		
-		if (!active) {
-			 last_x = -1;
-			last_y = -1;
-			touchpad_wait_edge_touch(touchpad);
-		} else usleep(scroll_sleep_time);
+		touchpad_info_t info = {};
+		touchpad_get_info(touchpad, &info);
+		bool moving = edge_motion && motion_active(&info);
+		bool scrolling = edge_scrolling && info.edge_touched;
+		if (moving) motion_step(&info, elapsed, &carry);
+		else carry = 0;
+		if (scrolling) scroll_step(&info, &state);
+		else core_scroll_reset(&state);
+		
+		if (moving || scrolling) {
+			tick_sleep_until(last_tick+period);
+		} else if (edge_scrolling) {
+			touchpad_wait_any(touchpad, &info);
+		} else {
+			motion_wait(&info);
+		}
 		
 		pthread_mutex_lock(&running_mutex);
 	}
 	pthread_mutex_unlock(&running_mutex);
 	
+	kclock_leave(kclock);
 	return NULL;
 }
 
@@ -358,7 +990,13 @@ static void print_help(int argc, char *argv[]) {
 				 "will be slightly longer when touching a corner. "
 				 "The default sleep time is "MACRO_TO_STR(DEFAULT_SLEEP_TIME)".");
 	print_option(long_options+i++, 'n', "name", color,
-				 "Specify the touchpad name.");
+				 "Specify the touchpad name. This option can be used several "
+				 "times to listen to several devices. The -t, -x, -X, -y, -Y "
+				 "and --no-edge-protection options given after it only apply "
+				 "to this device.");
+	print_option(long_options+i++, 0, NULL, color,
+				 "Listen to every device that looks like a touchpad, "
+				 "in addition to the ones given with -n.");
 	print_option(long_options+i++, 'a', NULL, color,
 				 "Activate edge motion even "
 				 "when the touchpad is just touched.");
@@ -394,9 +1032,109 @@ static void print_help(int argc, char *argv[]) {
 				 MACRO_TO_STR(DEFAULT_SCROLL_DIV)
 				 ". A negative value can be given to reverse the scroll direction. "
 				 "This option has no effect without the --edge-scrolling option.");
+	print_option(long_options+i++, 0, "MS", color,
+				 "Keep scrolling after the finger left the edge, at the "
+				 "speed it had when it was lifted, slowing down with a "
+				 "time constant of MS milliseconds until it stops or the "
+				 "touchpad is touched again. MS default value is "
+				 MACRO_TO_STR(DEFAULT_MOMENTUM)". This option has no effect "
+				 "without the --edge-scrolling option, and cannot be used "
+				 "with --power-save.");
+	print_option(long_options+i++, 0, "DIV", color,
+				 "Grab the touchpads, so only Kerpad receives their events, "
+				 "and move the pointer with the finger movements divided by "
+				 "DIV. DIV default value is "MACRO_TO_STR(DEFAULT_POINTER_DIV)
+				 ". The left, right and middle buttons are passed through, but "
+				 "everything else libinput does with the touchpad (tap to "
+				 "click, two-finger scrolling, gestures, palm detection) is "
+				 "lost. If the events are not read for "
+				 MACRO_TO_STR(TOUCHPAD_GRAB_TIMEOUT)" ms, the touchpads are "
+				 "released so they are not left unusable.");
 	print_option(long_options+i++, 0, NULL, color,
-				 "Disable edge motion. If used without --edge-scrolling or "
+				 "Disable edge motion. If used without --edge-scrolling, --grab or "
 				 "--list option, Kerpad will do nothing.");
+	print_option(long_options+i++, 0, "POLICY", color,
+				 "Enable the low-latency mode: the listening and edge motion "
+				 "threads use a real-time scheduling policy and the memory "
+				 "is locked. POLICY value can be:\n"
+				 "- fifo: SCHED_FIFO policy (default value)\n"
+				 "- rr: SCHED_RR policy\n"
+				 "If kerpad does not have the required privileges, "
+				 "it falls back to the default scheduling.");
+	print_option(long_options+i++, 0, "PRIO", color,
+				 "Set the real-time priority used by the --realtime option. "
+				 "PRIO default value is "MACRO_TO_STR(DEFAULT_RT_PRIORITY)".");
+	print_option(long_options+i++, 0, "LIST", color,
+				 "Pin the listening and edge motion threads to the cpus in LIST "
+				 "(for example 0,2-3). "
+				 "This option has no effect without the --realtime option.");
+	print_option(long_options+i++, 0, "SINK", color,
+				 "Choose where the mouse events are written. "
+				 "SINK value can be:\n"
+				 "- uinput: a virtual mouse (default value)\n"
+				 "- null: events are only counted\n"
+				 "- memory: events are kept in memory\n"
+				 "- trace:PATH: events are written as text in PATH\n"
+				 "- trace-bin:PATH: events are written as binary "
+				 "input_event structures in PATH\n"
+				 "PATH can be - for the standard output. With other sinks "
+				 "than uinput, statistics are printed when kerpad stops.");
+	print_option(long_options+i++, 0, "BACKEND", color,
+				 "Choose how the touchpads are read and the events written. "
+				 "BACKEND value can be:\n"
+				 "- blocking: read and write system calls (default value)\n"
+				 "- uring: io_uring, a read is kept queued on each "
+				 "touchpad and a single system call waits for any of them. "
+				 "If io_uring is not supported, it falls back to blocking.");
+	print_option(long_options+i++, 0, "HZ", color,
+				 "Write at most HZ frames per second (e.g. 60, 120 or 144 "
+				 "to match the display). The movements and the scrolling "
+				 "are accumulated between two reports, so the speed does "
+				 "not change. By default, each movement is written at once.");
+	print_option(long_options+i++, 0, "US", color,
+				 "Offset in microseconds of the report times of "
+				 "--report-rate on the monotonic clock, between 0 and the "
+				 "report period. US default value is 0.");
+	print_option(long_options+i++, 0, "WAKEUPS", color,
+				 "Save power: the edge motion and the edge scrolling share "
+				 "one timer, woken up at most WAKEUPS times per second, "
+				 "with a timer slack so the kernel can group its wake ups. "
+				 "The cursor moves further at each tick so its speed does "
+				 "not change. WAKEUPS default value is "
+				 MACRO_TO_STR(DEFAULT_POWER_SAVE_BUDGET)".");
+	print_option(long_options+i++, 0, NULL, color,
+				 "Move the cursor at the edge when the touchpad frames are "
+				 "read, by the time elapsed since the previous move, rather "
+				 "than with a timer, so the cursor follows the freshest "
+				 "position and the edge motion thread barely wakes up. The "
+				 "timer is only used when the frames stop (finger pressed "
+				 "but still). Cannot be used with --power-save.");
+	print_option(long_options+i++, 0, "SECONDS", color,
+				 "Instead of listening to a touchpad, simulate SECONDS "
+				 "seconds of use with a virtual clock, as fast as possible, "
+				 "then print statistics. The output is null unless "
+				 "--output is used.");
+	print_option(long_options+i++, 0, "GESTURES", color,
+				 "Gestures used by --simulate and --replay. GESTURES can be random "
+				 "(default value), edge-dwell, edge-scroll, double-tap, or "
+				 "a file where each line is one of: touch X Y, move X Y MS, "
+				 "wait MS, press, release, lift.");
+	print_option(long_options+i++, 0, "RATE", color,
+				 "Frames per second of the gestures of --simulate and --replay. "
+				 "RATE default value is "MACRO_TO_STR(DEFAULT_SIMULATION_RATE)".");
+	print_option(long_options+i++, 0, NULL, color,
+				 "With --simulate, give the gestures to the edge logic of "
+				 "libkerpad (core_feed and core_run) in one thread, instead "
+				 "of running the threads of Kerpad, so both can be compared. "
+				 "Cannot be used with --grab, --frame-sync, --momentum nor "
+				 "--power-save.");
+	print_option(long_options+i++, 0, "SECONDS", color,
+				 "Instead of listening to a touchpad, replay SECONDS "
+				 "seconds of the gestures in real time: a child process "
+				 "writes the frames in a socket that is read as the event "
+				 "file of a touchpad, so the latencies of --stats are the "
+				 "ones of real reads. The output is null unless --output "
+				 "is used. Cannot be used with --simulate.");
 	print_option(long_options+i++, 'l', "WHICH", color,
 				 "List characteristics of input devices and exit. "
 				 "WHICH value can be:\n"
@@ -406,7 +1144,42 @@ static void print_help(int argc, char *argv[]) {
 				 "Display coordinates while "
 				 "pressing the touchpad.\n"
 				 "If combine with -a, it will display the coordinates "
-				 "even when the touchpad is just touched.");
+				 "even when the touchpad is just touched. Scrolled "
+				 "values and touchpad resynchronisations are also displayed.");
+	print_option(long_options+i++, 0, "N", color,
+				 "Display at most N lines per second for each kind of "
+				 "message of the --verbose option, the other lines are "
+				 "dropped and counted. N default value is "
+				 MACRO_TO_STR(DEFAULT_LOG_RATE)".");
+	print_option(long_options+i++, 0, "PATH", color,
+				 "Record the touchpad reads, the frames, the waits and "
+				 "wake ups of the threads, the motion and scrolling ticks "
+				 "and the writes of the mouse events, and write them in "
+				 "PATH as Chrome trace JSON when kerpad stops. The file "
+				 "can be opened with Perfetto. Only the last "
+				 MACRO_TO_STR(TRACER_BUFFER_SIZE)" spans of each thread "
+				 "are kept.");
+	print_option(long_options+i++, 0, NULL, color,
+				 "Print on the standard error the time taken by each phase "
+				 "of the startup (scan of the input devices, edge limits, "
+				 "creation of the virtual mouse, creation of the threads...) "
+				 "once Kerpad is ready, and the total time as \"ready\".");
+	print_option(long_options+i++, 0, "SEC", color,
+				 "Print on the standard error, every SEC seconds, the "
+				 "number of frames handled during the interval and the "
+				 "percentiles of their latency, from the time given by the "
+				 "kernel to their handling by Kerpad.");
+	print_option(long_options+i++, 0, "DIR", color,
+				 "Write the flight records in DIR when an anomaly is "
+				 "detected. The last seconds of touchpad events, touchpad "
+				 "states, cursor moves, scrolls and thread wake ups are "
+				 "always kept in memory, and written when the touchpad events "
+				 "are not read, when a frame is handled late, when a tick "
+				 "wakes up late, when the kernel drops events, or when Kerpad "
+				 "receives SIGUSR1. DIR default value is "
+				 DEFAULT_RECORDER_DIR".");
+	print_option(long_options+i++, 0, NULL, color,
+				 "Disable the flight recorder.");
 	print_option(long_options+i++, 'h', NULL, color,
 				 "Display this help and exit.");
 	
@@ -459,31 +1232,42 @@ static int parse_args(int argc, char *argv[]) {
 		
 		switch (opt) {
 		case 't':
-			edge_thickness = atoi(optarg);
+			current_settings->edge_thickness = atoi(optarg);
 			break;
 		case 'x':
-			minx = atoi(optarg);
+			current_settings->minx = atoi(optarg);
 			break;
 		case 'X':
-			maxx = atoi(optarg);
+			current_settings->maxx = atoi(optarg);
 			break;
 		case 'y':
-			miny = atoi(optarg);
+			current_settings->miny = atoi(optarg);
 			break;
 		case 'Y':
-			maxy = atoi(optarg);
+			current_settings->maxy = atoi(optarg);
 			break;
 		case 's':
 			sleep_time = atoi(optarg);
 			break;
 		case 'n':
-			device_name = optarg;
+			if (n_devices == MAX_TOUCHPADS) {
+				error_message("cannot listen to more than "
+						MACRO_TO_STR(MAX_TOUCHPADS)" devices");
+				return -1;
+			}
+			device_settings[n_devices] = default_settings;
+			device_settings[n_devices].device_name = optarg;
+			current_settings = device_settings+n_devices;
+			++n_devices;
+			break;
+		case ALL_TOUCHPADS_OPTION:
+			all_touchpads = true;
 			break;
 		case 'a':
 			move_touched = 1;
 			break;
 		case NO_EDGE_PROTECTION_OPTION:
-			no_edge_protection = true;
+			current_settings->no_edge_protection = true;
 			break;
 		case DISABLE_DOUBLE_TAP_OPTION:
 			disable_double_tap = true;
@@ -535,9 +1319,104 @@ static int parse_args(int argc, char *argv[]) {
 				return -1;
 			}
 			break;
+		case MOMENTUM_OPTION:
+			momentum = optarg? atoi(optarg): DEFAULT_MOMENTUM;
+			if (momentum <= 0) {
+				error_message("the momentum time constant must be positive");
+				return -1;
+			}
+			break;
+		case GRAB_OPTION:
+			grab = optarg? atoi(optarg): DEFAULT_POINTER_DIV;
+			if (grab <= 0) {
+				error_message("the pointer divisor must be positive");
+				return -1;
+			}
+			break;
 		case NO_EDGE_MOTION_OPTION:
 			edge_motion = false;
 			break;
+		case REALTIME_OPTION:
+			if (!optarg || !strcmp(optarg, "fifo")) {
+				realtime.policy = RT_POLICY_FIFO;
+			} else if (!strcmp(optarg, "rr")) {
+				realtime.policy = RT_POLICY_RR;
+			} else {
+				print_help(argc, argv);
+				return -1;
+			}
+			break;
+		case RT_PRIORITY_OPTION:
+			realtime.priority = atoi(optarg);
+			break;
+		case CPUS_OPTION:
+			realtime.cpus = optarg;
+			break;
+		case OUTPUT_OPTION:
+			if (sink_parse(optarg, &output) == -1) {
+				print_help(argc, argv);
+				return -1;
+			}
+			output_given = true;
+			break;
+		case POWER_SAVE_OPTION:
+			power_save = optarg? atoi(optarg): DEFAULT_POWER_SAVE_BUDGET;
+			if (power_save <= 0) {
+				error_message("the wake up budget must be positive");
+				return -1;
+			}
+			break;
+		case FRAME_SYNC_OPTION:
+			frame_sync = true;
+			break;
+		case IO_OPTION:
+			io = uring_parse(optarg);
+			if (io == -1) {
+				print_help(argc, argv);
+				return -1;
+			}
+			break;
+		case REPORT_RATE_OPTION:
+			report.report_rate = atoi(optarg);
+			if (report.report_rate <= 0 || report.report_rate > 1000000) {
+				error_message("the report rate must be between 1 and 1000000");
+				return -1;
+			}
+			break;
+		case REPORT_PHASE_OPTION:
+			report.report_phase = atol(optarg);
+			if (report.report_phase < 0) {
+				error_message("the report phase must not be negative");
+				return -1;
+			}
+			break;
+		case SIMULATE_OPTION:
+			simulation_time = atof(optarg);
+			if (simulation_time <= 0) {
+				error_message("the simulation time must be positive");
+				return -1;
+			}
+			break;
+		case SIMULATE_CORE_OPTION:
+			simulate_core = true;
+			break;
+		case REPLAY_OPTION:
+			replay_time = atof(optarg);
+			if (replay_time <= 0) {
+				error_message("the replay time must be positive");
+				return -1;
+			}
+			break;
+		case GESTURES_OPTION:
+			gestures = optarg;
+			break;
+		case SIMULATION_RATE_OPTION:
+			simulation_rate = atoi(optarg);
+			if (simulation_rate <= 0) {
+				error_message("the simulation rate must be positive");
+				return -1;
+			}
+			break;
 		case 'l':
 			if (!optarg || !strcmp(optarg, "candidates")) {
 				list = LIST_CANDIDATES;
@@ -551,6 +1430,32 @@ static int parse_args(int argc, char *argv[]) {
 		case 'v':
 			verbose = 1;
 			break;
+		case LOG_RATE_OPTION:
+			log_rate = atoi(optarg);
+			if (log_rate <= 0) {
+				error_message("the log rate must be positive");
+				return -1;
+			}
+			break;
+		case CHROME_TRACE_OPTION:
+			chrome_trace = optarg;
+			break;
+		case STARTUP_REPORT_OPTION:
+			startup_report_enabled = true;
+			break;
+		case FLIGHT_RECORDER_OPTION:
+			recorder_dir = optarg;
+			break;
+		case NO_FLIGHT_RECORDER_OPTION:
+			recorder_dir = NULL;
+			break;
+		case STATS_OPTION:
+			stats_interval = atoi(optarg);
+			if (stats_interval <= 0) {
+				error_message("the statistics interval must be positive");
+				return -1;
+			}
+			break;
 		case 'h':
 			print_help(argc, argv);
 			return 1;
@@ -569,7 +1474,253 @@ static int parse_args(int argc, char *argv[]) {
 	return 0;
 }
 
+/**
+ * Gather the options used by the edge logic
+ */
+static void init_core_settings() {
+	core_settings = (core_settings_t) {
+		.edge_motion = edge_motion,
+		.move_touched = move_touched,
+		.disable_double_tap = disable_double_tap,
+		.sleep_time = sleep_time,
+		.speed = CURSOR_SPEED,
+		.edge_scrolling = edge_scrolling,
+		.left_scrolling = left_edge_scrolling,
+		.right_scrolling = right_edge_scrolling,
+		.top_scrolling = top_edge_scrolling,
+		.bottom_scrolling = bottom_edge_scrolling,
+		.scroll_div = scroll_div,
+		.scroll_sleep_time = scroll_sleep_time,
+		.momentum = momentum*1000L,
+	};
+	core_motion_active_variant = core_select_motion_active(&core_settings);
+}
+
+/**
+ * Init the gestures of the simulation or of the replay
+ * and give their limits in xlimits and ylimits
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int init_gesture(struct input_absinfo *xlimits, struct input_absinfo *ylimits) {
+	gesture_settings_t gs = {
+		.minx = 0,
+		.maxx = GESTURE_DEFAULT_MAXX,
+		.miny = 0,
+		.maxy = GESTURE_DEFAULT_MAXY,
+		.rate = simulation_rate,
+		.loop = true,
+		.random = !strcmp(gestures, "random"),
+		.seed = SIMULATION_SEED,
+	};
+	char *script = NULL;
+	if (!gs.random) {
+		script = gesture_scenario(gestures, &gs);
+		if (!script) script = gesture_read_script(gestures);
+		if (!script) return -1;
+	}
+	gs.script = script;
+	gesture = gesture_init(&gs);
+	free(script);
+	if (!gesture) return -1;
+	
+	*xlimits = (struct input_absinfo) {
+		.minimum = gs.minx,
+		.maximum = gs.maxx,
+	};
+	*ylimits = (struct input_absinfo) {
+		.minimum = gs.miny,
+		.maximum = gs.maxy,
+	};
+	return 0;
+}
+
+/**
+ * Init the simulated touchpad and its gestures
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int init_simulation() {
+	struct input_absinfo xlimits;
+	struct input_absinfo ylimits;
+	if (init_gesture(&xlimits, &ylimits) == -1) return -1;
+	touchpad = touchpad_init_simulated(&default_settings, &xlimits, &ylimits, kclock);
+	if (!output_given) output.type = SINK_NULL;
+	return 0;
+}
+
+/**
+ * Write the frames of the gestures in fd at their time,
+ * stamped with CLOCK_MONOTONIC as the kernel does,
+ * then stop Kerpad
+ * Runs in the process forked by init_replay
+ */
+static void replay_frames(int fd) {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		struct input_event frame[GESTURE_FRAME_SIZE];
+		int n = gesture_next_frame(gesture, frame);
+		long time = gesture_time(gesture);
+		if (gesture_done(gesture) || time >= replay_time*1000000) break;
+		if (!n) continue;
+		struct timespec ts = {
+			.tv_sec = start.tv_sec+time/1000000,
+			.tv_nsec = start.tv_nsec+time%1000000*1000,
+		};
+		if (ts.tv_nsec >= 1000000000) {
+			++ts.tv_sec;
+			ts.tv_nsec -= 1000000000;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		for (int i = 0; i < n; ++i) {
+			frame[i].input_event_sec = ts.tv_sec;
+			frame[i].input_event_usec = ts.tv_nsec/1000;
+		}
+		// Kerpad has stopped
+		if (write(fd, frame, n*sizeof(*frame)) == -1) return;
+	}
+	kill(getppid(), SIGTERM);
+}
+
+/**
+ * Init the touchpad reading the replayed gestures,
+ * and fork the process writing them
+ * Must be called before any thread is created
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int init_replay() {
+	struct input_absinfo xlimits;
+	struct input_absinfo ylimits;
+	if (init_gesture(&xlimits, &ylimits) == -1) return -1;
+	// a SOCK_SEQPACKET socket keeps the frames
+	// apart, as the event file of a device
+	int sockets[2];
+	exitif(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) == -1,
+		   "cannot create the replay socket");
+	replay_pid = fork();
+	exitif(replay_pid == -1, "cannot fork the replay process");
+	if (replay_pid == 0) {
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		// so it is stopped by SIGTERM at the cleanup
+		unblock_sigint();
+		close(sockets[0]);
+		replay_frames(sockets[1]);
+		_exit(EXIT_SUCCESS);
+	}
+	close(sockets[1]);
+	touchpad = touchpad_init_fd(&default_settings, sockets[0], &xlimits, &ylimits,
+								io, kclock);
+	if (!output_given) output.type = SINK_NULL;
+	return 0;
+}
+
+/**
+ * Print the wake ups of the edge thread
+ * in power save mode
+ *
+ * elapsed: time since the start in seconds
+ */
+static void print_power_save_stats(double elapsed) {
+	kclock_stats_t clock_stats;
+	kclock_get_stats(kclock, &clock_stats);
+	fprintf(stderr, "edge thread: %lu wakeups (%.1f/s, budget %d/s)\n",
+			clock_stats.wakeups[EDGE_MOTION_THREAD_ID],
+			clock_stats.wakeups[EDGE_MOTION_THREAD_ID]/elapsed, power_save);
+}
+
+/**
+ * Return the upper bound of the latency of
+ * the given percentile of the frames, in us
+ */
+static long latency_percentile(unsigned long *buckets, unsigned long frames,
+							   double percentile) {
+	unsigned long count = 0;
+	for (int i = 0; i < TOUCHPAD_LATENCY_BUCKETS; ++i) {
+		count += buckets[i];
+		if (count && count >= percentile*frames) return (i+1)*TOUCHPAD_LATENCY_STEP;
+	}
+	return 0;
+}
+
+/**
+ * Print the number of frames and the percentiles of
+ * their latency every stats_interval seconds, until
+ * kerpad stops
+ *
+ * start: time when the threads were started
+ */
+static void print_stats_loop(struct timespec *start) {
+	touchpad_latency_t previous = {};
+	touchpad_latency_t latency;
+	long begin = start->tv_sec*1000000L+start->tv_nsec/1000;
+	long next = begin;
+	while (!atomic_load(&stats_stopped)) {
+		next += stats_interval*1000000L;
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		while (!atomic_load(&stats_stopped) && now.tv_sec*1000000L+now.tv_nsec/1000 < next) {
+			futex_wait_until(&stats_stopped, 0, next);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		}
+		if (atomic_load(&stats_stopped)) break;
+		
+		touchpad_get_latency(touchpad, &latency);
+		unsigned long frames = 0;
+		for (int i = 0; i < TOUCHPAD_LATENCY_BUCKETS; ++i) {
+			unsigned long count = latency.buckets[i];
+			latency.buckets[i] -= previous.buckets[i];
+			previous.buckets[i] = count;
+			frames += latency.buckets[i];
+		}
+		fprintf(stderr, "stats: %ld s, %lu frames, latency p50 %ld us, "
+				"p99 %ld us, max %ld us\n", (next-begin)/1000000, frames,
+				latency_percentile(latency.buckets, frames, 0.5),
+				latency_percentile(latency.buckets, frames, 0.99),
+				latency_percentile(latency.buckets, frames, 1));
+	}
+}
+
+/**
+ * Print the statistics of a simulation
+ *
+ * elapsed: real time taken by the simulation in seconds
+ */
+static void print_simulation_stats(double elapsed) {
+	kclock_stats_t clock_stats;
+	kclock_get_stats(kclock, &clock_stats);
+	sink_stats_t stats;
+	sink_get_stats(sink, &stats);
+	double simulated = clock_stats.now/1e6;
+	
+	fprintf(stderr, "simulated %.3fs in %.3fs\n", simulated, elapsed);
+	fprintf(stderr, "listening thread: %lu wakeups (%.1f/s)\n",
+			clock_stats.wakeups[LISTENING_THREAD_ID],
+			clock_stats.wakeups[LISTENING_THREAD_ID]/simulated);
+	if (power_save)
+		print_power_save_stats(simulated);
+	else if (edge_motion)
+		fprintf(stderr, "edge motion thread: %lu wakeups (%.1f/s)\n",
+				clock_stats.wakeups[EDGE_MOTION_THREAD_ID],
+				clock_stats.wakeups[EDGE_MOTION_THREAD_ID]/simulated);
+	if (edge_scrolling && !power_save)
+		fprintf(stderr, "edge scrolling thread: %lu wakeups (%.1f/s)\n",
+				clock_stats.wakeups[EDGE_SCROLLING_THREAD_ID],
+				clock_stats.wakeups[EDGE_SCROLLING_THREAD_ID]/simulated);
+	fprintf(stderr, "output: %lu frames (%.1f/s), %lu events (%.1f/s)\n",
+			stats.frames, stats.frames/simulated, stats.events, stats.events/simulated);
+	if (edge_motion && motion_active_time)
+		fprintf(stderr, "edge motion: %lu px, %.1f px/s (expected %.1f px/s)\n",
+				stats.motion, motion_distance*1e6/motion_active_time,
+				CURSOR_SPEED*1e6/sleep_time);
+	if (edge_scrolling)
+		fprintf(stderr, "edge scrolling: %lu hi-res units\n", stats.scroll);
+}
+
 int main(int argc, char *argv[]) {
+	startup_init();
 	block_sigint();
 	int parse_result = parse_args(argc, argv);
 	if (parse_result < 0) {
@@ -580,53 +1731,173 @@ int main(int argc, char *argv[]) {
 		return EXIT_SUCCESS;
 	}
 	
-	if (!edge_motion && !edge_scrolling && list == LIST_NO) {
+	if (realtime_check_settings(&realtime) == -1) {
+		return EXIT_FAILURE;
+	}
+	if (momentum && power_save) {
+		error_message("--momentum cannot be used with --power-save");
+		return EXIT_FAILURE;
+	}
+	if (frame_sync && power_save) {
+		error_message("--frame-sync cannot be used with --power-save");
+		return EXIT_FAILURE;
+	}
+	if (replay_time > 0 && simulation_time > 0) {
+		error_message("--replay cannot be used with --simulate");
+		return EXIT_FAILURE;
+	}
+	if (simulate_core && simulation_time <= 0) {
+		error_message("--simulate-core needs --simulate");
+		return EXIT_FAILURE;
+	}
+	if (simulate_core && (grab || frame_sync || momentum || power_save)) {
+		error_message("--simulate-core cannot be used with --grab, "
+					  "--frame-sync, --momentum nor --power-save");
+		return EXIT_FAILURE;
+	}
+	if (report.report_rate && report.report_phase >= 1000000/report.report_rate) {
+		error_message("the report phase must be shorter than the report period");
+		return EXIT_FAILURE;
+	}
+	init_core_settings();
+	startup_mark("options");
+	
+	if (!edge_motion && !edge_scrolling && !grab && list == LIST_NO) {
 		// there are nothing to do
 		return EXIT_SUCCESS;
 	}
 	
-	touchpad_settings_t settings = {
-		.device_name = device_name,
-		.minx = minx,
-		.maxx = maxx,
-		.miny = miny,
-		.maxy = maxy,
-		.edge_thickness = edge_thickness,
-		.no_edge_protection = no_edge_protection,
-		.list = list,
-	};
-	touchpad = touchpad_init(&settings);
-	if (touchpad == NULL) {
-		return EXIT_FAILURE;
+	if (simulation_time > 0) {
+		kclock = kclock_init_virtual();
+		default_settings.grab = grab > 0;
+		if (init_simulation() == -1) return EXIT_FAILURE;
+		startup_mark("simulation");
+	} else if (replay_time > 0) {
+		kclock = kclock_init_real();
+		default_settings.grab = grab > 0;
+		if (init_replay() == -1) return EXIT_FAILURE;
+		startup_mark("replay");
+	} else {
+		kclock = kclock_init_real();
+		touchpad_settings_t settings[MAX_TOUCHPADS+1];
+		int count = 0;
+		for (int i = 0; i < n_devices; ++i) settings[count++] = device_settings[i];
+		if (all_touchpads || n_devices == 0) {
+			settings[count] = default_settings;
+			settings[count++].all = all_touchpads;
+		}
+		for (int i = 0; i < count; ++i) {
+			settings[i].list = list;
+			settings[i].grab = grab > 0;
+		}
+		touchpad = touchpad_init(settings, count, io, kclock);
+		if (touchpad == NULL) {
+			return EXIT_FAILURE;
+		}
 	}
 	if (list != LIST_NO) {
 		// We just wanted to list devices
 		// so we can quit now
+		if (startup_report_enabled) startup_report();
 		touchpad_clean(touchpad);
 		return EXIT_SUCCESS;
 	}
 	
-	mouse = mouse_init("Kerpad Mouse");
+	if (verbose) {
+		logger_init(kclock, log_rate);
+		for (int i = 0; i < LOG_N_CATEGORIES; ++i) logger_enable(i);
+	}
+	if (chrome_trace) tracer_init(kclock, chrome_trace);
+	if (recorder_dir) recorder_init(kclock, touchpad, recorder_dir);
+	startup_mark("logging");
+	output.io = io;
+	sink = sink_init(&output, "Kerpad Mouse", kclock);
+	startup_mark("sink");
+	mouse = mouse_init(sink, &report, &realtime, kclock);
+	startup_mark("mouse");
 	
 	init_sighanlder();
-	unblock_sigint();
 	
 	pthread_t touchap_listening_th;
 	pthread_t edge_motion_th;
 	pthread_t edge_scrolling_th;
+	pthread_attr_t attr;
+	realtime_init_thread_attr(&realtime, &attr);
+	realtime_lock_memory(&realtime);
+	startup_mark("realtime");
+	// from now on, kerpad should not allocate
+	guard_arm();
 	
-	pthread_create(&touchap_listening_th, NULL, touchpad_listening_thread, NULL);
-	if (edge_motion)
-		pthread_create(&edge_motion_th, NULL, edge_motion_thread, NULL);
-	if (edge_scrolling)
-		pthread_create(&edge_scrolling_th, NULL, edge_scrolling_thread, NULL);
+	// in power save mode, one thread does both
+	bool motion_thread = power_save? edge_motion || edge_scrolling: edge_motion;
+	bool scrolling_thread = !power_save && edge_scrolling;
+	if (simulate_core) {
+		motion_thread = false;
+		scrolling_thread = false;
+	}
+	kclock_expect(kclock, 1+motion_thread+scrolling_thread);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (simulate_core)
+		pthread_create(&touchap_listening_th, &attr, core_simulation_thread, NULL);
+	else
+		pthread_create(&touchap_listening_th, &attr, simulation_time > 0?
+					   simulated_listening_thread: touchpad_listening_thread, NULL);
+	if (motion_thread)
+		pthread_create(&edge_motion_th, &attr, power_save?
+					   power_save_thread: edge_motion_thread, NULL);
+	if (scrolling_thread)
+		pthread_create(&edge_scrolling_th, &attr, edge_scrolling_thread, NULL);
+	pthread_attr_destroy(&attr);
+	// the threads were created with the signals
+	// blocked, only this thread handles them
+	unblock_sigint();
+	startup_mark("threads");
+	if (startup_report_enabled) startup_report();
+	if (stats_interval) print_stats_loop(&start);
 	
 	pthread_join(touchap_listening_th, NULL);
-	if (edge_motion) pthread_join(edge_motion_th, NULL);
-	if (edge_scrolling) pthread_join(edge_scrolling_th, NULL);
+	if (motion_thread) pthread_join(edge_motion_th, NULL);
+	if (scrolling_thread) pthread_join(edge_scrolling_th, NULL);
+	// the cleanup wakes the threads up as handler
+	// does, with the locks of a simulated clock
+	block_sigint();
+	sink_stats_t guard_stats;
+	sink_get_stats(sink, &guard_stats);
+	int guard_result = guard_check(guard_stats.frames);
 	
+	recorder_clean();
 	touchpad_clean(touchpad);
 	mouse_clean(mouse);
+	logger_clean();
+	tracer_clean();
+	if (simulation_time > 0) {
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		print_simulation_stats(end.tv_sec-start.tv_sec+(end.tv_nsec-start.tv_nsec)/1e9);
+		gesture_clean(gesture);
+	} else {
+		if (replay_pid > 0) {
+			// the replay is not over if Kerpad was interrupted
+			kill(replay_pid, SIGTERM);
+			waitpid(replay_pid, NULL, 0);
+			gesture_clean(gesture);
+		}
+		if (output.type != SINK_UINPUT) {
+			sink_stats_t stats;
+			sink_get_stats(sink, &stats);
+			fprintf(stderr, "%lu frames, %lu events, %lu writes\n",
+					stats.frames, stats.events, stats.writes);
+		}
+		if (power_save) {
+			struct timespec end;
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			print_power_save_stats(end.tv_sec-start.tv_sec
+								   +(end.tv_nsec-start.tv_nsec)/1e9);
+		}
+	}
+	sink_clean(sink);
+	kclock_clean(kclock);
 	
-	return EXIT_SUCCESS;
+	return guard_result == -1? EXIT_FAILURE: EXIT_SUCCESS;
 }
@@ -1,104 +1,372 @@
 /*
  * This file is responsible for
  * simulating a mouse
+ *
+ * Each thread that moves the mouse pushes its commands
+ * into its own single-producer/single-consumer queue,
+ * and a writer thread drains them and writes them to the sink
+ * so producers never wait for a lock or a syscall
  */
 
 #include <stdlib.h>
-#include <linux/uinput.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <string.h>
+#include <linux/input.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sched.h>
+#include <limits.h>
 
 #include "mouse.h"
 #include "util.h"
+#include "tracer.h"
+
+// must be a power of 2
+#define QUEUE_SIZE 256
+
+#define CACHE_LINE_SIZE 64
+
+// REL_X, REL_Y, REL_WHEEL_HI_RES and REL_HWHEEL_HI_RES
+#define N_AXES 4
+
+// states of the writer
+#define WRITER_RUNNING 0
+// waiting for commands, woken up by any command
+#define WRITER_IDLE    1
+// waiting for the next report time,
+// only woken up by buttons
+#define WRITER_REPORT  2
+
+struct mouse_cmd {
+	// EV_REL or EV_KEY
+	uint16_t type;
+	uint16_t code;
+	int32_t value;
+};
+
+struct mouse_queue {
+	// written by the producer only
+	_Alignas(CACHE_LINE_SIZE) atomic_uint head;
+	// written by the writer only
+	_Alignas(CACHE_LINE_SIZE) atomic_uint tail;
+	struct mouse_cmd cmds[QUEUE_SIZE];
+};
 
 struct mouse {
-	int ui_fd;
-	pthread_mutex_t mutex;
+	sink_t *sink;
+	kclock_t *clock;
+	
+	// report period and phase in microseconds,
+	// period is 0 if frames are written at once
+	long period;
+	long phase;
+	// report period of the last written frame
+	long last_slot;
+	// deltas not written yet in synchronous mode
+	int pending[N_AXES];
+	
+	struct mouse_queue queues[MOUSE_MAX_PRODUCERS];
+	atomic_int n_queues;
+	
+	// if true, there is no writer thread and
+	// producers write their commands themselves
+	bool synchronous;
+	pthread_t writer;
+	realtime_settings_t *realtime;
+	// WRITER_RUNNING, WRITER_IDLE or WRITER_REPORT
+	atomic_int sleeping;
+	atomic_bool stopped;
 };
 
-mouse_t *mouse_init(const char *name) {
-	mouse_t *mouse = malloc(sizeof(*mouse));
-	mouse->ui_fd = open("/dev/uinput", O_WRONLY|O_NONBLOCK);
-	exitif(mouse->ui_fd == -1, "cannot open /dev/uinput");
-	struct uinput_setup usetup = {};
+// queue of the calling thread
+static _Thread_local struct mouse_queue *thread_queue = NULL;
+static _Thread_local mouse_t *thread_mouse = NULL;
+
+static const uint16_t axes[N_AXES] = {
+	REL_X, REL_Y, REL_WHEEL_HI_RES, REL_HWHEEL_HI_RES,
+};
+
+/**
+ * Return true if a queue has pending commands
+ */
+static bool has_pending_cmds(mouse_t *mouse) {
+	int n_queues = atomic_load(&mouse->n_queues);
+	for (int i = 0; i < n_queues; ++i) {
+		struct mouse_queue *queue = mouse->queues+i;
+		if (atomic_load(&queue->head) != atomic_load_explicit(&queue->tail,
+															  memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+static void write_frame(mouse_t *mouse, int deltas[N_AXES], const struct mouse_cmd *button);
+
+/**
+ * Drain all the queues and add
+ * the pending deltas of each axis to deltas
+ * A button is written at once with the deltas before it
+ *
+ * Return the number of drained commands
+ */
+static int drain_queues(mouse_t *mouse, int deltas[N_AXES]) {
+	int drained = 0;
+	int n_queues = atomic_load(&mouse->n_queues);
+	for (int i = 0; i < n_queues; ++i) {
+		struct mouse_queue *queue = mouse->queues+i;
+		unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+		unsigned head = atomic_load_explicit(&queue->head, memory_order_acquire);
+		for (; tail != head; ++tail, ++drained) {
+			struct mouse_cmd *cmd = queue->cmds+(tail&(QUEUE_SIZE-1));
+			if (cmd->type == EV_KEY) {
+				write_frame(mouse, deltas, cmd);
+				continue;
+			}
+			for (int axis = 0; axis < N_AXES; ++axis) {
+				if (cmd->code == axes[axis]) deltas[axis] += cmd->value;
+			}
+		}
+		atomic_store_explicit(&queue->tail, tail, memory_order_release);
+	}
+	return drained;
+}
+
+/**
+ * Return the index of the report period containing time
+ */
+static long report_slot(mouse_t *mouse, long time) {
+	long t = time-mouse->phase;
+	// rounded down, even before the phase
+	return t >= 0? t/mouse->period: -((-t+mouse->period-1)/mouse->period);
+}
+
+/**
+ * Return the time at which the pending deltas can be written,
+ * now if they can be written at once
+ */
+static long report_time(mouse_t *mouse, long now) {
+	if (!mouse->period) return now;
+	if (report_slot(mouse, now) > mouse->last_slot) return now;
+	return mouse->phase+(mouse->last_slot+1)*mouse->period;
+}
+
+/**
+ * Write one frame with the non null deltas
+ * and the button if non null, and reset the deltas
+ */
+static void write_frame(mouse_t *mouse, int deltas[N_AXES], const struct mouse_cmd *button) {
+	struct input_event frame[N_AXES+2] = {};
+	int n = 0;
+	for (int axis = 0; axis < N_AXES; ++axis) {
+		if (!deltas[axis]) continue;
+		frame[n].type = EV_REL;
+		frame[n].code = axes[axis];
+		frame[n].value = deltas[axis];
+		++n;
+	}
+	if (button) {
+		frame[n].type = EV_KEY;
+		frame[n].code = button->code;
+		frame[n].value = button->value;
+		++n;
+	}
+	if (!n) return;
+	frame[n].type = EV_SYN;
+	frame[n].code = SYN_REPORT;
+	frame[n].value = 0;
+	++n;
 	
-	ioctl(mouse->ui_fd, UI_SET_EVBIT, EV_KEY);
-	ioctl(mouse->ui_fd, UI_SET_KEYBIT, BTN_LEFT);
+	long begin = tracer_begin();
+	sink_write(mouse->sink, frame, n);
+	tracer_end(TRACE_WRITE, begin, n);
+	for (int axis = 0; axis < N_AXES; ++axis) deltas[axis] = 0;
+	if (mouse->period) mouse->last_slot = report_slot(mouse, kclock_now(mouse->clock));
+}
+
+/**
+ * Return true if a delta is not null
+ */
+static bool has_deltas(int deltas[N_AXES]) {
+	for (int axis = 0; axis < N_AXES; ++axis) {
+		if (deltas[axis]) return true;
+	}
+	return false;
+}
+
+/**
+ * Thread responsible for writing the
+ * commands of all queues to the sink
+ */
+static void *mouse_writer_thread(void *arg) {
+	mouse_t *mouse = arg;
+	realtime_apply_thread(mouse->realtime, "mouse writer");
+	tracer_thread("mouse writer");
 	
-	ioctl(mouse->ui_fd, UI_SET_EVBIT, EV_REL);
-	ioctl(mouse->ui_fd, UI_SET_RELBIT, REL_X);
-	ioctl(mouse->ui_fd, UI_SET_RELBIT, REL_Y);
-	ioctl(mouse->ui_fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
-	ioctl(mouse->ui_fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+	// deltas drained but not written yet
+	int deltas[N_AXES] = {};
+	while (true) {
+		drain_queues(mouse, deltas);
+		if (has_deltas(deltas)) {
+			long now = kclock_now(mouse->clock);
+			long time = report_time(mouse, now);
+			if (time > now && !atomic_load(&mouse->stopped)) {
+				// the frames of this wake up are
+				// submitted together before sleeping
+				sink_flush(mouse->sink);
+				// commands pushed until the next report
+				// time are coalesced in the same frame,
+				// but a button is written at once
+				atomic_store(&mouse->sleeping, WRITER_REPORT);
+				if (!has_pending_cmds(mouse) && !atomic_load(&mouse->stopped))
+					futex_wait_until(&mouse->sleeping, WRITER_REPORT, time);
+				atomic_store(&mouse->sleeping, WRITER_RUNNING);
+				continue;
+			}
+			// commands pushed while writing will be
+			// coalesced in the next frame
+			write_frame(mouse, deltas, NULL);
+			continue;
+		}
+		sink_flush(mouse->sink);
+		if (atomic_load(&mouse->stopped)) break;
+		
+		atomic_store(&mouse->sleeping, WRITER_IDLE);
+		// a producer may have pushed a command
+		// before seeing that the writer sleeps
+		if (has_pending_cmds(mouse) || atomic_load(&mouse->stopped)) {
+			atomic_store(&mouse->sleeping, WRITER_RUNNING);
+			continue;
+		}
+		futex_wait(&mouse->sleeping, WRITER_IDLE);
+	}
+	return NULL;
+}
+
+/**
+ * Wake up the writer if it is waiting for commands,
+ * or for the next report time if button is true
+ */
+static void wake_writer(mouse_t *mouse, bool button) {
+	int sleeping = atomic_load(&mouse->sleeping);
+	if (sleeping == WRITER_RUNNING || (sleeping == WRITER_REPORT && !button)) return;
+	if (atomic_exchange(&mouse->sleeping, WRITER_RUNNING) != WRITER_RUNNING)
+		futex_wake(&mouse->sleeping, 1);
+}
+
+mouse_t *mouse_init(sink_t *sink, mouse_settings_t *settings,
+					realtime_settings_t *realtime, kclock_t *clock) {
+	mouse_t *mouse = aligned_alloc(CACHE_LINE_SIZE, sizeof(*mouse));
+	mouse->sink = sink;
+	mouse->clock = clock;
+	mouse->period = settings->report_rate > 0? 1000000/settings->report_rate: 0;
+	mouse->phase = settings->report_phase;
+	mouse->last_slot = LONG_MIN;
+	for (int axis = 0; axis < N_AXES; ++axis) mouse->pending[axis] = 0;
 	
-	usetup.id.bustype = BUS_USB;
-	usetup.id.vendor = 0x1234;
-	usetup.id.product = 0x5678;
-	strcpy(usetup.name, name);
-	ioctl(mouse->ui_fd, UI_DEV_SETUP, &usetup);
-	ioctl(mouse->ui_fd, UI_DEV_CREATE);
-	sleep(1);
+	for (int i = 0; i < MOUSE_MAX_PRODUCERS; ++i) {
+		atomic_init(&mouse->queues[i].head, 0);
+		atomic_init(&mouse->queues[i].tail, 0);
+	}
+	atomic_init(&mouse->n_queues, 0);
+	atomic_init(&mouse->sleeping, WRITER_RUNNING);
+	atomic_init(&mouse->stopped, false);
+	mouse->realtime = realtime;
+	// with a virtual clock, only one thread runs at a time
+	// and a writer thread would make the output nondeterministic
+	mouse->synchronous = kclock_is_virtual(clock);
+	if (mouse->synchronous) return mouse;
 	
-	pthread_mutex_init(&mouse->mutex, NULL);
+	pthread_attr_t attr;
+	realtime_init_thread_attr(realtime, &attr);
+	exitif(pthread_create(&mouse->writer, &attr, mouse_writer_thread, mouse) != 0,
+		   "cannot create the mouse writer thread");
+	pthread_attr_destroy(&attr);
 	
 	return mouse;
 }
 
+/**
+ * Return the queue of the calling thread,
+ * and create it if needed
+ */
+static struct mouse_queue *get_queue(mouse_t *mouse) {
+	if (thread_mouse != mouse) {
+		int i = atomic_fetch_add(&mouse->n_queues, 1);
+		exitif(i >= MOUSE_MAX_PRODUCERS, "too many threads use the mouse");
+		thread_queue = mouse->queues+i;
+		thread_mouse = mouse;
+	}
+	return thread_queue;
+}
 
-static void mouse_emit(mouse_t *mouse, int type, int code, int val) {
-	struct input_event ie = {
-		.type = type,
-		.code = code,
-		.value = val
-	};
-	ie.time.tv_sec = 0;
-	ie.time.tv_usec = 0;
+/**
+ * Push count commands in the queue of the
+ * calling thread and wake up the writer
+ */
+static void push_cmds(mouse_t *mouse, const struct mouse_cmd *cmds, int count) {
+	struct mouse_queue *queue = get_queue(mouse);
+	unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	while (head-atomic_load_explicit(&queue->tail, memory_order_acquire)
+		   > QUEUE_SIZE-(unsigned)count) {
+		// the queue is full, let the writer drain it
+		wake_writer(mouse, true);
+		sched_yield();
+	}
+	for (int i = 0; i < count; ++i) {
+		queue->cmds[(head+i)&(QUEUE_SIZE-1)] = cmds[i];
+	}
+	atomic_store(&queue->head, head+count);
 	
-	exitif(write(mouse->ui_fd, &ie, sizeof(ie)) == -1, "cannot write to /dev/uinput");
+	if (mouse->synchronous) {
+		drain_queues(mouse, mouse->pending);
+		long now = kclock_now(mouse->clock);
+		if (report_time(mouse, now) <= now) write_frame(mouse, mouse->pending, NULL);
+		sink_flush(mouse->sink);
+		return;
+	}
+	wake_writer(mouse, cmds[count-1].type == EV_KEY);
 }
 
 void mouse_move(mouse_t *mouse, int dx, int dy) {
-	pthread_mutex_lock(&mouse->mutex);
-	mouse_emit(mouse, EV_REL, REL_X, dx);
-	mouse_emit(mouse, EV_REL, REL_Y, dy);
-	mouse_emit(mouse, EV_SYN, SYN_REPORT, 0);
-	pthread_mutex_unlock(&mouse->mutex);
+	struct mouse_cmd cmds[] = {
+		{EV_REL, REL_X, dx},
+		{EV_REL, REL_Y, dy},
+	};
+	push_cmds(mouse, cmds, 2);
 }
 
 void mouse_move_x(mouse_t *mouse, int dx) {
-	pthread_mutex_lock(&mouse->mutex);
-	mouse_emit(mouse, EV_REL, REL_X, dx);
-	mouse_emit(mouse, EV_SYN, SYN_REPORT, 0);
-	pthread_mutex_unlock(&mouse->mutex);
+	struct mouse_cmd cmd = {EV_REL, REL_X, dx};
+	push_cmds(mouse, &cmd, 1);
 }
 
 void mouse_move_y(mouse_t *mouse, int dy) {
-	pthread_mutex_lock(&mouse->mutex);
-	mouse_emit(mouse, EV_REL, REL_Y, dy);
-	mouse_emit(mouse, EV_SYN, SYN_REPORT, 0);
-	pthread_mutex_unlock(&mouse->mutex);
+	struct mouse_cmd cmd = {EV_REL, REL_Y, dy};
+	push_cmds(mouse, &cmd, 1);
 }
 
 void mouse_scroll_x(mouse_t *mouse, int dx) {
-	pthread_mutex_lock(&mouse->mutex);
-	mouse_emit(mouse, EV_REL, REL_HWHEEL_HI_RES, dx);
-	mouse_emit(mouse, EV_SYN, SYN_REPORT, 0);
-	pthread_mutex_unlock(&mouse->mutex);
+	struct mouse_cmd cmd = {EV_REL, REL_HWHEEL_HI_RES, dx};
+	push_cmds(mouse, &cmd, 1);
 }
 
 void mouse_scroll_y(mouse_t *mouse, int dy) {
-	pthread_mutex_lock(&mouse->mutex);
-	mouse_emit(mouse, EV_REL, REL_WHEEL_HI_RES, dy);
-	mouse_emit(mouse, EV_SYN, SYN_REPORT, 0);
-	pthread_mutex_unlock(&mouse->mutex);
+	struct mouse_cmd cmd = {EV_REL, REL_WHEEL_HI_RES, dy};
+	push_cmds(mouse, &cmd, 1);
+}
+
+void mouse_button(mouse_t *mouse, int code, int value) {
+	struct mouse_cmd cmd = {EV_KEY, code, value};
+	push_cmds(mouse, &cmd, 1);
 }
 
 void mouse_clean(mouse_t *mouse) {
-	sleep(1);
-	ioctl(mouse->ui_fd, UI_DEV_DESTROY);
-	close(mouse->ui_fd);
-	pthread_mutex_destroy(&mouse->mutex);
+	if (!mouse->synchronous) {
+		atomic_store(&mouse->stopped, true);
+		wake_writer(mouse, true);
+		pthread_join(mouse->writer, NULL);
+	} else {
+		write_frame(mouse, mouse->pending, NULL);
+		sink_flush(mouse->sink);
+	}
 	free(mouse);
 }
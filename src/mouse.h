@@ -1,14 +1,45 @@
 #ifndef __MOUSE_H__
 #define __MOUSE_H__
 
+#include "realtime.h"
+#include "sink.h"
+#include "clock.h"
+
+// max number of threads
+// that can use a mouse
+#define MOUSE_MAX_PRODUCERS 8
+
 typedef struct mouse mouse_t;
 
+struct mouse_settings {
+	// if positive, the movements are accumulated and written
+	// in at most report_rate frames per second
+	int report_rate;
+	// offset of the report times in microseconds, a frame is
+	// written at most once in each period starting at
+	// report_phase+k/report_rate seconds
+	long report_phase;
+};
+typedef struct mouse_settings mouse_settings_t;
+
 /**
  * Init the mouse simulation
  *
- * name: the name of the simulated mouse
+ * The functions below only push commands in a queue
+ * owned by the calling thread, they are written
+ * by a dedicated thread that merges the pending
+ * movements of each axis in one frame
+ *
+ * sink: where the events are written,
+ *       it is not cleaned by mouse_clean
+ * settings: report rate of the frames
+ * realtime: low-latency settings of the writer thread
+ * clock: with a virtual clock, there is no writer thread
+ *        and commands are written by the calling thread,
+ *        at the first command of each report period
  */
-mouse_t *mouse_init(const char *name);
+mouse_t *mouse_init(sink_t *sink, mouse_settings_t *settings,
+					realtime_settings_t *realtime, kclock_t *clock);
 
 /**
  * Add dx to mouse abscissa
@@ -33,8 +64,16 @@ void mouse_scroll_x(mouse_t *mouse, int dx);
 
 void mouse_scroll_y(mouse_t *mouse, int dy);
 
+/**
+ * Press (value 1) or release (value 0) a button
+ * The pending movements and the button are written
+ * at once, regardless of the report rate
+ */
+void mouse_button(mouse_t *mouse, int code, int value);
+
 /**
  * Clean the mouse simulation
+ * Pending commands are written before
  */
 void mouse_clean(mouse_t *mouse);
 
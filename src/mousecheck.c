@@ -0,0 +1,241 @@
+/*
+ * kerpad-mousecheck checks the events written by the mouse:
+ * the commands are given to a mouse writing in a memory
+ * sink, and the stored events are compared with the frames
+ * expected, with and without a report rate, and with the
+ * writer thread of a real clock
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <linux/input.h>
+
+#include "mouse.h"
+#include "sink.h"
+#include "clock.h"
+#include "realtime.h"
+#include "util.h"
+
+// report rate of the coalescing check, in frames per second
+#define REPORT_RATE 100
+#define REPORT_PERIOD (1000000/REPORT_RATE)
+// commands pushed through the writer thread
+#define N_COMMANDS 10000
+
+#define REL(c, v) {.type = EV_REL, .code = (c), .value = (v)}
+#define KEY(c, v) {.type = EV_KEY, .code = (c), .value = (v)}
+#define SYN {.type = EV_SYN, .code = SYN_REPORT}
+#define LEN(array) (sizeof(array)/sizeof(*(array)))
+
+static realtime_settings_t realtime = {
+	.policy = RT_POLICY_NONE,
+};
+
+/**
+ * Return a mouse writing in a new memory sink
+ */
+static mouse_t *init_mouse(sink_t **sink, int report_rate, kclock_t *clock) {
+	sink_settings_t sink_settings = {
+		.type = SINK_MEMORY,
+	};
+	*sink = sink_init(&sink_settings, "Kerpad Check Mouse", clock);
+	mouse_settings_t settings = {
+		.report_rate = report_rate,
+	};
+	return mouse_init(*sink, &settings, &realtime, clock);
+}
+
+/**
+ * Check that the events stored by the sink since
+ * the previous check are the count expected ones
+ *
+ * checked: number of events already checked, updated
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int expect_events(sink_t *sink, size_t *checked,
+						 const struct input_event *expected, size_t count,
+						 const char *what) {
+	size_t n_events;
+	const struct input_event *events = sink_get_events(sink, &n_events);
+	int err = 0;
+	if (n_events-*checked != count) {
+		error_message("%s: %zu events instead of %zu", what, n_events-*checked, count);
+		err = -1;
+	}
+	for (size_t i = 0; !err && i < count; ++i) {
+		const struct input_event *event = events+*checked+i;
+		if (event->type != expected[i].type || event->code != expected[i].code
+			|| event->value != expected[i].value) {
+			error_message("%s: event %zu is %d %d %d instead of %d %d %d", what, i,
+						  event->type, event->code, event->value,
+						  expected[i].type, expected[i].code, expected[i].value);
+			err = -1;
+		}
+	}
+	*checked = n_events;
+	return err;
+}
+
+/**
+ * Check that each command is written at once in
+ * its own frame, without a report rate
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int check_frames() {
+	kclock_t *clock = kclock_init_virtual();
+	kclock_expect(clock, 1);
+	kclock_enter(clock, 0);
+	sink_t *sink;
+	mouse_t *mouse = init_mouse(&sink, 0, clock);
+	size_t checked = 0;
+	int err = 0;
+	
+	mouse_move(mouse, 3, -2);
+	mouse_move_x(mouse, 5);
+	mouse_move_y(mouse, -7);
+	struct input_event moves[] = {
+		REL(REL_X, 3), REL(REL_Y, -2), SYN,
+		REL(REL_X, 5), SYN,
+		REL(REL_Y, -7), SYN,
+	};
+	err |= expect_events(sink, &checked, moves, LEN(moves), "moves");
+	
+	mouse_scroll_y(mouse, 120);
+	mouse_scroll_x(mouse, -60);
+	struct input_event scrolls[] = {
+		REL(REL_WHEEL_HI_RES, 120), SYN,
+		REL(REL_HWHEEL_HI_RES, -60), SYN,
+	};
+	err |= expect_events(sink, &checked, scrolls, LEN(scrolls), "scrolls");
+	
+	mouse_button(mouse, BTN_LEFT, 1);
+	mouse_button(mouse, BTN_LEFT, 0);
+	struct input_event buttons[] = {
+		KEY(BTN_LEFT, 1), SYN,
+		KEY(BTN_LEFT, 0), SYN,
+	};
+	err |= expect_events(sink, &checked, buttons, LEN(buttons), "buttons");
+	
+	mouse_clean(mouse);
+	err |= expect_events(sink, &checked, NULL, 0, "clean");
+	sink_clean(sink);
+	kclock_leave(clock);
+	kclock_clean(clock);
+	return err;
+}
+
+/**
+ * Check that the commands of a report period are
+ * coalesced in one frame, but that a button is
+ * written at once with the deltas before it
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int check_report_rate() {
+	kclock_t *clock = kclock_init_virtual();
+	kclock_expect(clock, 1);
+	kclock_enter(clock, 0);
+	sink_t *sink;
+	mouse_t *mouse = init_mouse(&sink, REPORT_RATE, clock);
+	size_t checked = 0;
+	int err = 0;
+	
+	// the first command of a period is written at once
+	mouse_move_x(mouse, 1);
+	mouse_move_x(mouse, 2);
+	mouse_move(mouse, 3, 4);
+	mouse_scroll_y(mouse, 30);
+	struct input_event first[] = {
+		REL(REL_X, 1), SYN,
+	};
+	err |= expect_events(sink, &checked, first, LEN(first), "first command");
+	
+	kclock_sleep_until(clock, REPORT_PERIOD);
+	mouse_move_y(mouse, 5);
+	struct input_event coalesced[] = {
+		REL(REL_X, 5), REL(REL_Y, 9), REL(REL_WHEEL_HI_RES, 30), SYN,
+	};
+	err |= expect_events(sink, &checked, coalesced, LEN(coalesced), "next period");
+	
+	mouse_move_x(mouse, -6);
+	mouse_button(mouse, BTN_RIGHT, 1);
+	struct input_event button[] = {
+		REL(REL_X, -6), KEY(BTN_RIGHT, 1), SYN,
+	};
+	err |= expect_events(sink, &checked, button, LEN(button), "button");
+	
+	mouse_scroll_x(mouse, 90);
+	mouse_clean(mouse);
+	struct input_event pending[] = {
+		REL(REL_HWHEEL_HI_RES, 90), SYN,
+	};
+	err |= expect_events(sink, &checked, pending, LEN(pending), "clean");
+	sink_clean(sink);
+	kclock_leave(clock);
+	kclock_clean(clock);
+	return err;
+}
+
+/**
+ * Check that the writer thread of a real clock writes
+ * all the deltas and buttons, in complete frames
+ *
+ * Return 0 on success, and -1 on error
+ */
+static int check_writer() {
+	kclock_t *clock = kclock_init_real();
+	sink_t *sink;
+	mouse_t *mouse = init_mouse(&sink, 0, clock);
+	long dx = 0;
+	long wheel = 0;
+	for (int i = 0; i < N_COMMANDS; ++i) {
+		mouse_move_x(mouse, i%7-3);
+		mouse_scroll_y(mouse, i%5+1);
+		dx += i%7-3;
+		wheel += i%5+1;
+		if (i%1000 == 0) mouse_button(mouse, BTN_LEFT, i/1000%2);
+	}
+	mouse_clean(mouse);
+	
+	size_t count;
+	const struct input_event *events = sink_get_events(sink, &count);
+	sink_stats_t stats;
+	sink_get_stats(sink, &stats);
+	long written_dx = 0;
+	long written_wheel = 0;
+	int buttons = 0;
+	int err = 0;
+	bool in_frame = false;
+	for (size_t i = 0; i < count; ++i) {
+		if (events[i].type == EV_REL && events[i].code == REL_X)
+			written_dx += events[i].value;
+		else if (events[i].type == EV_REL && events[i].code == REL_WHEEL_HI_RES)
+			written_wheel += events[i].value;
+		else if (events[i].type == EV_KEY)
+			++buttons;
+		in_frame = events[i].type != EV_SYN;
+	}
+	if (stats.lost || in_frame) {
+		error_message("writer: %lu events lost, last frame %s", stats.lost,
+					  in_frame? "not complete": "complete");
+		err = -1;
+	}
+	if (written_dx != dx || written_wheel != wheel || buttons != N_COMMANDS/1000) {
+		error_message("writer: x %ld, wheel %ld and %d buttons instead of %ld, %ld and %d",
+					  written_dx, written_wheel, buttons, dx, wheel, N_COMMANDS/1000);
+		err = -1;
+	}
+	sink_clean(sink);
+	kclock_clean(clock);
+	return err;
+}
+
+int main() {
+	if (check_frames() == -1 || check_report_rate() == -1 || check_writer() == -1)
+		return EXIT_FAILURE;
+	printf("mousecheck: the mouse writes the expected events\n");
+	return EXIT_SUCCESS;
+}
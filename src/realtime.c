@@ -0,0 +1,126 @@
+/*
+ * This file is responsible for the low-latency mode:
+ * real-time scheduling, cpu pinning and memory locking
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "realtime.h"
+#include "util.h"
+
+// amount of stack touched by each real-time thread
+// so its pages are mapped before the first event
+#define PREFAULT_STACK_SIZE (64*1024)
+// stack size of the threads in low-latency mode,
+// mlockall would lock the whole default stack (often 8MiB)
+#define THREAD_STACK_SIZE (256*1024)
+
+/**
+ * Parse a cpu list like "0,2-3" into set
+ *
+ * Return 0 on success and -1 if the list is invalid
+ */
+static int parse_cpus(const char *cpus, cpu_set_t *set) {
+	CPU_ZERO(set);
+	const char *str = cpus;
+	while (*str) {
+		char *end;
+		long first = strtol(str, &end, 10);
+		if (end == str || first < 0 || first >= CPU_SETSIZE) return -1;
+		long last = first;
+		str = end;
+		if (*str == '-') {
+			++str;
+			last = strtol(str, &end, 10);
+			if (end == str || last < first || last >= CPU_SETSIZE) return -1;
+			str = end;
+		}
+		for (long cpu = first; cpu <= last; ++cpu) CPU_SET(cpu, set);
+		if (*str == ',') ++str;
+		else if (*str) return -1;
+	}
+	return CPU_COUNT(set)? 0: -1;
+}
+
+int realtime_check_settings(realtime_settings_t *settings) {
+	if (settings->policy == RT_POLICY_NONE) return 0;
+	
+	int sched_policy = settings->policy == RT_POLICY_RR? SCHED_RR: SCHED_FIFO;
+	if (settings->priority < 0) settings->priority = DEFAULT_RT_PRIORITY;
+	if (settings->priority < sched_get_priority_min(sched_policy)
+		|| settings->priority > sched_get_priority_max(sched_policy)) {
+		error_message("real-time priority must be between %d and %d",
+					  sched_get_priority_min(sched_policy),
+					  sched_get_priority_max(sched_policy));
+		return -1;
+	}
+	
+	cpu_set_t set;
+	if (settings->cpus && parse_cpus(settings->cpus, &set) == -1) {
+		error_message("invalid cpu list: %s", settings->cpus);
+		return -1;
+	}
+	return 0;
+}
+
+void realtime_init_thread_attr(realtime_settings_t *settings, pthread_attr_t *attr) {
+	exitif(pthread_attr_init(attr) != 0, "cannot init thread attributes");
+	if (settings->policy == RT_POLICY_NONE) return;
+	exitif(pthread_attr_setstacksize(attr, THREAD_STACK_SIZE) != 0,
+		   "cannot set thread stack size");
+}
+
+void realtime_lock_memory(realtime_settings_t *settings) {
+	if (settings->policy == RT_POLICY_NONE) return;
+	
+	errno = 0;
+	msgif(mlockall(MCL_CURRENT|MCL_FUTURE) == -1,
+		  "warning: cannot lock memory, page faults may delay events");
+}
+
+/**
+ * Touch PREFAULT_STACK_SIZE bytes of the stack
+ * so they are mapped (and locked by mlockall)
+ */
+static void prefault_stack() {
+	char stack[PREFAULT_STACK_SIZE];
+	memset(stack, 0, sizeof(stack));
+	// prevent the compiler from removing the memset
+	__asm__ volatile("" : : "r"(stack) : "memory");
+}
+
+void realtime_apply_thread(realtime_settings_t *settings, const char *name) {
+	if (settings->policy == RT_POLICY_NONE) return;
+	
+	struct sched_param param = {
+		.sched_priority = settings->priority,
+	};
+	int sched_policy = settings->policy == RT_POLICY_RR? SCHED_RR: SCHED_FIFO;
+	int err = pthread_setschedparam(pthread_self(), sched_policy, &param);
+	if (err) {
+		errno = err;
+		msgif(true, "warning: cannot use real-time scheduling for the %s thread%s",
+			  name, err == EPERM? " (missing CAP_SYS_NICE), "
+			  "falling back to default scheduling": "");
+	}
+	
+	if (settings->cpus) {
+		cpu_set_t set;
+		parse_cpus(settings->cpus, &set);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (err) {
+			errno = err;
+			msgif(true, "warning: cannot pin the %s thread to cpus %s",
+				  name, settings->cpus);
+		}
+	}
+	
+	prefault_stack();
+}
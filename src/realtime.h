@@ -0,0 +1,63 @@
+#ifndef __REALTIME_H__
+#define __REALTIME_H__
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#define RT_POLICY_NONE 0
+#define RT_POLICY_FIFO 1
+#define RT_POLICY_RR   2
+
+#define DEFAULT_RT_PRIORITY 50
+
+struct realtime_settings {
+	// RT_POLICY_NONE, RT_POLICY_FIFO or RT_POLICY_RR
+	// if RT_POLICY_NONE, every other setting is ignored
+	int policy;
+	
+	// real-time priority of the threads,
+	// if negative, DEFAULT_RT_PRIORITY is used
+	int priority;
+	
+	// if non null, list of cpus on which
+	// the threads are pinned (e.g. "0,2-3")
+	char *cpus;
+};
+typedef struct realtime_settings realtime_settings_t;
+
+/**
+ * Check the settings
+ *
+ * Return 0 on success, and -1 if the
+ * settings are invalid
+ */
+int realtime_check_settings(realtime_settings_t *settings);
+
+/**
+ * Init attr for the creation of a thread
+ * In low-latency mode, the stack is kept small
+ * as it will be locked in memory
+ */
+void realtime_init_thread_attr(realtime_settings_t *settings, pthread_attr_t *attr);
+
+/**
+ * Lock the current and future memory of the process
+ * so the input path never waits for a page fault
+ *
+ * Should be called once the initialisation is done
+ * Does nothing if no real-time policy is set
+ */
+void realtime_lock_memory(realtime_settings_t *settings);
+
+/**
+ * Apply the real-time policy, the priority and the cpu affinity
+ * to the calling thread and pre-fault its stack
+ *
+ * If the process does not have the privileges to do so,
+ * print a warning and keep the default scheduling
+ *
+ * name: name of the thread, used in messages
+ */
+void realtime_apply_thread(realtime_settings_t *settings, const char *name);
+
+#endif // !__REALTIME_H__
@@ -0,0 +1,351 @@
+/*
+ * This file is responsible for the flight recorder:
+ * the last seconds of what kerpad did are always kept
+ * in memory, and written in a file when something
+ * goes wrong, to understand intermittent problems
+ *
+ * Each thread records in its own preallocated ring,
+ * published by its count of records, so the watchdog
+ * can copy the rings while they are written and
+ * drop the records overwritten during the copy
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "recorder.h"
+#include "util.h"
+
+#define RECORDER_MAX_THREADS 8
+
+// time between two checks of the watchdog, in milliseconds
+#define CHECK_INTERVAL 250
+// min time between two dumps of anomalies, in seconds
+#define DUMP_INTERVAL 10
+// max number of dumps of anomalies per run
+#define MAX_DUMPS 16
+
+// value of pending asking the watchdog to stop
+#define STOP RECORDER_N_ANOMALIES
+
+#define RECORD_EVENT   0
+#define RECORD_STATE   1
+#define RECORD_MOTION  2
+#define RECORD_SCROLL  3
+#define RECORD_WAKEUP  4
+#define RECORD_ANOMALY 5
+
+#define STATE_TOUCHED       1
+#define STATE_EDGE_TOUCHED  2
+#define STATE_PRESSED       4
+#define STATE_DOUBLE_TAPPED 8
+
+struct record {
+	// time given by the clock, in us
+	long time;
+	int kind;
+	// latency or delay of the record, in us, or anomaly
+	// value, kept in a long so it is never truncated
+	long value;
+	int args[5];
+	// ring of the record, only set in the dumps
+	int thread;
+};
+
+struct recorder_ring {
+	// written by its thread only
+	const char *name;
+	// number of records written, the record of
+	// a count is complete once it is published
+	atomic_ulong count;
+	struct record *records;
+};
+
+static const char *anomaly_names[RECORDER_N_ANOMALIES] = {
+	"stall", "latency", "overrun", "syn-dropped", "request",
+};
+
+static struct {
+	struct recorder_ring rings[RECORDER_MAX_THREADS];
+	atomic_int n_rings;
+	
+	kclock_t *clock;
+	touchpad_t *touchpad;
+	const char *dir;
+	// anomaly waiting to be dumped, -1 if none,
+	// or STOP, the watchdog waits on it
+	atomic_int pending;
+	pthread_t watchdog;
+	
+	// the fields below are only used by the watchdog
+	// copy of the rings, sorted by time
+	struct record *dump;
+	// dumps of anomalies, and files written
+	int n_dumps;
+	int n_files;
+	long last_dump;
+	
+	bool started;
+} recorder;
+
+// ring of the calling thread, -1 if none
+static _Thread_local int thread_ring = -1;
+
+static void *watchdog_thread(void *arg);
+
+void recorder_init(kclock_t *clock, touchpad_t *touchpad, const char *dir) {
+	for (int i = 0; i < RECORDER_MAX_THREADS; ++i) {
+		struct recorder_ring *ring = recorder.rings+i;
+		ring->name = NULL;
+		atomic_init(&ring->count, 0);
+		ring->records = malloc(RECORDER_RING_SIZE*sizeof(struct record));
+		exitif(ring->records == NULL, "cannot allocate the flight recorder");
+		// map the pages now rather than while recording
+		memset(ring->records, 0, RECORDER_RING_SIZE*sizeof(struct record));
+	}
+	// only touched by the dumps
+	recorder.dump = malloc(RECORDER_MAX_THREADS*RECORDER_RING_SIZE*sizeof(struct record));
+	exitif(recorder.dump == NULL, "cannot allocate the flight recorder");
+	atomic_init(&recorder.n_rings, 0);
+	recorder.clock = clock;
+	recorder.touchpad = touchpad;
+	recorder.dir = dir;
+	atomic_init(&recorder.pending, -1);
+	recorder.n_dumps = 0;
+	recorder.n_files = 0;
+	recorder.last_dump = 0;
+	recorder.started = true;
+	exitif(pthread_create(&recorder.watchdog, NULL, watchdog_thread, NULL) != 0,
+		   "cannot create the flight recorder thread");
+}
+
+/**
+ * Return the ring of the calling thread,
+ * NULL if there are too many threads
+ */
+static struct recorder_ring *get_ring() {
+	if (thread_ring < 0) thread_ring = atomic_fetch_add(&recorder.n_rings, 1);
+	if (thread_ring >= RECORDER_MAX_THREADS) return NULL;
+	return recorder.rings+thread_ring;
+}
+
+void recorder_thread(const char *name) {
+	if (!recorder.started) return;
+	struct recorder_ring *ring = get_ring();
+	if (ring) ring->name = name;
+}
+
+/**
+ * Record in the ring of the calling thread,
+ * overwriting the oldest record if it is full
+ */
+static void record(int kind, long value, int a, int b, int c, int d, int e) {
+	struct recorder_ring *ring = get_ring();
+	if (!ring) return;
+	unsigned long count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+	ring->records[count%RECORDER_RING_SIZE] = (struct record) {
+		.time = kclock_now(recorder.clock),
+		.kind = kind,
+		.value = value,
+		.args = {a, b, c, d, e},
+	};
+	atomic_store_explicit(&ring->count, count+1, memory_order_release);
+}
+
+void recorder_event(int device, struct input_event *event, long latency) {
+	if (!recorder.started) return;
+	record(RECORD_EVENT, latency, device, event->type, event->code, event->value, 0);
+}
+
+void recorder_state(touchpad_info_t *info) {
+	if (!recorder.started) return;
+	int flags = (info->touched? STATE_TOUCHED: 0)
+		| (info->edge_touched? STATE_EDGE_TOUCHED: 0)
+		| (info->pressed? STATE_PRESSED: 0)
+		| (info->double_tapped? STATE_DOUBLE_TAPPED: 0);
+	record(RECORD_STATE, 0, info->device, info->x, info->y,
+		   (info->edgex+1)*3+info->edgey+1, flags);
+}
+
+void recorder_motion(int dx, int dy) {
+	if (!recorder.started) return;
+	record(RECORD_MOTION, 0, dx, dy, 0, 0, 0);
+}
+
+void recorder_scroll(int wheel, int hwheel) {
+	if (!recorder.started) return;
+	record(RECORD_SCROLL, 0, wheel, hwheel, 0, 0, 0);
+}
+
+void recorder_wakeup(long deadline) {
+	if (!recorder.started) return;
+	long late = deadline < 0? -1: kclock_now(recorder.clock)-deadline;
+	record(RECORD_WAKEUP, late, 0, 0, 0, 0, 0);
+	if (late > RECORDER_MAX_OVERRUN) recorder_anomaly(RECORDER_OVERRUN, late);
+}
+
+void recorder_anomaly(int anomaly, long value) {
+	if (!recorder.started) return;
+	// the ring of an interrupted thread
+	// cannot be written by a signal handler
+	if (anomaly != RECORDER_REQUEST) record(RECORD_ANOMALY, value, anomaly, 0, 0, 0, 0);
+	int none = -1;
+	if (atomic_compare_exchange_strong(&recorder.pending, &none, anomaly))
+		futex_wake(&recorder.pending, 1);
+}
+
+/**
+ * Copy the complete records of the ring
+ * in dump, and return their number
+ */
+static int copy_ring(int thread, struct record *dump) {
+	struct recorder_ring *ring = recorder.rings+thread;
+	unsigned long end = atomic_load_explicit(&ring->count, memory_order_acquire);
+	unsigned long begin = end > RECORDER_RING_SIZE? end-RECORDER_RING_SIZE: 0;
+	for (unsigned long i = begin; i < end; ++i) dump[i-begin] = ring->records[i%RECORDER_RING_SIZE];
+	atomic_thread_fence(memory_order_acquire);
+	// the records of the counts written during the copy,
+	// and the one being written, overwrote the oldest ones
+	unsigned long count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+	unsigned long first = count+1 > RECORDER_RING_SIZE? count+1-RECORDER_RING_SIZE: 0;
+	if (first > end) first = end;
+	if (first < begin) first = begin;
+	int n = end-first;
+	memmove(dump, dump+(first-begin), n*sizeof(*dump));
+	for (int i = 0; i < n; ++i) dump[i].thread = thread;
+	return n;
+}
+
+static int compare_records(const void *a, const void *b) {
+	long x = ((const struct record *)a)->time;
+	long y = ((const struct record *)b)->time;
+	return (x > y)-(x < y);
+}
+
+/**
+ * Write a record, with its time relative to now
+ */
+static void write_record(FILE *file, struct record *r, long now) {
+	const char *name = recorder.rings[r->thread].name;
+	char default_name[32];
+	if (!name) {
+		snprintf(default_name, sizeof(default_name), "thread %d", r->thread);
+		name = default_name;
+	}
+	fprintf(file, "%+11.6f %-16s ", (r->time-now)/1e6, name);
+	int *a = r->args;
+	switch (r->kind) {
+	case RECORD_EVENT:
+		fprintf(file, "event   device %d type %d code %d value %d", a[0], a[1], a[2], a[3]);
+		if (r->value >= 0) fprintf(file, " latency %ld us", r->value);
+		break;
+	case RECORD_STATE:
+		fprintf(file, "state   device %d x %d y %d edge %d %d%s%s%s%s", a[0], a[1], a[2],
+				a[3]/3-1, a[3]%3-1,
+				a[4]&STATE_TOUCHED? " touched": "",
+				a[4]&STATE_EDGE_TOUCHED? " edge-touched": "",
+				a[4]&STATE_PRESSED? " pressed": "",
+				a[4]&STATE_DOUBLE_TAPPED? " double-tapped": "");
+		break;
+	case RECORD_MOTION:
+		fprintf(file, "motion  %d %d", a[0], a[1]);
+		break;
+	case RECORD_SCROLL:
+		fprintf(file, "scroll  %d %d", a[0], a[1]);
+		break;
+	case RECORD_WAKEUP:
+		if (r->value < 0) fprintf(file, "wakeup  event");
+		else fprintf(file, "wakeup  late %ld us", r->value);
+		break;
+	case RECORD_ANOMALY:
+		fprintf(file, "anomaly %s %ld", anomaly_names[a[0]], r->value);
+		break;
+	}
+	fprintf(file, "\n");
+}
+
+/**
+ * Write the records of all the threads in a new file
+ */
+static void dump(int anomaly) {
+	long now = kclock_now(recorder.clock);
+	// the anomalies are rate limited, not the requests
+	if (anomaly != RECORDER_REQUEST) {
+		if (recorder.n_dumps == MAX_DUMPS
+			|| (recorder.n_dumps && now-recorder.last_dump < DUMP_INTERVAL*1000000L)) return;
+		++recorder.n_dumps;
+		recorder.last_dump = now;
+	}
+	
+	int n_rings = atomic_load(&recorder.n_rings);
+	if (n_rings > RECORDER_MAX_THREADS) n_rings = RECORDER_MAX_THREADS;
+	int n = 0;
+	for (int i = 0; i < n_rings; ++i) n += copy_ring(i, recorder.dump+n);
+	qsort(recorder.dump, n, sizeof(*recorder.dump), compare_records);
+	
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/kerpad-flight-%d-%d.txt", recorder.dir, getpid(),
+			 recorder.n_files++);
+	FILE *file = fopen(path, "w");
+	if (msgif(file == NULL, "cannot write the flight records in %s", path)) return;
+	fprintf(file, "# kerpad flight records, anomaly: %s\n", anomaly_names[anomaly]);
+	fprintf(file, "# time relative to the dump (s), thread, record\n");
+	for (int i = 0; i < n; ++i) write_record(file, recorder.dump+i, now);
+	fclose(file);
+	error_message("warning: flight recorder: %s, %d records written in %s",
+				  anomaly_names[anomaly], n, path);
+}
+
+/**
+ * Thread responsible for dumping the records when an anomaly
+ * is recorded, and for detecting the stalls of the listening thread
+ */
+static void *watchdog_thread(void *arg) {
+	(void)arg;
+	recorder_thread("watchdog");
+	unsigned long handled = 0;
+	int stalled_time = 0;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	long next = ts.tv_sec*1000000L+ts.tv_nsec/1000;
+	while (1) {
+		next += CHECK_INTERVAL*1000L;
+		futex_wait_until(&recorder.pending, -1, next);
+		int anomaly = atomic_exchange(&recorder.pending, -1);
+		if (anomaly == STOP) break;
+		if (anomaly >= 0) dump(anomaly);
+		
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		// woken up by an anomaly before the check
+		if (ts.tv_sec*1000000L+ts.tv_nsec/1000 < next) {
+			next -= CHECK_INTERVAL*1000L;
+			continue;
+		}
+		if (!touchpad_stalled(recorder.touchpad, &handled)) {
+			stalled_time = 0;
+			continue;
+		}
+		stalled_time += CHECK_INTERVAL;
+		// reported once per stall
+		if (stalled_time >= RECORDER_STALL_TIME
+			&& stalled_time-CHECK_INTERVAL < RECORDER_STALL_TIME)
+			recorder_anomaly(RECORDER_STALL, stalled_time);
+	}
+	return NULL;
+}
+
+void recorder_clean() {
+	if (!recorder.started) return;
+	atomic_store(&recorder.pending, STOP);
+	futex_wake(&recorder.pending, 1);
+	pthread_join(recorder.watchdog, NULL);
+	recorder.started = false;
+	for (int i = 0; i < RECORDER_MAX_THREADS; ++i) free(recorder.rings[i].records);
+	free(recorder.dump);
+}
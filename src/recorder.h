@@ -0,0 +1,113 @@
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <linux/input.h>
+
+#include "clock.h"
+#include "touchpad.h"
+
+// default directory of the dumps
+#define DEFAULT_RECORDER_DIR "/var/tmp"
+
+// number of records kept per thread, the oldest ones
+// are overwritten, must be a power of 2
+// It is a few seconds of touchpad frames or of motion ticks
+#define RECORDER_RING_SIZE 2048
+
+// anomalies that dump the records, and their value
+// the listening thread did not read pending events, value: ms
+#define RECORDER_STALL       0
+// a frame was handled late, value: latency in us
+#define RECORDER_LATENCY     1
+// a tick woke up late, value: delay in us
+#define RECORDER_OVERRUN     2
+// the kernel dropped events, value: device
+#define RECORDER_SYN_DROPPED 3
+// a dump was asked with SIGUSR1, value: unused
+#define RECORDER_REQUEST     4
+#define RECORDER_N_ANOMALIES 5
+
+// thresholds of the anomalies
+#define RECORDER_STALL_TIME   500
+#define RECORDER_MAX_LATENCY  20000
+#define RECORDER_MAX_OVERRUN  20000
+
+/**
+ * Start the flight recorder: the raw touchpad events,
+ * the applied states, the motion and scrolling steps and
+ * the wake ups of the threads are recorded in a ring per
+ * thread, and a watchdog thread writes them in a file
+ * of dir when an anomaly is detected
+ *
+ * The rings are allocated and touched here, so recording
+ * does not allocate, lock nor fault a page
+ *
+ * clock: gives the time of the records
+ * touchpad: checked by the watchdog for stalls
+ */
+void recorder_init(kclock_t *clock, touchpad_t *touchpad, const char *dir);
+
+/**
+ * Name the calling thread in the dumps
+ * Does nothing if the recorder is not started
+ */
+void recorder_thread(const char *name);
+
+/**
+ * Record an event read from a device
+ *
+ * latency: time from the event to its handling
+ *          for a SYN_REPORT, in us, -1 otherwise
+ *
+ * Does nothing if the recorder is not started
+ */
+void recorder_event(int device, struct input_event *event, long latency);
+
+/**
+ * Record the state of a device after a frame was applied
+ * Does nothing if the recorder is not started
+ */
+void recorder_state(touchpad_info_t *info);
+
+/**
+ * Record a move of the cursor
+ * Does nothing if the recorder is not started
+ */
+void recorder_motion(int dx, int dy);
+
+/**
+ * Record a scroll, in hi-res units
+ * Does nothing if the recorder is not started
+ */
+void recorder_scroll(int wheel, int hwheel);
+
+/**
+ * Record a wake up of the calling thread
+ *
+ * deadline: time at which the thread should have
+ *           woken up, -1 if it waited for an event
+ *
+ * Does nothing if the recorder is not started
+ */
+void recorder_wakeup(long deadline);
+
+/**
+ * Record an anomaly and ask the watchdog to dump the records
+ * The dumps are rate limited
+ *
+ * anomaly: one of the RECORDER_* anomalies
+ *
+ * Can be called by a signal handler with RECORDER_REQUEST,
+ * the anomaly is not recorded then
+ * Does nothing if the recorder is not started
+ */
+void recorder_anomaly(int anomaly, long value);
+
+/**
+ * Stop the watchdog and free the rings,
+ * the threads must not record anymore
+ * Does nothing if the recorder is not started
+ */
+void recorder_clean();
+
+#endif // !__RECORDER_H__
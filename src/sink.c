@@ -0,0 +1,294 @@
+/*
+ * This file is responsible for writing
+ * the events of the simulated mouse
+ * to an output: a virtual device, a trace file,
+ * a memory buffer or nothing
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <linux/uinput.h>
+
+#include "sink.h"
+#include "util.h"
+#include "uring.h"
+#include "startup.h"
+
+// max number of events queued with the
+// io_uring backend before they are written
+#define URING_BUFFER_SIZE 256
+
+struct sink {
+	sink_settings_t settings;
+	sink_stats_t stats;
+	kclock_t *clock;
+	
+	// used by SINK_UINPUT and SINK_TRACE_BIN
+	int fd;
+	// with IO_URING, NULL otherwise
+	uring_t *uring;
+	// registered buffer of the queued events
+	struct input_event *uring_buffer;
+	// number of events queued, not written yet
+	int uring_events;
+	// used by SINK_TRACE
+	FILE *file;
+	
+	// used by SINK_MEMORY
+	struct input_event *events;
+	size_t n_events;
+};
+
+int sink_parse(const char *description, sink_settings_t *settings) {
+	settings->path = NULL;
+	settings->io = IO_BLOCKING;
+	if (!strcmp(description, "uinput")) {
+		settings->type = SINK_UINPUT;
+	} else if (!strcmp(description, "null")) {
+		settings->type = SINK_NULL;
+	} else if (!strcmp(description, "memory")) {
+		settings->type = SINK_MEMORY;
+	} else if (!strncmp(description, "trace:", 6) && description[6]) {
+		settings->type = SINK_TRACE;
+		settings->path = (char *)description+6;
+	} else if (!strncmp(description, "trace-bin:", 10) && description[10]) {
+		settings->type = SINK_TRACE_BIN;
+		settings->path = (char *)description+10;
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+static void init_uinput(sink_t *sink, const char *name) {
+	sink->fd = open("/dev/uinput", O_WRONLY|O_NONBLOCK);
+	exitif(sink->fd == -1, "cannot open /dev/uinput");
+	struct uinput_setup usetup = {};
+	
+	ioctl(sink->fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(sink->fd, UI_SET_KEYBIT, BTN_LEFT);
+	ioctl(sink->fd, UI_SET_KEYBIT, BTN_RIGHT);
+	ioctl(sink->fd, UI_SET_KEYBIT, BTN_MIDDLE);
+	
+	ioctl(sink->fd, UI_SET_EVBIT, EV_REL);
+	ioctl(sink->fd, UI_SET_RELBIT, REL_X);
+	ioctl(sink->fd, UI_SET_RELBIT, REL_Y);
+	ioctl(sink->fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+	ioctl(sink->fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+	
+	usetup.id.bustype = BUS_USB;
+	usetup.id.vendor = 0x1234;
+	usetup.id.product = 0x5678;
+	strcpy(usetup.name, name);
+	ioctl(sink->fd, UI_DEV_SETUP, &usetup);
+	ioctl(sink->fd, UI_DEV_CREATE);
+	startup_mark("uinput-create");
+	// let the compositor find the device
+	// before the first events
+	sleep(1);
+}
+
+/**
+ * Init the io_uring used to write to the file of the sink,
+ * keep the blocking writes if io_uring is not supported
+ */
+static void init_uring(sink_t *sink) {
+	sink->uring_buffer = malloc(URING_BUFFER_SIZE*sizeof(*sink->uring_buffer));
+	exitif(sink->uring_buffer == NULL, "cannot allocate the io_uring buffer");
+	struct iovec buffer = {
+		.iov_base = sink->uring_buffer,
+		.iov_len = URING_BUFFER_SIZE*sizeof(*sink->uring_buffer),
+	};
+	
+	errno = 0;
+	sink->uring = uring_init(4);
+	if (sink->uring == NULL
+		|| uring_register_files(sink->uring, &sink->fd, 1) == -1
+		|| uring_register_buffers(sink->uring, &buffer, 1) == -1) {
+		msgif(true, "warning: cannot use io_uring to write the events, "
+			  "falling back to blocking writes");
+		if (sink->uring) uring_clean(sink->uring);
+		sink->uring = NULL;
+		free(sink->uring_buffer);
+		sink->uring_buffer = NULL;
+	}
+}
+
+/**
+ * Return the name of the file of the sink, for the errors
+ */
+static const char *file_name(sink_t *sink) {
+	return sink->settings.type == SINK_UINPUT? "/dev/uinput": sink->settings.path;
+}
+
+/**
+ * Write the queued events at once, and wait for the completion
+ *
+ * Return 0 on success and -1 on error
+ */
+static int write_queued(sink_t *sink) {
+	uring_write(sink->uring, 0, sink->uring_buffer,
+				sink->uring_events*sizeof(*sink->uring_buffer), 0, false, 0);
+	sink->uring_events = 0;
+	uring_completion_t completion;
+	while (uring_wait(sink->uring, 1, &completion, 1) < 1);
+	if (completion.res < 0) {
+		errno = -completion.res;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Write size bytes to the file of the sink, with the io_uring
+ * backend the events are only queued until sink_flush
+ *
+ * Return 0 on success and -1 on error
+ */
+static int write_file(sink_t *sink, const void *buf, size_t size) {
+	if (!sink->uring) return write(sink->fd, buf, size) == -1? -1: 0;
+	
+	size_t count = size/sizeof(*sink->uring_buffer);
+	if (sink->uring_events+count > URING_BUFFER_SIZE
+		&& sink->uring_events && write_queued(sink) == -1) return -1;
+	if (count > URING_BUFFER_SIZE) return write(sink->fd, buf, size) == -1? -1: 0;
+	// the frames follow each other in the buffer, so they
+	// are written in order by a single request
+	memcpy(sink->uring_buffer+sink->uring_events, buf, size);
+	sink->uring_events += count;
+	return 0;
+}
+
+sink_t *sink_init(sink_settings_t *settings, const char *name, kclock_t *clock) {
+	sink_t *sink = malloc(sizeof(*sink));
+	sink->settings = *settings;
+	sink->clock = clock;
+	sink->stats = (sink_stats_t) {};
+	sink->fd = -1;
+	sink->uring = NULL;
+	sink->uring_buffer = NULL;
+	sink->uring_events = 0;
+	sink->file = NULL;
+	sink->events = NULL;
+	sink->n_events = 0;
+	
+	bool to_stdout = settings->path && !strcmp(settings->path, "-");
+	switch (settings->type) {
+	case SINK_UINPUT:
+		init_uinput(sink, name);
+		break;
+	case SINK_TRACE:
+		sink->file = to_stdout? stdout: fopen(settings->path, "w");
+		exitif(sink->file == NULL, "cannot open %s", settings->path);
+		break;
+	case SINK_TRACE_BIN:
+		sink->fd = to_stdout? STDOUT_FILENO:
+			open(settings->path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+		exitif(sink->fd == -1, "cannot open %s", settings->path);
+		break;
+	case SINK_MEMORY:
+		sink->events = malloc(SINK_MEMORY_SIZE*sizeof(*sink->events));
+		exitif(sink->events == NULL, "cannot allocate the memory sink");
+		break;
+	}
+	if (sink->fd != -1 && settings->io == IO_URING) init_uring(sink);
+	return sink;
+}
+
+void sink_write(sink_t *sink, const struct input_event *events, int count) {
+	++sink->stats.writes;
+	sink->stats.events += count;
+	for (int i = 0; i < count; ++i) {
+		if (events[i].type == EV_SYN && events[i].code == SYN_REPORT) {
+			++sink->stats.frames;
+		} else if (events[i].type == EV_REL) {
+			unsigned long value = abs(events[i].value);
+			if (events[i].code == REL_X || events[i].code == REL_Y)
+				sink->stats.motion += value;
+			else sink->stats.scroll += value;
+		}
+	}
+	
+	long now = 0;
+	if (sink->settings.type == SINK_TRACE || sink->settings.type == SINK_TRACE_BIN)
+		now = kclock_now(sink->clock);
+	
+	switch (sink->settings.type) {
+	case SINK_UINPUT:
+		exitif(write_file(sink, events, count*sizeof(*events)) == -1,
+			   "cannot write to %s", file_name(sink));
+		break;
+	case SINK_TRACE:
+		for (int i = 0; i < count; ++i) {
+			fprintf(sink->file, "%ld.%06ld %d %d %d\n",
+					now/1000000, now%1000000,
+					events[i].type, events[i].code, events[i].value);
+		}
+		break;
+	case SINK_TRACE_BIN: {
+		struct input_event stamped[count];
+		for (int i = 0; i < count; ++i) {
+			stamped[i] = events[i];
+			stamped[i].input_event_sec = now/1000000;
+			stamped[i].input_event_usec = now%1000000;
+		}
+		exitif(write_file(sink, stamped, sizeof(stamped)) == -1,
+			   "cannot write to %s", file_name(sink));
+		break;
+	}
+	case SINK_MEMORY:
+		for (int i = 0; i < count; ++i) {
+			if (sink->n_events == SINK_MEMORY_SIZE) {
+				++sink->stats.lost;
+				continue;
+			}
+			sink->events[sink->n_events++] = events[i];
+		}
+		break;
+	}
+}
+
+void sink_flush(sink_t *sink) {
+	if (!sink->uring_events) return;
+	exitif(write_queued(sink) == -1, "cannot write to %s", file_name(sink));
+}
+
+void sink_get_stats(sink_t *sink, sink_stats_t *stats) {
+	*stats = sink->stats;
+}
+
+const struct input_event *sink_get_events(sink_t *sink, size_t *count) {
+	*count = sink->n_events;
+	return sink->events;
+}
+
+void sink_clean(sink_t *sink) {
+	sink_flush(sink);
+	if (sink->uring) {
+		uring_clean(sink->uring);
+		free(sink->uring_buffer);
+	}
+	switch (sink->settings.type) {
+	case SINK_UINPUT:
+		sleep(1);
+		ioctl(sink->fd, UI_DEV_DESTROY);
+		close(sink->fd);
+		break;
+	case SINK_TRACE:
+		if (sink->file == stdout) fflush(stdout);
+		else exitif(fclose(sink->file) == EOF, "cannot close %s", sink->settings.path);
+		break;
+	case SINK_TRACE_BIN:
+		if (sink->fd != STDOUT_FILENO)
+			exitif(close(sink->fd) == -1, "cannot close %s", sink->settings.path);
+		break;
+	case SINK_MEMORY:
+		free(sink->events);
+		break;
+	}
+	free(sink);
+}
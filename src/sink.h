@@ -0,0 +1,107 @@
+#ifndef __SINK_H__
+#define __SINK_H__
+
+#include <stddef.h>
+#include <linux/input.h>
+
+#include "clock.h"
+
+// events are written to a virtual device
+// created with /dev/uinput
+#define SINK_UINPUT    0
+// events are only counted
+#define SINK_NULL      1
+// events are written as text lines in a file
+#define SINK_TRACE     2
+// events are written as struct input_event in a file
+#define SINK_TRACE_BIN 3
+// events are stored in a memory buffer
+#define SINK_MEMORY    4
+
+// number of events kept by the memory sink
+#define SINK_MEMORY_SIZE (1<<16)
+
+typedef struct sink sink_t;
+
+struct sink_settings {
+	// one of the SINK_* values
+	int type;
+	
+	// path of the trace file for SINK_TRACE
+	// and SINK_TRACE_BIN, "-" is the standard output
+	char *path;
+	
+	// IO_BLOCKING or IO_URING, I/O backend
+	// of SINK_UINPUT and SINK_TRACE_BIN
+	int io;
+};
+typedef struct sink_settings sink_settings_t;
+
+struct sink_stats {
+	// number of written frames (SYN_REPORT)
+	unsigned long frames;
+	// number of written events, SYN_REPORT included
+	unsigned long events;
+	// number of calls to sink_write
+	unsigned long writes;
+	// events that did not fit in the memory sink
+	unsigned long lost;
+	// sum of the absolute REL_X and REL_Y values
+	unsigned long motion;
+	// sum of the absolute hi-res wheel values
+	unsigned long scroll;
+};
+typedef struct sink_stats sink_stats_t;
+
+/**
+ * Parse a sink description: uinput, null, memory,
+ * trace:PATH or trace-bin:PATH
+ * The I/O backend is set to IO_BLOCKING
+ *
+ * Return 0 on success and -1 if the description is invalid
+ */
+int sink_parse(const char *description, sink_settings_t *settings);
+
+/**
+ * Init an output sink
+ *
+ * name: the name of the virtual device for SINK_UINPUT
+ * clock: gives the time of the events in trace files
+ */
+sink_t *sink_init(sink_settings_t *settings, const char *name, kclock_t *clock);
+
+/**
+ * Write count events to the sink, with the io_uring
+ * backend they are written by sink_flush
+ *
+ * Should not be called by several threads at the same time
+ */
+void sink_write(sink_t *sink, const struct input_event *events, int count);
+
+/**
+ * Complete the writes of sink_write: with the io_uring
+ * backend, the events are only queued, and are written
+ * together by a single request here
+ * Should be called by the thread that writes before it
+ * waits, so the events are not delayed
+ */
+void sink_flush(sink_t *sink);
+
+/**
+ * Write the statistics of the sink in stats
+ */
+void sink_get_stats(sink_t *sink, sink_stats_t *stats);
+
+/**
+ * Return the events stored by a SINK_MEMORY sink,
+ * and write their number in count
+ * Return NULL for other sinks
+ */
+const struct input_event *sink_get_events(sink_t *sink, size_t *count);
+
+/**
+ * Clean the sink
+ */
+void sink_clean(sink_t *sink);
+
+#endif // !__SINK_H__
@@ -0,0 +1,413 @@
+/*
+ * kerpad-soak runs kerpad for hours on a virtual touchpad
+ * driven by kerpad-loadgen, and samples at intervals
+ * its memory, its file descriptors, its threads and
+ * the latency of its frames, given by kerpad --stats
+ *
+ * It fails if one of them keeps growing, or if the
+ * latency drifts, to catch slow leaks and degradations
+ * that a short run cannot show
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+#include "util.h"
+
+// 4 hours
+#define DEFAULT_DURATION 14400
+#define DEFAULT_INTERVAL 60
+#define DEFAULT_WARMUP 2
+// allowed growth of the resident memory, in kB
+#define DEFAULT_MAX_RSS 512
+// allowed increase of the p99 latency, in us
+#define DEFAULT_MAX_DRIFT 200
+#define DEFAULT_KERPAD "./kerpad"
+#define DEFAULT_LOADGEN "./kerpad-loadgen"
+// name of the touchpad created by kerpad-loadgen
+#define LOADGEN_NAME "Kerpad Loadgen Touchpad"
+// time given to kerpad-loadgen to create its touchpad, in us
+#define LOADGEN_DELAY 2000000
+// simulated duration given to kerpad, longer than any soak
+#define SIMULATION_TIME "1000000000"
+// prefix of the lines printed by kerpad --stats
+#define STATS_PREFIX "stats: "
+#define MAX_ARGS 64
+#define LINE_SIZE 256
+
+static struct option long_options[] = {
+	{"duration", required_argument, NULL, 'd'},
+	{"interval", required_argument, NULL, 'i'},
+	{"warmup", required_argument, NULL, 'w'},
+	{"max-rss", required_argument, NULL, 'r'},
+	{"max-drift", required_argument, NULL, 'l'},
+	{"simulate", no_argument, NULL, 's'},
+	{"kerpad", required_argument, NULL, 'k'},
+	{"loadgen", required_argument, NULL, 'g'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0},
+};
+
+// state of kerpad at the end of an interval
+struct sample {
+	long time;
+	long rss;
+	long fds;
+	long threads;
+	unsigned long frames;
+	long p50;
+	long p99;
+	long max;
+};
+
+// a value of the samples checked at the end
+struct series {
+	const char *name;
+	const char *unit;
+	size_t offset;
+	// allowed growth
+	long max_growth;
+};
+
+struct soak {
+	struct sample *samples;
+	int n_samples;
+	int max_samples;
+	int warmup;
+	long max_rss;
+	long max_drift;
+};
+
+static void print_help(char *argv[]) {
+	printf("Usage: %s [options] [-- kerpad options]\n", argv[0]);
+	printf("Run kerpad for a long time and check that its resources\n");
+	printf("and its latency stay flat.\n\n");
+	printf("    -d, --duration=SEC    duration of the soak (default: %d)\n", DEFAULT_DURATION);
+	printf("    -i, --interval=SEC    time between samples (default: %d)\n", DEFAULT_INTERVAL);
+	printf("    -w, --warmup=N        samples ignored at the start (default: %d)\n",
+		   DEFAULT_WARMUP);
+	printf("    -r, --max-rss=KB      allowed growth of the resident memory\n");
+	printf("                          (default: %d)\n", DEFAULT_MAX_RSS);
+	printf("    -l, --max-drift=US    allowed increase of the p99 latency\n");
+	printf("                          (default: %d)\n", DEFAULT_MAX_DRIFT);
+	printf("    -s, --simulate        use a simulated touchpad instead of\n");
+	printf("                          kerpad-loadgen, faster than real time\n");
+	printf("    -k, --kerpad=PATH     kerpad executable (default: %s)\n", DEFAULT_KERPAD);
+	printf("    -g, --loadgen=PATH    kerpad-loadgen executable (default: %s)\n",
+		   DEFAULT_LOADGEN);
+	printf("    -h, --help            display this help and exit\n");
+}
+
+static long now_us() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000L+now.tv_nsec/1000;
+}
+
+/**
+ * Start args[0] with args, its standard output
+ * is dropped and its standard error is written in err
+ *
+ * err: file descriptor, or -1 to drop it too
+ */
+static pid_t spawn(char *args[], int err) {
+	pid_t pid = fork();
+	exitif(pid == -1, "cannot fork");
+	if (pid == 0) {
+		// do not outlive the soak
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		int null = open("/dev/null", O_WRONLY);
+		if (null != -1) {
+			dup2(null, STDOUT_FILENO);
+			if (err == -1) dup2(null, STDERR_FILENO);
+		}
+		if (err != -1) dup2(err, STDERR_FILENO);
+		execv(args[0], args);
+		exitif(true, "cannot execute %s", args[0]);
+	}
+	return pid;
+}
+
+/**
+ * Read the resident memory and the number
+ * of threads of a process in its status
+ *
+ * Return 0 on success and -1 on error
+ */
+static int read_status(pid_t pid, struct sample *sample) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *status = fopen(path, "r");
+	if (status == NULL) return -1;
+	char line[LINE_SIZE];
+	sample->rss = -1;
+	sample->threads = -1;
+	while (fgets(line, sizeof(line), status)) {
+		sscanf(line, "VmRSS: %ld", &sample->rss);
+		sscanf(line, "Threads: %ld", &sample->threads);
+	}
+	fclose(status);
+	return sample->rss == -1 || sample->threads == -1? -1: 0;
+}
+
+/**
+ * Return the number of open file descriptors
+ * of a process, -1 on error
+ */
+static long count_fds(pid_t pid) {
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+	DIR *dir = opendir(path);
+	if (dir == NULL) return -1;
+	long count = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] != '.') ++count;
+	}
+	closedir(dir);
+	return count;
+}
+
+/**
+ * Sample kerpad after a line of its statistics
+ *
+ * Return 0 on success and -1 on error
+ */
+static int add_sample(struct soak *soak, pid_t pid, const char *line) {
+	struct sample sample;
+	if (sscanf(line, STATS_PREFIX "%ld s, %lu frames, latency p50 %ld us, "
+			   "p99 %ld us, max %ld us", &sample.time, &sample.frames,
+			   &sample.p50, &sample.p99, &sample.max) != 5) return -1;
+	sample.fds = count_fds(pid);
+	if (read_status(pid, &sample) == -1 || sample.fds == -1) return -1;
+	
+	if (soak->n_samples == soak->max_samples) {
+		soak->max_samples = soak->max_samples? 2*soak->max_samples: 64;
+		soak->samples = realloc(soak->samples, soak->max_samples*sizeof(*soak->samples));
+		exitif(soak->samples == NULL, "cannot allocate the samples");
+	}
+	soak->samples[soak->n_samples++] = sample;
+	printf("%8ld %10ld %6ld %8ld %10lu %8ld %8ld %8ld%s\n", sample.time, sample.rss,
+		   sample.fds, sample.threads, sample.frames, sample.p50, sample.p99, sample.max,
+		   soak->n_samples <= soak->warmup? "  (warmup)": "");
+	fflush(stdout);
+	return 0;
+}
+
+/**
+ * Run kerpad until the end of the soak,
+ * sampling it after each line of its statistics
+ *
+ * Return 0 on success and -1 if kerpad
+ * stopped before the end
+ */
+static int run(struct soak *soak, char *args[], long duration) {
+	printf("%8s %10s %6s %8s %10s %8s %8s %8s\n", "time (s)", "rss (kB)", "fds",
+		   "threads", "frames", "p50 (us)", "p99 (us)", "max (us)");
+	fflush(stdout);
+	int fds[2];
+	exitif(pipe(fds) == -1, "cannot create a pipe");
+	pid_t pid = spawn(args, fds[1]);
+	close(fds[1]);
+	
+	FILE *output = fdopen(fds[0], "r");
+	exitif(output == NULL, "cannot read the output of kerpad");
+	long end = now_us()+duration*1000000;
+	char line[LINE_SIZE];
+	// last line that is not a statistic,
+	// to show why kerpad stopped
+	char message[LINE_SIZE] = "";
+	bool done = false;
+	while (fgets(line, sizeof(line), output)) {
+		if (done) continue;
+		if (strncmp(line, STATS_PREFIX, strlen(STATS_PREFIX))
+			|| add_sample(soak, pid, line) == -1) {
+			snprintf(message, strcspn(line, "\n")+1, "%s", line);
+			continue;
+		}
+		if (now_us() >= end) {
+			done = true;
+			kill(pid, SIGTERM);
+		}
+	}
+	fclose(output);
+	waitpid(pid, NULL, 0);
+	
+	if (!done) {
+		error_message("kerpad stopped before the end of the soak%s%s",
+					  *message? ": ": "", message);
+		return -1;
+	}
+	return 0;
+}
+
+static int compare_long(const void *a, const void *b) {
+	long x = *(const long *)a;
+	long y = *(const long *)b;
+	return (x > y)-(x < y);
+}
+
+/**
+ * Return the median of a value of count samples
+ */
+static long median(struct sample *samples, int count, size_t offset) {
+	long values[count];
+	for (int i = 0; i < count; ++i)
+		values[i] = *(long *)((char *)(samples+i)+offset);
+	qsort(values, count, sizeof(long), compare_long);
+	return values[count/2];
+}
+
+/**
+ * Check that the values of the samples after the warmup did not
+ * keep growing: the value fails if all the samples of the second
+ * half are above all the ones of the first half by more than
+ * the allowed growth
+ *
+ * Return 0 if the value is flat, -1 otherwise
+ */
+static int check_growth(struct soak *soak, struct series *series) {
+	struct sample *samples = soak->samples+soak->warmup;
+	int n = soak->n_samples-soak->warmup;
+	long first_max = 0;
+	long second_min = 0;
+	for (int i = 0; i < n; ++i) {
+		long value = *(long *)((char *)(samples+i)+series->offset);
+		if (i < n/2 && (i == 0 || value > first_max)) first_max = value;
+		if (i >= n/2 && (i == n/2 || value < second_min)) second_min = value;
+	}
+	long first = *(long *)((char *)samples+series->offset);
+	long last = *(long *)((char *)(samples+n-1)+series->offset);
+	bool grew = second_min-first_max > series->max_growth;
+	printf("%-8s %10ld -> %-10ld %s\n", series->name, first, last, grew? "GROWING": "ok");
+	if (grew) error_message("%s keeps growing, by %ld %s", series->name,
+							last-first, series->unit);
+	return grew? -1: 0;
+}
+
+/**
+ * Check that the p99 latency of the second half of the
+ * samples did not increase compared to the first half
+ *
+ * Return 0 if it did not drift, -1 otherwise
+ */
+static int check_drift(struct soak *soak) {
+	struct sample *samples = soak->samples+soak->warmup;
+	int n = soak->n_samples-soak->warmup;
+	size_t offset = offsetof(struct sample, p99);
+	long first = median(samples, n/2, offset);
+	long second = median(samples+n/2, n-n/2, offset);
+	bool drifted = second-first > soak->max_drift;
+	printf("%-8s %10ld -> %-10ld %s\n", "p99 (us)", first, second,
+		   drifted? "DRIFTING": "ok");
+	if (drifted) error_message("the p99 latency drifted by %ld us", second-first);
+	return drifted? -1: 0;
+}
+
+int main(int argc, char *argv[]) {
+	struct soak soak = {
+		.samples = NULL,
+		.n_samples = 0,
+		.max_samples = 0,
+		.warmup = DEFAULT_WARMUP,
+		.max_rss = DEFAULT_MAX_RSS,
+		.max_drift = DEFAULT_MAX_DRIFT,
+	};
+	long duration = DEFAULT_DURATION;
+	int interval = DEFAULT_INTERVAL;
+	bool simulate = false;
+	char *kerpad = DEFAULT_KERPAD;
+	char *loadgen = DEFAULT_LOADGEN;
+	
+	while (1) {
+		int opt = getopt_long(argc, argv, "d:i:w:r:l:sk:g:h", long_options, NULL);
+		if (opt == -1) break;
+		
+		switch (opt) {
+		case 'd': duration = atol(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		case 'w': soak.warmup = atoi(optarg); break;
+		case 'r': soak.max_rss = atol(optarg); break;
+		case 'l': soak.max_drift = atol(optarg); break;
+		case 's': simulate = true; break;
+		case 'k': kerpad = optarg; break;
+		case 'g': loadgen = optarg; break;
+		case 'h':
+			print_help(argv);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv);
+			return EXIT_FAILURE;
+		}
+	}
+	if (duration <= 0 || interval <= 0 || soak.warmup < 0
+		|| argc-optind > MAX_ARGS-6) {
+		error_message("invalid options");
+		return EXIT_FAILURE;
+	}
+	
+	char stats[32];
+	snprintf(stats, sizeof(stats), "--stats=%d", interval);
+	char *args[MAX_ARGS];
+	int n_args = 0;
+	args[n_args++] = kerpad;
+	if (simulate) {
+		args[n_args++] = "--simulate="SIMULATION_TIME;
+	} else {
+		args[n_args++] = "--name="LOADGEN_NAME;
+		// the cursor is not moved during the soak,
+		// unless an other output is given
+		args[n_args++] = "--output=trace-bin:/dev/null";
+	}
+	for (int i = optind; i < argc; ++i) args[n_args++] = argv[i];
+	args[n_args++] = stats;
+	args[n_args] = NULL;
+	
+	pid_t loadgen_pid = -1;
+	if (!simulate) {
+		char *loadgen_args[] = {loadgen, NULL};
+		loadgen_pid = spawn(loadgen_args, STDERR_FILENO);
+		usleep(LOADGEN_DELAY);
+	}
+	
+	printf("soak of %lds, sampled every %ds:", duration, interval);
+	for (int i = 0; i < n_args; ++i) printf(" %s", args[i]);
+	printf("\n");
+	fflush(stdout);
+	int res = run(&soak, args, duration);
+	
+	if (loadgen_pid != -1) {
+		kill(loadgen_pid, SIGTERM);
+		waitpid(loadgen_pid, NULL, 0);
+	}
+	if (res == 0 && soak.n_samples-soak.warmup < 2) {
+		error_message("not enough samples after the warmup");
+		res = -1;
+	}
+	if (res == 0) {
+		struct series series[] = {
+			{"rss (kB)", "kB", offsetof(struct sample, rss), soak.max_rss},
+			{"fds", "fds", offsetof(struct sample, fds), 0},
+			{"threads", "threads", offsetof(struct sample, threads), 0},
+		};
+		printf("\n");
+		for (size_t i = 0; i < sizeof(series)/sizeof(*series); ++i) {
+			if (check_growth(&soak, series+i) == -1) res = -1;
+		}
+		if (check_drift(&soak) == -1) res = -1;
+	}
+	
+	free(soak.samples);
+	return res == -1? EXIT_FAILURE: EXIT_SUCCESS;
+}
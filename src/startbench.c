@@ -0,0 +1,227 @@
+/*
+ * kerpad-startbench measures cold starts of kerpad:
+ * kerpad is started again and again with --startup-report,
+ * and stopped once it is ready, and the distributions
+ * of the durations of the startup phases are printed
+ *
+ * The time from the fork to the ready line is measured
+ * here too, so it also covers the exec and the loading
+ * of the program, which kerpad cannot time itself
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "startup.h"
+#include "util.h"
+
+#define DEFAULT_RUNS 20
+#define DEFAULT_KERPAD "./kerpad"
+// phases of kerpad, plus the one measured here
+#define MAX_PHASES (STARTUP_MAX_PHASES+2)
+#define SPAWN_PHASE "spawn-to-ready"
+#define MAX_ARGS 64
+#define LINE_SIZE 256
+
+static struct option long_options[] = {
+	{"runs", required_argument, NULL, 'n'},
+	{"kerpad", required_argument, NULL, 'k'},
+	{"drop-caches", no_argument, NULL, 'c'},
+	{"help", no_argument, NULL, 'h'},
+	{0, 0, 0, 0},
+};
+
+struct phase {
+	char name[64];
+	// durations of each run in milliseconds
+	double *durations;
+	int count;
+};
+
+struct bench {
+	int n_runs;
+	struct phase phases[MAX_PHASES];
+	int n_phases;
+};
+
+static void print_help(char *argv[]) {
+	printf("Usage: %s [options] [-- kerpad options]\n", argv[0]);
+	printf("Time the phases of repeated cold starts of kerpad.\n\n");
+	printf("    -n, --runs=N          number of starts (default: %d)\n", DEFAULT_RUNS);
+	printf("    -k, --kerpad=PATH     kerpad executable (default: %s)\n", DEFAULT_KERPAD);
+	printf("    -c, --drop-caches     drop the page cache before each start,\n");
+	printf("                          needs root privileges\n");
+	printf("    -h, --help            display this help and exit\n");
+}
+
+static double now_ms() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1e3+now.tv_nsec/1e6;
+}
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y)-(x < y);
+}
+
+/**
+ * Record the duration of a phase for the current run
+ */
+static void add_duration(struct bench *bench, const char *name, double duration) {
+	struct phase *phase = NULL;
+	for (int i = 0; i < bench->n_phases; ++i) {
+		if (!strcmp(bench->phases[i].name, name)) phase = bench->phases+i;
+	}
+	if (!phase) {
+		if (bench->n_phases == MAX_PHASES) return;
+		phase = bench->phases+bench->n_phases++;
+		snprintf(phase->name, sizeof(phase->name), "%s", name);
+		phase->durations = malloc(bench->n_runs*sizeof(double));
+		exitif(phase->durations == NULL, "cannot allocate the durations");
+		phase->count = 0;
+	}
+	if (phase->count < bench->n_runs) phase->durations[phase->count++] = duration;
+}
+
+/**
+ * Let the next start find nothing in the page cache
+ */
+static void drop_caches() {
+	sync();
+	int fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	errno = 0;
+	exitif(fd == -1 || write(fd, "3", 1) != 1, "cannot drop the page cache");
+	close(fd);
+}
+
+/**
+ * Start kerpad, read its startup report and stop it
+ *
+ * Return 0 on success and -1 if kerpad
+ * stopped before being ready
+ */
+static int run(struct bench *bench, char *args[]) {
+	int fds[2];
+	exitif(pipe(fds) == -1, "cannot create a pipe");
+	double start = now_ms();
+	pid_t pid = fork();
+	exitif(pid == -1, "cannot fork");
+	if (pid == 0) {
+		close(fds[0]);
+		dup2(fds[1], STDERR_FILENO);
+		int null = open("/dev/null", O_WRONLY);
+		if (null != -1) dup2(null, STDOUT_FILENO);
+		execv(args[0], args);
+		exitif(true, "cannot execute %s", args[0]);
+	}
+	close(fds[1]);
+	
+	FILE *report = fdopen(fds[0], "r");
+	exitif(report == NULL, "cannot read the output of kerpad");
+	char line[LINE_SIZE];
+	// last line that is not part of the report,
+	// to show why kerpad stopped
+	char message[LINE_SIZE] = "";
+	bool ready = false;
+	while (fgets(line, sizeof(line), report)) {
+		char name[64];
+		double duration;
+		if (ready || strncmp(line, STARTUP_PREFIX, strlen(STARTUP_PREFIX))
+			|| sscanf(line+strlen(STARTUP_PREFIX), "%63s %lf", name, &duration) != 2) {
+			if (!ready) snprintf(message, strcspn(line, "\n")+1, "%s", line);
+			continue;
+		}
+		add_duration(bench, name, duration);
+		if (!strcmp(name, STARTUP_READY)) {
+			add_duration(bench, SPAWN_PHASE, now_ms()-start);
+			ready = true;
+			kill(pid, SIGTERM);
+		}
+	}
+	fclose(report);
+	waitpid(pid, NULL, 0);
+	
+	if (!ready) {
+		error_message("kerpad stopped before being ready%s%s",
+					  *message? ": ": "", message);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Print the distribution of the durations of each phase
+ */
+static void print_phases(struct bench *bench) {
+	printf("%-16s %9s %9s %9s %9s %9s\n", "phase (ms)", "min", "p50", "p90", "max", "mean");
+	for (int i = 0; i < bench->n_phases; ++i) {
+		struct phase *phase = bench->phases+i;
+		int n = phase->count;
+		double *d = phase->durations;
+		qsort(d, n, sizeof(double), compare_double);
+		double sum = 0;
+		for (int j = 0; j < n; ++j) sum += d[j];
+		printf("%-16s %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+			   phase->name, d[0], d[n/2], d[n*9/10], d[n-1], sum/n);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	struct bench bench = {
+		.n_runs = DEFAULT_RUNS,
+		.n_phases = 0,
+	};
+	char *kerpad = DEFAULT_KERPAD;
+	bool cold = false;
+	
+	while (1) {
+		int opt = getopt_long(argc, argv, "n:k:ch", long_options, NULL);
+		if (opt == -1) break;
+		
+		switch (opt) {
+		case 'n': bench.n_runs = atoi(optarg); break;
+		case 'k': kerpad = optarg; break;
+		case 'c': cold = true; break;
+		case 'h':
+			print_help(argv);
+			return EXIT_SUCCESS;
+		default:
+			print_help(argv);
+			return EXIT_FAILURE;
+		}
+	}
+	if (bench.n_runs <= 0 || argc-optind > MAX_ARGS-3) {
+		error_message("invalid options");
+		return EXIT_FAILURE;
+	}
+	
+	char *args[MAX_ARGS];
+	int n_args = 0;
+	args[n_args++] = kerpad;
+	for (int i = optind; i < argc; ++i) args[n_args++] = argv[i];
+	args[n_args++] = "--startup-report";
+	args[n_args] = NULL;
+	
+	printf("%d starts of", bench.n_runs);
+	for (int i = 0; i < n_args; ++i) printf(" %s", args[i]);
+	printf("%s\n", cold? ", page cache dropped": "");
+	for (int i = 0; i < bench.n_runs; ++i) {
+		if (cold) drop_caches();
+		if (run(&bench, args) == -1) return EXIT_FAILURE;
+	}
+	print_phases(&bench);
+	
+	for (int i = 0; i < bench.n_phases; ++i) free(bench.phases[i].durations);
+	return EXIT_SUCCESS;
+}
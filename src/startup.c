@@ -0,0 +1,64 @@
+/*
+ * This file is responsible for timing the phases
+ * of the startup of kerpad, from the parsing of
+ * the options to the creation of the threads
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "startup.h"
+
+struct phase {
+	const char *name;
+	// in nanoseconds
+	long duration;
+};
+
+static struct {
+	struct phase phases[STARTUP_MAX_PHASES];
+	int n_phases;
+	long start;
+	long last;
+	bool started;
+} startup;
+
+/**
+ * Return the monotonic time in nanoseconds
+ */
+static long now_ns() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000L+now.tv_nsec;
+}
+
+void startup_init() {
+	startup.n_phases = 0;
+	startup.start = now_ns();
+	startup.last = startup.start;
+	startup.started = true;
+}
+
+void startup_mark(const char *name) {
+	if (!startup.started) return;
+	long now = now_ns();
+	if (startup.n_phases < STARTUP_MAX_PHASES) {
+		startup.phases[startup.n_phases++] = (struct phase) {
+			.name = name,
+			.duration = now-startup.last,
+		};
+	}
+	startup.last = now;
+}
+
+void startup_report() {
+	if (!startup.started) return;
+	startup.started = false;
+	long total = now_ns()-startup.start;
+	for (int i = 0; i < startup.n_phases; ++i) {
+		fprintf(stderr, STARTUP_PREFIX"%s %.3f ms\n",
+				startup.phases[i].name, startup.phases[i].duration/1e6);
+	}
+	fprintf(stderr, STARTUP_PREFIX STARTUP_READY" %.3f ms\n", total/1e6);
+}
@@ -0,0 +1,38 @@
+#ifndef __STARTUP_H__
+#define __STARTUP_H__
+
+// max number of phases in the report
+#define STARTUP_MAX_PHASES 16
+
+// prefix of the lines of the report,
+// followed by a phase and its duration in ms
+#define STARTUP_PREFIX "startup: "
+// phase giving the total time, ending the report
+#define STARTUP_READY "ready"
+
+/**
+ * Start timing the startup phases,
+ * the first phase begins now
+ *
+ * Without this call, startup_mark
+ * and startup_report do nothing
+ */
+void startup_init();
+
+/**
+ * End the current phase, the next one begins now
+ *
+ * Should be called by the thread that called startup_init
+ * name: string literal naming the ended phase
+ */
+void startup_mark(const char *name);
+
+/**
+ * Print the duration of each phase, then the time
+ * since startup_init as STARTUP_READY, on the standard error
+ *
+ * This is done once, the next calls do nothing
+ */
+void startup_report();
+
+#endif // !__STARTUP_H__
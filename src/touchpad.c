@@ -12,36 +12,39 @@
 #include <linux/input-event-codes.h>
 #include <sys/ioctl.h>
 #include <pthread.h>
-#include <sys/time.h>
+#include <time.h>
 #include <stdint.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <stdatomic.h>
 
 #include "touchpad.h"
 #include "util.h"
+#include "clock.h"
+#include "logger.h"
+#include "tracer.h"
+#include "recorder.h"
+#include "startup.h"
+#include "uring.h"
+#include "core.h"
 
 #define EVENT_DIR "/dev/input/"
 #define EVENT_FILE_PREFIX "event"
 
-#define EVENT_TIME_MILLI(event) ((event).input_event_sec*1000L \
-								 +(event).input_event_usec/1000)
-
 #define TOUCH_CODE BTN_TOUCH
 #define PRESS_CODE BTN_MOUSE
 
-// delay max between to touch
-// to be a double tap
-#define DOUBLE_TAP_TIME 250
-
-struct occured_events {
-	// values are ignored if < 0
-	int x;
-	int y;
-	int touched;
-	int pressed;
-	unsigned long touch_time;
-};
+// max number of events read at once
+#define EVENT_BATCH_SIZE 64
+
+// max number of candidate devices
+// remembered while scanning EVENT_DIR
+#define MAX_SCANNED_DEVICES 64
+
+// time between two checks of the grab watchdog, in milliseconds
+#define GRAB_CHECK_INTERVAL 100
 
 struct touchpad_resemblance {
 	char name[255];
@@ -49,25 +52,110 @@ struct touchpad_resemblance {
 };
 typedef struct touchpad_resemblance touchpad_resemblance_t;
 
-struct touchpad {
+struct scanned_device {
+	char path[255];
+	touchpad_resemblance_t tr;
+	int mark;
+	// true if a touchpad_device already uses it
+	bool used;
+};
+
+struct touchpad_device {
 	touchpad_settings_t settings;
 	
 	touchpad_resemblance_t tr;
 	int fd;
+	// true if the time of the events is
+	// given with CLOCK_MONOTONIC, as the clock
+	bool monotonic;
 	
-	pthread_mutex_t mutex;
-	pthread_cond_t cond_touch;
-	pthread_cond_t cond_press;
-	pthread_cond_t cond_touch_or_press;
-	pthread_cond_t cond_edge_touch;
+	// edge logic of the device
+	struct core_touchpad core;
+	struct core_limits limits;
+	// core_touchpad_apply specialized for the limits
+	core_apply_fn apply;
 	
-	unsigned long last_touch_time;
-	struct occured_events occured;
+	// true while the device is grabbed,
+	// set to false by the watchdog
+	atomic_bool grabbed;
 	
+	// copy of the core state given by touchpad_get_info
 	touchpad_info_t info;
+};
+typedef struct touchpad_device touchpad_device_t;
+
+// an event that threads can wait for
+struct notification {
+	// incremented each time the event occurs
+	atomic_int seq;
+	// number of threads waiting for the event,
+	// the event is only notified to the kernel if positive
+	atomic_int waiters;
+};
+
+// frame of the history, each field is atomic
+// so it can be read while it is written
+struct history_slot {
+	// number of the frame plus one,
+	// 0 while the slot is written
+	atomic_ulong seq;
+	atomic_int device;
+	atomic_long time;
+	atomic_int x;
+	atomic_int y;
+	atomic_int edgex;
+	atomic_int edgey;
+	atomic_int flags;
+};
+
+#define SAMPLE_TOUCHED      1
+#define SAMPLE_EDGE_TOUCHED 2
+#define SAMPLE_PRESSED      4
+
+struct touchpad {
+	touchpad_device_t devices[MAX_TOUCHPADS];
+	int n_devices;
+	// used to wait for events of any device
+	struct pollfd fds[MAX_TOUCHPADS];
+	
+	// with IO_URING, a read is always queued for each
+	// device, NULL with IO_BLOCKING
+	uring_t *uring;
+	// registered buffers of the queued reads
+	struct input_event buffers[MAX_TOUCHPADS][EVENT_BATCH_SIZE];
+	// true if the buffers are registered
+	bool fixed_buffers;
+	
+	// index of the device whose
+	// informations are given by touchpad_get_info
+	int current;
+	
+	pthread_mutex_t mutex;
+	struct notification notifications[TOUCHPAD_N_EVENTS];
+	
+	// last applied frames of all devices, only written
+	// by the listening thread, read without lock
+	struct history_slot history[TOUCHPAD_HISTORY_SIZE];
+	// number of frames written in the history
+	atomic_ulong history_head;
+	// frames counted by latency, only
+	// written by the listening thread
+	atomic_ulong latency[TOUCHPAD_LATENCY_BUCKETS];
+	
+	// used to wait and to resync the time
+	kclock_t *clock;
+	
+	// movements and buttons of the grabbed devices,
+	// only used by the listening thread
+	touchpad_pointer_t pointer;
+	// number of reads handled by the listening thread
+	atomic_ulong handled;
+	// releases the grabs if the events are not read
+	pthread_t watchdog;
+	bool has_watchdog;
 	
 	// this module should not be used if this is true
-	bool stopped;
+	atomic_bool stopped;
 };
 
 #define GET_BIT(var, bit) ((var)&(1<<(bit)))
@@ -139,29 +227,21 @@ static void print_touchpad_resemblance(touchpad_resemblance_t *tr,
 }
 
 /**
- * Return a file descriptor describing the touchpad
- *
- * Store in found_tr the touchpad resemblance of the found device
- *
- * If device_name is not null, it will search for the best device
- * with this name. Otherwise it will try to found the device
- * that look the most like a touchpad.
+ * Scan EVENT_DIR and store in scanned the devices
+ * that look like a touchpad or are named like one
+ * of the count wanted devices
  * 
  * list can be LIST_NO, LIST_CANDIDATES or LIST_ALL
  *
- * Return the file descriptor on success, and -1 if no such device
- * are found
+ * Return the number of stored devices
  */
-static int get_touchpad(touchpad_resemblance_t *found_tr, char *device_name, int list) {
+static int scan_devices(struct scanned_device *scanned,
+						touchpad_settings_t *settings, int count, int list) {
 	DIR *dir = opendir(EVENT_DIR);
 	exitif(dir == NULL, "cannot open %s directory", EVENT_DIR);
 	struct dirent *de;
 	int prefix_len = strlen(EVENT_FILE_PREFIX);
-	int fd = -1;
-	
-	char best_path[255] = {};
-	touchpad_resemblance_t best_tr = {};
-	int best_mark = 0;
+	int n_scanned = 0;
 	
 	while ((de = readdir(dir))) {
 		exitif(errno != 0, "cannot read from %s directory", EVENT_DIR);
@@ -171,7 +251,7 @@ static int get_touchpad(touchpad_resemblance_t *found_tr, char *device_name, int
 		strcpy(path, EVENT_DIR);
 		strcat(path, de->d_name);
 		
-		fd = open(path, O_RDONLY);
+		int fd = open(path, O_RDONLY);
 		exitif(fd == -1, "cannot open %s", path);
 		
 		touchpad_resemblance_t tr = {};
@@ -182,285 +262,852 @@ static int get_touchpad(touchpad_resemblance_t *found_tr, char *device_name, int
 			print_touchpad_resemblance(&tr, path);
 		}
 		
-		bool names_equal = device_name && !strcmp(device_name, tr.name);
-		// To select a device with the correct name even if it is not a touchpad
-		if (names_equal) ++mark;
-		if ((!device_name || names_equal) && best_mark < mark) {
-			strcpy(best_path, path);
-			best_tr = tr;
-			best_mark = mark;
+		bool wanted = mark;
+		for (int i = 0; i < count; ++i) {
+			if (settings[i].device_name && !strcmp(settings[i].device_name, tr.name))
+				wanted = true;
+		}
+		if (wanted && n_scanned < MAX_SCANNED_DEVICES) {
+			struct scanned_device *sd = scanned+n_scanned++;
+			strcpy(sd->path, path);
+			sd->tr = tr;
+			sd->mark = mark;
+			sd->used = false;
 		}
 		
 		exitif(close(fd) == -1, "cannot close %s", path);
-		fd = -1;
 	}
 	exitif(closedir(dir) == -1, "cannot close %s directory", EVENT_DIR);
-	
-	if (best_mark == 0) {
-		if (!device_name) fprintf(stderr, "No touchpad found\n");
-		else fprintf(stderr, "No device named %s found\n", device_name);
-		return -1;
+	return n_scanned;
+}
+
+/**
+ * Return the best unused scanned device for the given name
+ *
+ * If device_name is not null, it will search for the best device
+ * with this name. Otherwise it will try to found the device
+ * that look the most like a touchpad.
+ *
+ * Return NULL if no such device are found
+ */
+static struct scanned_device *best_device(struct scanned_device *scanned,
+										  int n_scanned, char *device_name) {
+	struct scanned_device *best = NULL;
+	int best_mark = 0;
+	for (int i = 0; i < n_scanned; ++i) {
+		if (scanned[i].used) continue;
+		int mark = scanned[i].mark;
+		bool names_equal = device_name && !strcmp(device_name, scanned[i].tr.name);
+		// To select a device with the correct name even if it is not a touchpad
+		if (names_equal) ++mark;
+		if ((!device_name || names_equal) && best_mark < mark) {
+			best = scanned+i;
+			best_mark = mark;
+		}
 	}
+	return best;
+}
+
+/**
+ * Print the found device and check that
+ * it can be used as a touchpad
+ *
+ * named: true if the device was asked by its name
+ * quiet: if true, unusable devices are silently rejected
+ *
+ * Return true if the device can be used
+ */
+static bool check_device(struct scanned_device *sd, bool named, bool quiet) {
+	touchpad_resemblance_t *tr = &sd->tr;
+	if (quiet && !(TR_HAS_ABS(*tr) && TR_HAS_XY(*tr) && TR_HAS_KEY(*tr)))
+		return false;
 	
 	bool device_ok = true;
-	printf("Found device: %s\n", best_tr.name);
-	printf("on %s\n", best_path);
-	if (!TR_HAS_NAME_IN_TOUCHPAD(best_tr) && !device_name) {
+	printf("Found device: %s\n", tr->name);
+	printf("on %s\n", sd->path);
+	if (quiet) return true;
+	
+	if (!TR_HAS_NAME_IN_TOUCHPAD(*tr) && !named) {
 		fprintf(stderr, "Warning: found device don't have \"Touchpad\" in it's name\n");
 	}
-	if (!TR_HAS_ABS(best_tr)) {
+	if (!TR_HAS_ABS(*tr)) {
 		fprintf(stderr, "Error: found device don't support absolute values events\n");
 		device_ok = false;
 	}
-	if (!TR_HAS_XY(best_tr)) {
+	if (!TR_HAS_XY(*tr)) {
 		fprintf(stderr, "Error: found device don't support asbolute x/y events\n");
-		if (TR_HAS_MT(best_tr))
+		if (TR_HAS_MT(*tr))
 			fprintf(stderr, "This program does not support multi-touch protocol yet\n");
 		device_ok = false;
 	}
-	if (!TR_HAS_KEY(best_tr)) {
+	if (!TR_HAS_KEY(*tr)) {
 		fprintf(stderr, "Error: found device don't support key events. "
 				"Key events are used to detect when the touchpad "
 				"is touched or pressed\n");
 		device_ok = false;
 	}
-	if (!TR_HAS_TOUCH(best_tr)) {
+	if (!TR_HAS_TOUCH(*tr)) {
 		fprintf(stderr, "Error: found device don't support touch events\n");
 		//device_ok = false;
 	}
-	if (!TR_HAS_PRESS(best_tr)) {
+	if (!TR_HAS_PRESS(*tr)) {
 		fprintf(stderr, "Warning: found device don't support press events\n");
 	}
+	return device_ok;
+}
+
+/**
+ * Add a device to the touchpad
+ */
+static void add_device(touchpad_t *touchpad, struct scanned_device *sd,
+					   touchpad_settings_t *settings) {
+	touchpad_device_t *device = touchpad->devices+touchpad->n_devices;
+	device->fd = open(sd->path, O_RDONLY);
+	exitif(device->fd == -1, "cannot open %s", sd->path);
+	// so event times can be compared with the clock
+	int clock_id = CLOCK_MONOTONIC;
+	errno = 0;
+	device->monotonic = !msgif(ioctl(device->fd, EVIOCSCLOCKID, &clock_id) == -1,
+							   "warning: cannot use the monotonic clock for %s events",
+							   sd->tr.name);
+	device->tr = sd->tr;
+	device->settings = *settings;
+	atomic_init(&device->grabbed, false);
+	core_touchpad_init(&device->core);
+	device->info = (touchpad_info_t) {
+		.device = touchpad->n_devices,
+	};
+	touchpad->fds[touchpad->n_devices] = (struct pollfd) {
+		.fd = device->fd,
+		.events = POLLIN,
+	};
+	sd->used = true;
+	++touchpad->n_devices;
+}
+
+/**
+ * Find the devices described by the count settings
+ * and add them to the touchpad
+ * 
+ * Return the number of added devices,
+ * or -1 if a wanted device is not found or cannot be used
+ */
+static int get_touchpads(touchpad_t *touchpad, touchpad_settings_t *settings, int count) {
+	struct scanned_device scanned[MAX_SCANNED_DEVICES];
+	int n_scanned = scan_devices(scanned, settings, count, settings[0].list);
 	
-	fd = open(best_path, O_RDONLY);
-	*found_tr = best_tr;
-	exitif(fd == -1, "cannot open %s", best_path);
-	return (device_ok? fd: -1);
+	// named devices are chosen first, so they
+	// cannot be taken by an unnamed setting
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int i = 0; i < count; ++i) {
+			touchpad_settings_t *ts = settings+i;
+			if ((pass == 0) != (ts->device_name != NULL)) continue;
+			
+			if (ts->all) {
+				struct scanned_device *sd;
+				while (touchpad->n_devices < MAX_TOUCHPADS
+					   && (sd = best_device(scanned, n_scanned, NULL))) {
+					if (check_device(sd, false, true)) add_device(touchpad, sd, ts);
+					else sd->used = true;
+				}
+				continue;
+			}
+			
+			struct scanned_device *sd = best_device(scanned, n_scanned, ts->device_name);
+			if (!sd) {
+				if (!ts->device_name) fprintf(stderr, "No touchpad found\n");
+				else fprintf(stderr, "No device named %s found\n", ts->device_name);
+				return -1;
+			}
+			if (!check_device(sd, ts->device_name != NULL, false)) return -1;
+			add_device(touchpad, sd, ts);
+		}
+	}
+	
+	if (touchpad->n_devices == 0) {
+		fprintf(stderr, "No touchpad found\n");
+		return -1;
+	}
+	return touchpad->n_devices;
 }
 
-static void reset_occured_events(struct occured_events *evt) {
-	evt->x = -1;
-	evt->y = -1;
-	evt->touched = -1;
-	evt->pressed = -1;
+static void init_edge_limits(touchpad_device_t *device,
+							 struct input_absinfo *xlimits, struct input_absinfo *ylimits) {
+	touchpad_settings_t *ts = &device->settings;
+	if (ts->edge_thickness < 0) ts->edge_thickness = DEFAULT_EDGE_THICKNESS;
+	if (ts->minx < 0) ts->minx = xlimits->minimum+ts->edge_thickness;
+	if (ts->maxx < 0) ts->maxx = xlimits->maximum-ts->edge_thickness;
+	if (ts->miny < 0) ts->miny = ylimits->minimum+ts->edge_thickness;
+	if (ts->maxy < 0) ts->maxy = ylimits->maximum-ts->edge_thickness;
+	device->limits = (struct core_limits) {
+		.minx = ts->minx,
+		.maxx = ts->maxx,
+		.miny = ts->miny,
+		.maxy = ts->maxy,
+		.no_edge_protection = ts->no_edge_protection,
+	};
+	device->apply = core_select_apply(&device->limits);
 }
 
-static void init_edge_limits(touchpad_t *touchpad) {
+static void init_device_edge_limits(touchpad_device_t *device) {
 	struct input_absinfo xlimits = {};
-	exitif(ioctl(touchpad->fd, EVIOCGABS(ABS_X), &xlimits) == -1, "ioctl get x limits");
+	exitif(ioctl(device->fd, EVIOCGABS(ABS_X), &xlimits) == -1, "ioctl get x limits");
 	struct input_absinfo ylimits = {};
-	exitif(ioctl(touchpad->fd, EVIOCGABS(ABS_Y), &ylimits) == -1, "ioctl get y limits");
-	
-	touchpad_settings_t *ts = &touchpad->settings;
-	if (ts->edge_thickness < 0) ts->edge_thickness = DEFAULT_EDGE_THICKNESS;
-	if (ts->minx < 0) ts->minx = xlimits.minimum+ts->edge_thickness;
-	if (ts->maxx < 0) ts->maxx = xlimits.maximum-ts->edge_thickness;
-	if (ts->miny < 0) ts->miny = ylimits.minimum+ts->edge_thickness;
-	if (ts->maxy < 0) ts->maxy = ylimits.maximum-ts->edge_thickness;
+	exitif(ioctl(device->fd, EVIOCGABS(ABS_Y), &ylimits) == -1, "ioctl get y limits");
+	init_edge_limits(device, &xlimits, &ylimits);
 }
 
-touchpad_t *touchpad_init(touchpad_settings_t *settings) {
-	touchpad_resemblance_t tr = {};
-	int fd = get_touchpad(&tr, settings->device_name, settings->list);
-	if (fd < 0) return NULL;
-	
-	touchpad_t *touchpad = malloc(sizeof(*touchpad));
-	touchpad->tr = tr;
-	touchpad->fd = fd;
-	touchpad->settings = *settings;
+/**
+ * Init the synchronisation of the touchpad
+ */
+static void init_sync(touchpad_t *touchpad, kclock_t *clock) {
 	pthread_mutex_init(&touchpad->mutex, NULL);
-	pthread_cond_init(&touchpad->cond_touch, NULL);
-	pthread_cond_init(&touchpad->cond_press, NULL);
-	pthread_cond_init(&touchpad->cond_touch_or_press, NULL);
-	pthread_cond_init(&touchpad->cond_edge_touch, NULL);
-	reset_occured_events(&touchpad->occured);
-	init_edge_limits(touchpad);
-	touchpad->stopped = false;
-	return touchpad;
+	for (int i = 0; i < TOUCHPAD_N_EVENTS; ++i) {
+		atomic_init(&touchpad->notifications[i].seq, 0);
+		atomic_init(&touchpad->notifications[i].waiters, 0);
+	}
+	for (int i = 0; i < TOUCHPAD_HISTORY_SIZE; ++i) {
+		atomic_init(&touchpad->history[i].seq, 0);
+	}
+	atomic_init(&touchpad->history_head, 0);
+	for (int i = 0; i < TOUCHPAD_LATENCY_BUCKETS; ++i) {
+		atomic_init(&touchpad->latency[i], 0);
+	}
+	touchpad->clock = clock;
+	touchpad->pointer = (touchpad_pointer_t) {};
+	atomic_init(&touchpad->handled, 0);
+	touchpad->has_watchdog = false;
+	atomic_init(&touchpad->stopped, false);
 }
 
 /**
- * Return false if the touchpad coordinates are
- * beyond the borders defined in the settings
+ * Return true if events are waiting to be handled
+ *
+ * grabbed: if true, only the grabbed devices are checked
  */
-static int dont_touch_borders(touchpad_t *touchpad) {
-	int x = touchpad->info.x;
-	int y = touchpad->info.y;
-	return x >= touchpad->settings.minx
-		&& x <= touchpad->settings.maxx
-		&& y >= touchpad->settings.miny
-		&& y <= touchpad->settings.maxy;
-}
-
-static void applie_occured_events(touchpad_t *touchpad) {
-	bool touch_detected = false;
-	bool double_tap_detected = false;
-	bool edge_touch_detected = false;
-	bool press_detected = false;
-	
-	struct occured_events *evt = &touchpad->occured;
-	pthread_mutex_lock(&touchpad->mutex);
-	if (evt->x >= 0) {
-		touchpad->info.x = evt->x;
-		if (evt->x <= touchpad->settings.minx)
-			touchpad->info.edgex = -1;
-		else if (evt->x >= touchpad->settings.maxx)
-			touchpad->info.edgex = 1;
-		else touchpad->info.edgex = 0;
-	}
-	if (evt->y >= 0) {
-		touchpad->info.y = evt->y;
-		if (evt->y <= touchpad->settings.miny)
-			touchpad->info.edgey = -1;
-		else if (evt->y >= touchpad->settings.maxy)
-			touchpad->info.edgey = 1;
-		else touchpad->info.edgey = 0;
-	}
-	
-	if (evt->touched == 0) {
-		touchpad->info.touched = false;
-		touchpad->info.double_tapped = false;
-		touchpad->info.edge_touched = false;
-	} else if (evt->touched > 0) {
-		if (dont_touch_borders(touchpad)
-			|| touchpad->settings.no_edge_protection) {
-			touchpad->info.touched = true;
-			touch_detected = true;
-			if (evt->touch_time-touchpad->last_touch_time < DOUBLE_TAP_TIME) {
-				// double tap detected
-				touchpad->info.double_tapped = 1;
-				double_tap_detected = true;
-			}
-			touchpad->last_touch_time = evt->touch_time;
+static bool events_pending(touchpad_t *touchpad, bool grabbed) {
+	if (touchpad->uring) return uring_has_completions(touchpad->uring);
+	
+	struct pollfd fds[MAX_TOUCHPADS];
+	int n = 0;
+	for (int i = 0; i < touchpad->n_devices; ++i) {
+		// simulated
+		if (touchpad->devices[i].fd == -1) continue;
+		if (grabbed && !atomic_load(&touchpad->devices[i].grabbed)) continue;
+		fds[n++] = (struct pollfd) {
+			.fd = touchpad->devices[i].fd,
+			.events = POLLIN,
+		};
+	}
+	return n && poll(fds, n, 0) > 0;
+}
+
+/**
+ * Release the grabbed devices
+ */
+static void release_grabs(touchpad_t *touchpad) {
+	for (int i = 0; i < touchpad->n_devices; ++i) {
+		touchpad_device_t *device = touchpad->devices+i;
+		if (!atomic_exchange(&device->grabbed, false)) continue;
+		errno = 0;
+		msgif(ioctl(device->fd, EVIOCGRAB, 0) == -1, "cannot release %s", device->tr.name);
+	}
+}
+
+/**
+ * Thread responsible for releasing the grabbed
+ * devices if their events are not read anymore
+ *
+ * The listening thread stalls if events are pending
+ * and no read was handled since the previous check
+ */
+static void *grab_watchdog_thread(void *arg) {
+	touchpad_t *touchpad = arg;
+	unsigned long last_handled = atomic_load(&touchpad->handled);
+	int stalled_time = 0;
+	while (!atomic_load(&touchpad->stopped)) {
+		struct timespec ts = {
+			.tv_sec = 0,
+			.tv_nsec = GRAB_CHECK_INTERVAL*1000000L,
+		};
+		nanosleep(&ts, NULL);
+		
+		unsigned long handled = atomic_load(&touchpad->handled);
+		if (handled != last_handled || !events_pending(touchpad, true)) {
+			last_handled = handled;
+			stalled_time = 0;
+			continue;
 		}
-		if (!dont_touch_borders(touchpad)) {
-			touchpad->info.edge_touched = true;
-			edge_touch_detected = true;
+		stalled_time += GRAB_CHECK_INTERVAL;
+		if (stalled_time >= TOUCHPAD_GRAB_TIMEOUT) {
+			error_message("warning: the touchpad events were not read for %d ms, "
+						  "releasing the grabbed touchpads", stalled_time);
+			release_grabs(touchpad);
+			break;
 		}
 	}
+	return NULL;
+}
+
+/**
+ * Grab the devices whose settings ask for it,
+ * and start the watchdog
+ */
+static void init_grabs(touchpad_t *touchpad) {
+	bool grabbed = false;
+	for (int i = 0; i < touchpad->n_devices; ++i) {
+		touchpad_device_t *device = touchpad->devices+i;
+		if (!device->settings.grab) continue;
+		errno = 0;
+		if (msgif(ioctl(device->fd, EVIOCGRAB, 1) == -1,
+				  "warning: cannot grab %s, its pointer is left "
+				  "to the other programs", device->tr.name)) continue;
+		atomic_store(&device->grabbed, true);
+		grabbed = true;
+	}
+	if (!grabbed) return;
+	exitif(pthread_create(&touchpad->watchdog, NULL, grab_watchdog_thread, touchpad) != 0,
+		   "cannot create the grab watchdog thread");
+	touchpad->has_watchdog = true;
+}
+
+/**
+ * Queue a read of the events of a device in the io_uring
+ */
+static void queue_read(touchpad_t *touchpad, int device) {
+	uring_read(touchpad->uring, device, touchpad->buffers[device],
+			   sizeof(touchpad->buffers[device]),
+			   touchpad->fixed_buffers? device: -1, device);
+}
+
+/**
+ * Init the io_uring used to read the devices,
+ * keep the blocking reads if io_uring is not supported
+ */
+static void init_uring(touchpad_t *touchpad) {
+	int fds[MAX_TOUCHPADS];
+	struct iovec buffers[MAX_TOUCHPADS];
+	for (int i = 0; i < touchpad->n_devices; ++i) {
+		fds[i] = touchpad->devices[i].fd;
+		buffers[i] = (struct iovec) {
+			.iov_base = touchpad->buffers[i],
+			.iov_len = sizeof(touchpad->buffers[i]),
+		};
+	}
 	
-	if (evt->pressed == 0) {
-		touchpad->info.pressed = false;
-	} else if (evt->pressed > 0) {
-		if (dont_touch_borders(touchpad)
-			|| touchpad->settings.no_edge_protection) {
-			touchpad->info.pressed = true;
-			press_detected = true;
-		}
+	touchpad->uring = uring_init(2*MAX_TOUCHPADS);
+	if (touchpad->uring == NULL
+		|| uring_register_files(touchpad->uring, fds, touchpad->n_devices) == -1) {
+		msgif(true, "warning: cannot use io_uring to read the touchpad, "
+			  "falling back to blocking reads");
+		if (touchpad->uring) uring_clean(touchpad->uring);
+		touchpad->uring = NULL;
+		return;
 	}
+	// registered buffers are not required, they only
+	// save the mapping of the buffer at each read
+	touchpad->fixed_buffers = uring_register_buffers(
+		touchpad->uring, buffers, touchpad->n_devices) == 0;
+	for (int i = 0; i < touchpad->n_devices; ++i) queue_read(touchpad, i);
+}
+
+touchpad_t *touchpad_init(touchpad_settings_t *settings, int count, int io,
+						  kclock_t *clock) {
+	touchpad_t *touchpad = malloc(sizeof(*touchpad));
+	touchpad->n_devices = 0;
+	touchpad->current = 0;
+	touchpad->uring = NULL;
+	touchpad->fixed_buffers = false;
+	if (get_touchpads(touchpad, settings, count) < 0) {
+		for (int i = 0; i < touchpad->n_devices; ++i)
+			close(touchpad->devices[i].fd);
+		free(touchpad);
+		return NULL;
+	}
+	startup_mark("scan");
+	
+	for (int i = 0; i < touchpad->n_devices; ++i) {
+		touchpad_device_t *device = touchpad->devices+i;
+		init_device_edge_limits(device);
+	}
+	startup_mark("edge-limits");
+	if (io == IO_URING && settings[0].list == LIST_NO) {
+		errno = 0;
+		init_uring(touchpad);
+	}
+	init_sync(touchpad, clock);
+	if (settings[0].list == LIST_NO) init_grabs(touchpad);
+	startup_mark("devices");
+	return touchpad;
+}
+
+touchpad_t *touchpad_init_simulated(touchpad_settings_t *settings,
+									struct input_absinfo *xlimits,
+									struct input_absinfo *ylimits,
+									kclock_t *clock) {
+	touchpad_t *touchpad = malloc(sizeof(*touchpad));
+	touchpad->n_devices = 1;
+	touchpad->current = 0;
+	touchpad->uring = NULL;
+	touchpad->fixed_buffers = false;
+	
+	touchpad_device_t *device = touchpad->devices;
+	*device = (touchpad_device_t) {
+		.settings = *settings,
+		.fd = -1,
+	};
+	strcpy(device->tr.name, "Simulated Touchpad");
+	// there is nothing to grab, but the
+	// pointer is given as for a grabbed device
+	atomic_init(&device->grabbed, settings->grab);
+	core_touchpad_init(&device->core);
+	init_edge_limits(device, xlimits, ylimits);
+	init_sync(touchpad, clock);
+	return touchpad;
+}
+
+touchpad_t *touchpad_init_fd(touchpad_settings_t *settings, int fd,
+							 struct input_absinfo *xlimits,
+							 struct input_absinfo *ylimits,
+							 int io, kclock_t *clock) {
+	touchpad_t *touchpad = touchpad_init_simulated(settings, xlimits, ylimits, clock);
+	touchpad_device_t *device = touchpad->devices;
+	strcpy(device->tr.name, "Replayed Touchpad");
+	device->fd = fd;
+	device->monotonic = true;
+	touchpad->fds[0] = (struct pollfd) {
+		.fd = fd,
+		.events = POLLIN,
+	};
+	if (io == IO_URING) {
+		errno = 0;
+		init_uring(touchpad);
+	}
+	return touchpad;
+}
+
+/**
+ * Append the state of the device to the history
+ */
+static void append_history(touchpad_t *touchpad, touchpad_device_t *device) {
+	unsigned long head = atomic_load_explicit(&touchpad->history_head, memory_order_relaxed);
+	struct history_slot *slot = touchpad->history+head%TOUCHPAD_HISTORY_SIZE;
+	struct core_touchpad *core = &device->core;
+	
+	// readers check seq before and after the fields,
+	// like a sequence lock with a sequence per slot
+	atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&slot->device, device-touchpad->devices, memory_order_relaxed);
+	atomic_store_explicit(&slot->time, kclock_now(touchpad->clock), memory_order_relaxed);
+	atomic_store_explicit(&slot->x, core->x, memory_order_relaxed);
+	atomic_store_explicit(&slot->y, core->y, memory_order_relaxed);
+	atomic_store_explicit(&slot->edgex, core->edgex, memory_order_relaxed);
+	atomic_store_explicit(&slot->edgey, core->edgey, memory_order_relaxed);
+	atomic_store_explicit(&slot->flags, (core->touched? SAMPLE_TOUCHED: 0)
+						  |(core->edge_touched? SAMPLE_EDGE_TOUCHED: 0)
+						  |(core->pressed? SAMPLE_PRESSED: 0), memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, head+1, memory_order_release);
+	atomic_store_explicit(&touchpad->history_head, head+1, memory_order_release);
+}
+
+int touchpad_get_history(touchpad_t *touchpad, int device,
+						 struct core_sample *samples, int count) {
+	unsigned long head = atomic_load_explicit(&touchpad->history_head, memory_order_acquire);
+	unsigned long oldest = head > TOUCHPAD_HISTORY_SIZE? head-TOUCHPAD_HISTORY_SIZE: 0;
+	// the samples are read from the newest
+	// and written from the end of samples
+	int n = 0;
+	for (unsigned long frame = head; frame > oldest && n < count; --frame) {
+		struct history_slot *slot = touchpad->history+(frame-1)%TOUCHPAD_HISTORY_SIZE;
+		if (atomic_load_explicit(&slot->seq, memory_order_acquire) != frame) break;
+		int slot_device = atomic_load_explicit(&slot->device, memory_order_relaxed);
+		int flags = atomic_load_explicit(&slot->flags, memory_order_relaxed);
+		struct core_sample sample = {
+			.time = atomic_load_explicit(&slot->time, memory_order_relaxed),
+			.x = atomic_load_explicit(&slot->x, memory_order_relaxed),
+			.y = atomic_load_explicit(&slot->y, memory_order_relaxed),
+			.edgex = atomic_load_explicit(&slot->edgex, memory_order_relaxed),
+			.edgey = atomic_load_explicit(&slot->edgey, memory_order_relaxed),
+			.touched = flags&SAMPLE_TOUCHED,
+			.edge_touched = flags&SAMPLE_EDGE_TOUCHED,
+			.pressed = flags&SAMPLE_PRESSED,
+		};
+		atomic_thread_fence(memory_order_acquire);
+		// overwritten while it was read,
+		// so are the older ones
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != frame) break;
+		if (slot_device == device) samples[count-1-n++] = sample;
+	}
+	memmove(samples, samples+count-n, n*sizeof(*samples));
+	return n;
+}
+
+void touchpad_get_limits(touchpad_t *touchpad, int device, struct core_limits *limits) {
+	*limits = touchpad->devices[device].limits;
+}
+
+bool touchpad_stalled(touchpad_t *touchpad, unsigned long *handled) {
+	unsigned long current = atomic_load(&touchpad->handled);
+	bool stalled = current == *handled && events_pending(touchpad, false);
+	*handled = current;
+	return stalled;
+}
+
+void touchpad_get_latency(touchpad_t *touchpad, touchpad_latency_t *latency) {
+	for (int i = 0; i < TOUCHPAD_LATENCY_BUCKETS; ++i) {
+		latency->buckets[i] = atomic_load_explicit(&touchpad->latency[i],
+												   memory_order_relaxed);
+	}
+}
+
+static void applie_occured_events(touchpad_t *touchpad, touchpad_device_t *device) {
+	long begin = tracer_begin();
+	pthread_mutex_lock(&touchpad->mutex);
+	int detected = device->apply(&device->core, &device->limits);
+	struct core_touchpad *core = &device->core;
+	touchpad_info_t *info = &device->info;
+	info->x = core->x;
+	info->y = core->y;
+	info->edgex = core->edgex;
+	info->edgey = core->edgey;
+	info->touched = core->touched;
+	info->edge_touched = core->edge_touched;
+	info->pressed = core->pressed;
+	info->double_tapped = core->double_tapped;
+	
+	// the device that has just been touched or
+	// pressed becomes the one given by touchpad_get_info
+	if (detected&(CORE_TOUCH|CORE_EDGE_TOUCH|CORE_PRESS))
+		touchpad->current = device->info.device;
 	pthread_mutex_unlock(&touchpad->mutex);
+	append_history(touchpad, device);
+	recorder_state(info);
+	
+	if (atomic_load_explicit(&device->grabbed, memory_order_relaxed)) {
+		touchpad->pointer.dx += core->motion_x;
+		touchpad->pointer.dy += core->motion_y;
+	}
+	core->motion_x = 0;
+	core->motion_y = 0;
 	
-	if (touch_detected)
+	if (detected&CORE_TOUCH)
 		touchpad_broadcast_touch(touchpad);
 	
-	if (press_detected || double_tap_detected)
+	if (detected&(CORE_PRESS|CORE_DOUBLE_TAP))
 		touchpad_broadcast_press(touchpad);
 	
-	if (edge_touch_detected)
+	if (detected&CORE_EDGE_TOUCH)
 		touchpad_broadcast_edge_touch(touchpad);
+	tracer_end(TRACE_APPLY, begin, device-touchpad->devices);
 }
 
-void touchpad_read_next_event(touchpad_t *touchpad) {
-	struct input_event event = {};
-	
-	exitif(read(touchpad->fd, &event, sizeof(event)) == -1,
-		   "cannot read from the touchpad event file");
-	//printf("%d\t%d\t%d\n", event.type, event.code, event.value);
-	if (event.type == SYN_REPORT) {
-		applie_occured_events(touchpad);
-		reset_occured_events(&touchpad->occured);
-	} else if (event.type == EV_KEY) {
-		switch (event.code) {
-		case TOUCH_CODE: // touched
-			touchpad->occured.touched = event.value;
-			if (event.value)
-				touchpad->occured.touch_time = EVENT_TIME_MILLI(event);
-			break;
-		case PRESS_CODE: // pressed
-			touchpad->occured.pressed = event.value;
-			break;
+/**
+ * Read the current state of the device after
+ * events have been dropped, and store the
+ * differences with the known state in the core frame
+ */
+static void resync_device(touchpad_t *touchpad, touchpad_device_t *device) {
+	uint8_t keys[(KEY_CNT+7)/8] = {};
+	exitif(ioctl(device->fd, EVIOCGKEY(sizeof(keys)), keys) == -1, "ioctl get keys");
+	struct input_absinfo x = {};
+	exitif(ioctl(device->fd, EVIOCGABS(ABS_X), &x) == -1, "ioctl get x");
+	struct input_absinfo y = {};
+	exitif(ioctl(device->fd, EVIOCGABS(ABS_Y), &y) == -1, "ioctl get y");
+	
+	bool touched = keys[TOUCH_CODE/8]&(1<<(TOUCH_CODE%8));
+	bool pressed = keys[PRESS_CODE/8]&(1<<(PRESS_CODE%8));
+	core_touchpad_resync(&device->core, x.value, y.value, touched, pressed,
+						 kclock_now(touchpad->clock)/1000);
+	logger_push(LOG_RESYNC, "touchpad %ld resynchronised, x:%ld y:%ld",
+				device-touchpad->devices, x.value, y.value);
+}
+
+/**
+ * Handle an event of the device
+ *
+ * stale: true if a more recent complete frame
+ *        has already been read
+ */
+static void handle_event(touchpad_t *touchpad, touchpad_device_t *device,
+						 struct input_event *event, bool stale) {
+	if (event->type == EV_KEY
+		&& (event->code == BTN_LEFT || event->code == BTN_RIGHT || event->code == BTN_MIDDLE)
+		&& atomic_load_explicit(&device->grabbed, memory_order_relaxed)
+		&& touchpad->pointer.n_buttons < TOUCHPAD_MAX_BUTTONS) {
+		touchpad->pointer.buttons[touchpad->pointer.n_buttons++] = *event;
+	}
+	switch (core_touchpad_event(&device->core, event, stale)) {
+	case CORE_FRAME_RESYNC:
+		recorder_anomaly(RECORDER_SYN_DROPPED, device-touchpad->devices);
+		// simulated devices cannot be read
+		if (device->fd != -1) resync_device(touchpad, device);
+		applie_occured_events(touchpad, device);
+		break;
+	case CORE_FRAME_READY:
+		applie_occured_events(touchpad, device);
+		break;
+	}
+}
+
+/**
+ * Count the latency of each frame of the events,
+ * and record the events in the flight recorder
+ */
+static void record_events(touchpad_t *touchpad, touchpad_device_t *device,
+							struct input_event *events, int count) {
+	// the kernel gives the time of the events with CLOCK_MONOTONIC,
+	// or with CLOCK_REALTIME if the clock of the device could not be
+	// changed, the frames of a simulated touchpad are timed with the clock
+	long now;
+	if (device->fd == -1) {
+		now = kclock_now(touchpad->clock);
+	} else {
+		struct timespec ts;
+		clock_gettime(device->monotonic? CLOCK_MONOTONIC: CLOCK_REALTIME, &ts);
+		now = ts.tv_sec*1000000L+ts.tv_nsec/1000;
+	}
+	int index = device-touchpad->devices;
+	for (int i = 0; i < count; ++i) {
+		if (events[i].type != EV_SYN || events[i].code != SYN_REPORT) {
+			recorder_event(index, events+i, -1);
+			continue;
 		}
-	} else if (event.type == EV_ABS) {
-		// moved
-		switch (event.code) {
-		case ABS_X:
-			touchpad->occured.x = event.value;
-			break;
-		case ABS_Y:
-			touchpad->occured.y = event.value;
-			break;
+		long latency = now-(events[i].input_event_sec*1000000L+events[i].input_event_usec);
+		recorder_event(index, events+i, latency);
+		if (latency > RECORDER_MAX_LATENCY) recorder_anomaly(RECORDER_LATENCY, latency);
+		// clamped before the narrowing to int
+		if (latency < 0) latency = 0;
+		if (latency >= TOUCHPAD_LATENCY_STEP*TOUCHPAD_LATENCY_BUCKETS)
+			latency = TOUCHPAD_LATENCY_STEP*TOUCHPAD_LATENCY_BUCKETS-1;
+		int bucket = latency/TOUCHPAD_LATENCY_STEP;
+		// only this thread writes, no need of an atomic increment
+		atomic_store_explicit(&touchpad->latency[bucket],
+							  atomic_load_explicit(&touchpad->latency[bucket],
+												   memory_order_relaxed)+1,
+							  memory_order_relaxed);
+	}
+}
+
+/**
+ * Handle count events of the device
+ */
+static void handle_events(touchpad_t *touchpad, touchpad_device_t *device,
+						  struct input_event *events, int count) {
+	// frames before the last complete one are stale
+	int last_report = -1;
+	for (int i = 0; i < count; ++i) {
+		if (events[i].type == EV_SYN && events[i].code == SYN_REPORT)
+			last_report = i;
+	}
+	record_events(touchpad, device, events, count);
+	for (int i = 0; i < count; ++i) {
+		handle_event(touchpad, device, events+i, i < last_report);
+	}
+	// the watchdog knows the events are read
+	atomic_fetch_add_explicit(&touchpad->handled, 1, memory_order_relaxed);
+}
+
+/**
+ * Wait until the touchpad is stopped, used once the file
+ * of touchpad_init_fd ended, as nothing else can be read
+ */
+static void wait_stop(touchpad_t *touchpad) {
+	struct notification *notif = touchpad->notifications+TOUCHPAD_ANY;
+	// touchpad_stop notifies after setting stopped
+	atomic_fetch_add(&notif->waiters, 1);
+	int seq = atomic_load(&notif->seq);
+	while (!atomic_load(&touchpad->stopped)) {
+		kclock_wait(touchpad->clock, &notif->seq, seq);
+		seq = atomic_load(&notif->seq);
+	}
+	atomic_fetch_sub(&notif->waiters, 1);
+}
+
+/**
+ * Read the pending events of the device
+ */
+static void read_device_events(touchpad_t *touchpad, touchpad_device_t *device) {
+	struct input_event events[EVENT_BATCH_SIZE];
+	
+	long begin = tracer_begin();
+	ssize_t size = read(device->fd, events, sizeof(events));
+	tracer_end(TRACE_READ, begin, size > 0? size/sizeof(*events): 0);
+	if (size == -1 && errno == EINTR) return;
+	exitif(size == -1, "cannot read from the touchpad event file");
+	// only the file of touchpad_init_fd can end
+	if (size == 0) {
+		wait_stop(touchpad);
+		return;
+	}
+	handle_events(touchpad, device, events, size/sizeof(*events));
+}
+
+void touchpad_feed_events(touchpad_t *touchpad, struct input_event *events, int count) {
+	handle_events(touchpad, touchpad->devices, events, count);
+}
+
+/**
+ * Wait for the completion of queued reads,
+ * handle their events and queue them again
+ */
+static void read_uring_events(touchpad_t *touchpad) {
+	uring_completion_t completions[MAX_TOUCHPADS];
+	// the reads queued again are submitted
+	// by the system call that waits
+	long begin = tracer_begin();
+	int count = uring_wait(touchpad->uring, 1, completions, MAX_TOUCHPADS);
+	tracer_end(TRACE_READ, begin, count > 0? count: 0);
+	for (int i = 0; i < count; ++i) {
+		int device = completions[i].data;
+		int res = completions[i].res;
+		// only the file of touchpad_init_fd can end,
+		// it is not read again
+		if (res == 0) {
+			wait_stop(touchpad);
+			continue;
 		}
+		if (res > 0) {
+			handle_events(touchpad, touchpad->devices+device,
+						  touchpad->buffers[device], res/sizeof(struct input_event));
+		} else if (res != -EINTR) {
+			errno = -res;
+			exitif(true, "cannot read from the touchpad event file");
+		}
+		queue_read(touchpad, device);
 	}
 }
 
+void touchpad_read_next_event(touchpad_t *touchpad) {
+	if (touchpad->uring) {
+		read_uring_events(touchpad);
+		return;
+	}
+	if (touchpad->n_devices == 1) {
+		// no need to wait for several devices
+		read_device_events(touchpad, touchpad->devices);
+		return;
+	}
+	
+	int ready = poll(touchpad->fds, touchpad->n_devices, -1);
+	if (ready == -1 && errno == EINTR) return;
+	exitif(ready == -1, "cannot poll the touchpad event files");
+	for (int i = 0; i < touchpad->n_devices && ready > 0; ++i) {
+		if (!touchpad->fds[i].revents) continue;
+		--ready;
+		exitif(!(touchpad->fds[i].revents&POLLIN),
+			   "error on the touchpad event file of %s",
+			   touchpad->devices[i].tr.name);
+		read_device_events(touchpad, touchpad->devices+i);
+	}
+}
+
+void touchpad_get_pointer(touchpad_t *touchpad, touchpad_pointer_t *pointer) {
+	*pointer = touchpad->pointer;
+	touchpad->pointer = (touchpad_pointer_t) {};
+}
+
 void touchpad_get_info(touchpad_t *touchpad, touchpad_info_t *info) {
 	pthread_mutex_lock(&touchpad->mutex);
-	*info = touchpad->info;
+	*info = touchpad->devices[touchpad->current].info;
+	// the events are notified after the informations
+	// are updated, so an event that is not visible
+	// in info is counted after these values
+	for (int i = 0; i < TOUCHPAD_N_EVENTS; ++i) {
+		info->seq[i] = atomic_load(&touchpad->notifications[i].seq);
+	}
 	pthread_mutex_unlock(&touchpad->mutex);
 }
 
-void touchpad_wait_touch(touchpad_t *touchpad) {
-	pthread_mutex_lock(&touchpad->mutex);
-	if (!touchpad->stopped) {
-		pthread_cond_wait(&touchpad->cond_touch, &touchpad->mutex);
+/**
+ * Wait for the event to occur more than seq times
+ */
+static void wait_event(touchpad_t *touchpad, int event, int seq) {
+	struct notification *notif = touchpad->notifications+event;
+	long begin = tracer_begin();
+	// the waiter is counted before checking the
+	// sequence number and the notifier does the opposite,
+	// so at least one of them sees the other
+	atomic_fetch_add(&notif->waiters, 1);
+	while (atomic_load(&notif->seq) == seq && !atomic_load(&touchpad->stopped)) {
+		kclock_wait(touchpad->clock, &notif->seq, seq);
 	}
-	pthread_mutex_unlock(&touchpad->mutex);
+	atomic_fetch_sub(&notif->waiters, 1);
+	tracer_end(TRACE_WAIT, begin, event);
+	recorder_wakeup(-1);
+}
+
+/**
+ * Restart the threads waiting for the event
+ *
+ * traced: false if called by a signal handler, the tracer
+ *         would write in the ring of the interrupted thread
+ */
+static void notify_event(touchpad_t *touchpad, int event, bool traced) {
+	struct notification *notif = touchpad->notifications+event;
+	atomic_fetch_add(&notif->seq, 1);
+	if (atomic_load(&notif->waiters) > 0) {
+		if (traced) tracer_instant(TRACE_WAKE, event);
+		kclock_wake(touchpad->clock, &notif->seq);
+	}
+}
+
+void touchpad_wait_touch(touchpad_t *touchpad, touchpad_info_t *info) {
+	wait_event(touchpad, TOUCHPAD_TOUCH, info->seq[TOUCHPAD_TOUCH]);
 }
 
 void touchpad_broadcast_touch(touchpad_t *touchpad) {
-	pthread_cond_broadcast(&touchpad->cond_touch);
-	pthread_cond_broadcast(&touchpad->cond_touch_or_press);
+	notify_event(touchpad, TOUCHPAD_TOUCH, true);
+	notify_event(touchpad, TOUCHPAD_TOUCH_OR_PRESS, true);
+	notify_event(touchpad, TOUCHPAD_ANY, true);
 }
 
-void touchpad_wait_press(touchpad_t *touchpad) {
-	pthread_mutex_lock(&touchpad->mutex);
-	if (!touchpad->stopped) {
-		pthread_cond_wait(&touchpad->cond_press, &touchpad->mutex);
-	}
-	pthread_mutex_unlock(&touchpad->mutex);
+void touchpad_wait_press(touchpad_t *touchpad, touchpad_info_t *info) {
+	wait_event(touchpad, TOUCHPAD_PRESS, info->seq[TOUCHPAD_PRESS]);
 }
 
 void touchpad_broadcast_press(touchpad_t *touchpad) {
-	pthread_cond_broadcast(&touchpad->cond_press);
-	pthread_cond_broadcast(&touchpad->cond_touch_or_press);
+	notify_event(touchpad, TOUCHPAD_PRESS, true);
+	notify_event(touchpad, TOUCHPAD_TOUCH_OR_PRESS, true);
+	notify_event(touchpad, TOUCHPAD_ANY, true);
 }
 
-void touchpad_wait_touch_or_press(touchpad_t *touchpad) {
-	pthread_mutex_lock(&touchpad->mutex);
-	if (!touchpad->stopped) {
-		pthread_cond_wait(&touchpad->cond_touch_or_press, &touchpad->mutex);
-	}
-	pthread_mutex_unlock(&touchpad->mutex);
+void touchpad_wait_touch_or_press(touchpad_t *touchpad, touchpad_info_t *info) {
+	wait_event(touchpad, TOUCHPAD_TOUCH_OR_PRESS, info->seq[TOUCHPAD_TOUCH_OR_PRESS]);
 }
 
-void touchpad_wait_edge_touch(touchpad_t *touchpad) {
-	pthread_mutex_lock(&touchpad->mutex);
-	if (!touchpad->stopped) {
-		pthread_cond_wait(&touchpad->cond_edge_touch, &touchpad->mutex);
-	}
-	pthread_mutex_unlock(&touchpad->mutex);
+void touchpad_wait_edge_touch(touchpad_t *touchpad, touchpad_info_t *info) {
+	wait_event(touchpad, TOUCHPAD_EDGE_TOUCH, info->seq[TOUCHPAD_EDGE_TOUCH]);
+}
+
+void touchpad_wait_any(touchpad_t *touchpad, touchpad_info_t *info) {
+	wait_event(touchpad, TOUCHPAD_ANY, info->seq[TOUCHPAD_ANY]);
 }
 
 void touchpad_broadcast_edge_touch(touchpad_t *touchpad) {
-	pthread_cond_broadcast(&touchpad->cond_edge_touch);
+	notify_event(touchpad, TOUCHPAD_EDGE_TOUCH, true);
+	notify_event(touchpad, TOUCHPAD_ANY, true);
 }
 
 void touchpad_stop(touchpad_t *touchpad) {
-	pthread_mutex_lock(&touchpad->mutex);
-	touchpad->stopped = true;
-	pthread_mutex_unlock(&touchpad->mutex);
-	touchpad_broadcast_touch(touchpad);
-	touchpad_broadcast_press(touchpad);
-	touchpad_broadcast_edge_touch(touchpad);
+	atomic_store(&touchpad->stopped, true);
+	for (int i = 0; i < TOUCHPAD_N_EVENTS; ++i) notify_event(touchpad, i, false);
 }
 
 void touchpad_clean(touchpad_t *touchpad) {
-	if (touchpad->fd == -1) return; // should not append
-	if (!touchpad->stopped) touchpad_stop(touchpad);
-	exitif(close(touchpad->fd) == -1, "cannot close the touchpad event file");
+	if (touchpad->n_devices == 0) { // should not append
+		free(touchpad);
+		return;
+	}
+	if (!atomic_load(&touchpad->stopped)) touchpad_stop(touchpad);
+	if (touchpad->has_watchdog) pthread_join(touchpad->watchdog, NULL);
+	// closing the devices releases the grabs
+	if (touchpad->uring) uring_clean(touchpad->uring);
+	for (int i = 0; i < touchpad->n_devices; ++i) {
+		if (touchpad->devices[i].fd == -1) continue; // simulated
+		exitif(close(touchpad->devices[i].fd) == -1,
+			   "cannot close the touchpad event file");
+	}
 	pthread_mutex_destroy(&touchpad->mutex);
-	pthread_cond_destroy(&touchpad->cond_touch);
-	pthread_cond_destroy(&touchpad->cond_press);
-	pthread_cond_destroy(&touchpad->cond_touch_or_press);
-	pthread_cond_destroy(&touchpad->cond_edge_touch);
+	free(touchpad);
 }
@@ -2,6 +2,10 @@
 #define __TOUCHPAD_H__
 
 #include <stdbool.h>
+#include <linux/input.h>
+
+#include "clock.h"
+#include "core.h"
 
 #define DEFAULT_EDGE_THICKNESS 250
 
@@ -9,8 +13,39 @@
 #define LIST_CANDIDATES 1
 #define LIST_ALL        2
 
+// max number of devices
+// listened at the same time
+#define MAX_TOUCHPADS 8
+
+// number of frames kept in the history
+// of touchpad_get_history, must be a power of 2
+#define TOUCHPAD_HISTORY_SIZE 64
+
+// max number of button changes
+// given by touchpad_get_pointer
+#define TOUCHPAD_MAX_BUTTONS 8
+
+// the latencies of the frames are counted by steps of
+// TOUCHPAD_LATENCY_STEP us, the last bucket also counts
+// the frames that took longer
+#define TOUCHPAD_LATENCY_STEP    10
+#define TOUCHPAD_LATENCY_BUCKETS 1000
+
+// the grabbed devices are released if their
+// events are not read for this time, in milliseconds
+#define TOUCHPAD_GRAB_TIMEOUT 500
+
 typedef struct touchpad touchpad_t;
 
+// events that threads can wait for
+#define TOUCHPAD_TOUCH          0
+#define TOUCHPAD_PRESS          1
+#define TOUCHPAD_TOUCH_OR_PRESS 2
+#define TOUCHPAD_EDGE_TOUCH     3
+// any of the events above
+#define TOUCHPAD_ANY            4
+#define TOUCHPAD_N_EVENTS       5
+
 struct touchpad_info {
 	// Coordinates on the touchpad
 	int x;
@@ -36,14 +71,45 @@ struct touchpad_info {
 	// Double taps made beyond the edge limits are ingored
 	// unless no_edge_protection is true
 	bool double_tapped;
+	// index of the device that
+	// gave those informations
+	int device;
+	// number of times each event occured when
+	// those informations were given, used by touchpad_wait_*
+	int seq[TOUCHPAD_N_EVENTS];
 };
 typedef struct touchpad_info touchpad_info_t;
 
+// pointer movements and buttons of the grabbed devices
+struct touchpad_pointer {
+	// distance moved by the finger,
+	// in touchpad units
+	int dx;
+	int dy;
+	// button changes, in the order they occured
+	int n_buttons;
+	struct input_event buttons[TOUCHPAD_MAX_BUTTONS];
+};
+typedef struct touchpad_pointer touchpad_pointer_t;
+
+// distribution of the latencies of the frames, from
+// their time given by the kernel to their handling
+struct touchpad_latency {
+	unsigned long buckets[TOUCHPAD_LATENCY_BUCKETS];
+};
+typedef struct touchpad_latency touchpad_latency_t;
+
 struct touchpad_settings {
 	// if non null, it will search
 	// for a touchpad with this name
 	char *device_name;
 	
+	// if true, every device that looks like
+	// a touchpad and is not used by other settings
+	// is listened with these settings
+	// device_name is then ignored
+	bool all;
+	
 	// the below variables describe the limits
 	// on the touchpad after which it is considered
 	// beeing the edge
@@ -68,6 +134,11 @@ struct touchpad_settings {
 	// the edge limites
 	bool no_edge_protection;
 	
+	// if true, the device is grabbed so other programs
+	// do not receive its events, its movements and
+	// buttons are given by touchpad_get_pointer
+	bool grab;
+	
 	// if its value is LIST_CANDIDATES
 	// touchpad_init will list the caracteristics
 	// of candidate devices
@@ -81,15 +152,72 @@ typedef struct touchpad_settings touchpad_settings_t;
  * Init the needed things for touchpad
  * event polling
  *
- * Return a NULL if no touchpad
- * is found
+ * settings: array of count settings, each one
+ *           describing the device(s) to listen to
+ *           the list field of the first settings is used
+ *
+ * Events of all the found devices are read by
+ * touchpad_read_next_event, and touchpad_get_info
+ * gives the informations of the last touched one
+ *
+ * If a device is grabbed, a watchdog releases it when
+ * its events are not read for TOUCHPAD_GRAB_TIMEOUT ms,
+ * so the touchpad keeps working if kerpad stalls
+ *
+ * io: IO_BLOCKING or IO_URING, with IO_URING a read
+ *     is kept queued on each device, if io_uring is not
+ *     supported blocking reads are used
+ * clock: used to wait and for the time of events
+ *
+ * Return a NULL if a touchpad
+ * is not found
+ */
+touchpad_t *touchpad_init(touchpad_settings_t *settings, int count, int io,
+						  kclock_t *clock);
+
+/**
+ * Init a touchpad without device,
+ * its events are given with touchpad_feed_events
+ *
+ * xlimits, ylimits: limits of the simulated touchpad
+ * clock: used to wait and for the time of events
+ */
+touchpad_t *touchpad_init_simulated(touchpad_settings_t *settings,
+									struct input_absinfo *xlimits,
+									struct input_absinfo *ylimits,
+									kclock_t *clock);
+
+/**
+ * Init a touchpad reading the events of fd instead of
+ * a device, such as a socket where frames are replayed,
+ * they are read as the events of a device
+ *
+ * The time of the events must be given with CLOCK_MONOTONIC
+ * The touchpad is not grabbed, but its pointer is given
+ * as for a grabbed device if settings asks for it
+ * At the end of fd, reading waits until the touchpad is stopped
+ *
+ * xlimits, ylimits: limits of the touchpad
+ * io: IO_BLOCKING or IO_URING, as for touchpad_init
+ * clock: used to wait and for the time of events
+ */
+touchpad_t *touchpad_init_fd(touchpad_settings_t *settings, int fd,
+							 struct input_absinfo *xlimits,
+							 struct input_absinfo *ylimits,
+							 int io, kclock_t *clock);
+
+/**
+ * Handle count events of a simulated touchpad,
+ * as if they were read from a device
  */
-touchpad_t *touchpad_init(touchpad_settings_t *settings);
+void touchpad_feed_events(touchpad_t *touchpad, struct input_event *events, int count);
 
 /**
  * Stop the touchpad
  * Should not be used after this function call
  * A call to touchpad_stop is still required
+ * Can be called by a signal handler, the wake ups
+ * of the waiting threads are not traced then
  */
 void touchpad_stop(touchpad_t *touchpad);
 
@@ -99,7 +227,14 @@ void touchpad_stop(touchpad_t *touchpad);
 void touchpad_clean(touchpad_t *touchpad);
 
 /**
- * Read the next touchpad event
+ * Read the next touchpad events
+ * If several devices are listened, read the
+ * next events of each device that has some
+ *
+ * When several frames are pending, frames
+ * that only move are merged into the newest one,
+ * and the state of the device is read again if
+ * the kernel dropped events
  */
 void touchpad_read_next_event(touchpad_t *touchpad);
 
@@ -110,49 +245,122 @@ void touchpad_read_next_event(touchpad_t *touchpad);
 void touchpad_get_info(touchpad_t *touchpad, touchpad_info_t *info);
 
 /**
- * Wait for the touchpad to be touched
+ * Write the movements and the buttons of the grabbed devices
+ * since the previous call in pointer
+ *
+ * Should only be called by the thread that
+ * calls touchpad_read_next_event
+ */
+void touchpad_get_pointer(touchpad_t *touchpad, touchpad_pointer_t *pointer);
+
+/**
+ * Write the state of a device after each of its
+ * recent frames in samples, the oldest first
+ *
+ * It does not lock, the frames overwritten
+ * while they are read are skipped
+ *
+ * device: index of the device, as in touchpad_info_t
+ * count: max number of samples
+ *
+ * Return the number of samples
+ */
+int touchpad_get_history(touchpad_t *touchpad, int device,
+						 struct core_sample *samples, int count);
+
+/**
+ * Write the edge limits of a device in limits
+ *
+ * device: index of the device, as in touchpad_info_t
+ */
+void touchpad_get_limits(touchpad_t *touchpad, int device, struct core_limits *limits);
+
+/**
+ * Return true if events are waiting to be read and
+ * no read was handled since the previous call
+ *
+ * handled: number of reads handled at the previous
+ *          call, updated, 0 before the first call
+ *
+ * Can be called by any thread
+ */
+bool touchpad_stalled(touchpad_t *touchpad, unsigned long *handled);
+
+/**
+ * Write the number of frames handled since touchpad_init
+ * in each bucket of latency
+ *
+ * It does not lock, so it can be called by any thread
+ */
+void touchpad_get_latency(touchpad_t *touchpad, touchpad_latency_t *latency);
+
+/**
+ * Wait for the touchpad to be touched after
+ * info was given by touchpad_get_info
+ * Return immediately if it has already been touched
+ * or if the touchpad is stopped
  *
  * Touches made beyond the edge limits are ingored
  * unless no_edge_protection is true
  */
-void touchpad_wait_touch(touchpad_t *touchpad);
+void touchpad_wait_touch(touchpad_t *touchpad, touchpad_info_t *info);
 
 /**
  * Restart all the threads that are waiting for the touchap
  * to be touched
+ * Only enter the kernel if a thread is waiting
  */
 void touchpad_broadcast_touch(touchpad_t *touchpad);
 
 /**
- * Wait for the touchpad to be pressed or double tapped
+ * Wait for the touchpad to be pressed or double tapped after
+ * info was given by touchpad_get_info
+ * Return immediately if it has already been pressed
+ * or if the touchpad is stopped
  *
  * Pressed and double taps made beyon the edge limits are ingored
  * unless no_edge_protection is true
  */
-void touchpad_wait_press(touchpad_t *touchpad);
+void touchpad_wait_press(touchpad_t *touchpad, touchpad_info_t *info);
 
 /**
  * Restart all the threads that are waiting for the touchap
  * to be pressed or double tapped
+ * Only enter the kernel if a thread is waiting
  */
 void touchpad_broadcast_press(touchpad_t *touchpad);
 
 /**
  * Wait for the touchpad to be touched, pressed or double tapped
+ * after info was given by touchpad_get_info
+ * Return immediately if it has already happened
+ * or if the touchpad is stopped
  *
  * Touches, presses and double taps made beyond the edge limits are ingored
  * unless no_edge_protection is true
  */
-void touchpad_wait_touch_or_press(touchpad_t *touchpad);
+void touchpad_wait_touch_or_press(touchpad_t *touchpad, touchpad_info_t *info);
 
 /**
  * Wait for the touchpad to be touched beyond the edge limits
+ * after info was given by touchpad_get_info
+ * Return immediately if it has already been touched
+ * or if the touchpad is stopped
+ */
+void touchpad_wait_edge_touch(touchpad_t *touchpad, touchpad_info_t *info);
+
+/**
+ * Wait for any of the events above after
+ * info was given by touchpad_get_info
+ * Return immediately if one has already happened
+ * or if the touchpad is stopped
  */
-void touchpad_wait_edge_touch(touchpad_t *touchpad);
+void touchpad_wait_any(touchpad_t *touchpad, touchpad_info_t *info);
 
 /**
  * Restart all the threads that are  waiting for the touchap
  * to be touched beyond the edge limits
+ * Only enter the kernel if a thread is waiting
  */
 void touchpad_broadcast_edge_touch(touchpad_t *touchpad);
 
@@ -0,0 +1,204 @@
+/*
+ * This file is responsible for recording a timeline
+ * of what the threads do, to see where the latency
+ * accumulates between them
+ *
+ * Each thread records spans in its own preallocated
+ * ring, and the rings are written as Chrome trace JSON
+ * when kerpad stops
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "tracer.h"
+#include "util.h"
+
+#define TRACER_MAX_THREADS 8
+
+struct span {
+	int kind;
+	long arg;
+	// in nanoseconds since the init of the tracer
+	long begin;
+	// -1 for an instant event
+	long duration;
+};
+
+struct tracer_buffer {
+	// written by its thread only
+	const char *name;
+	unsigned long count;
+	struct span *spans;
+};
+
+static const char *kind_names[TRACE_N_KINDS] = {
+	"read", "apply", "wait", "wake", "motion", "scroll", "write",
+};
+
+static struct {
+	struct tracer_buffer buffers[TRACER_MAX_THREADS];
+	atomic_int n_buffers;
+	
+	kclock_t *clock;
+	bool virtual;
+	long start;
+	FILE *file;
+	const char *path;
+	bool started;
+} tracer;
+
+// buffer of the calling thread, -1 if none
+static _Thread_local int thread_buffer = -1;
+
+/**
+ * Return the time in nanoseconds
+ */
+static long now_ns() {
+	// the virtual clock only has microseconds
+	if (tracer.virtual) return kclock_now(tracer.clock)*1000;
+	
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec*1000000000L+now.tv_nsec;
+}
+
+void tracer_init(kclock_t *clock, const char *path) {
+	tracer.file = strcmp(path, "-")? fopen(path, "w"): stdout;
+	exitif(tracer.file == NULL, "cannot open %s", path);
+	tracer.path = path;
+	
+	for (int i = 0; i < TRACER_MAX_THREADS; ++i) {
+		struct tracer_buffer *buffer = tracer.buffers+i;
+		buffer->name = NULL;
+		buffer->count = 0;
+		buffer->spans = malloc(TRACER_BUFFER_SIZE*sizeof(struct span));
+		exitif(buffer->spans == NULL, "cannot allocate the trace buffers");
+		// map the pages now rather than while recording
+		memset(buffer->spans, 0, TRACER_BUFFER_SIZE*sizeof(struct span));
+	}
+	atomic_init(&tracer.n_buffers, 0);
+	tracer.clock = clock;
+	tracer.virtual = kclock_is_virtual(clock);
+	tracer.start = now_ns();
+	tracer.started = true;
+}
+
+/**
+ * Return the buffer of the calling thread,
+ * NULL if there are too many threads
+ */
+static struct tracer_buffer *get_buffer() {
+	if (thread_buffer < 0) thread_buffer = atomic_fetch_add(&tracer.n_buffers, 1);
+	if (thread_buffer >= TRACER_MAX_THREADS) return NULL;
+	return tracer.buffers+thread_buffer;
+}
+
+void tracer_thread(const char *name) {
+	if (!tracer.started) return;
+	struct tracer_buffer *buffer = get_buffer();
+	if (buffer) buffer->name = name;
+}
+
+long tracer_begin() {
+	if (!tracer.started) return 0;
+	return now_ns()-tracer.start;
+}
+
+/**
+ * Record a span in the buffer of the calling thread,
+ * overwriting the oldest one if the buffer is full
+ */
+static void record(int kind, long begin, long duration, long arg) {
+	struct tracer_buffer *buffer = get_buffer();
+	if (!buffer) return;
+	struct span *span = buffer->spans+buffer->count%TRACER_BUFFER_SIZE;
+	span->kind = kind;
+	span->arg = arg;
+	span->begin = begin;
+	span->duration = duration;
+	++buffer->count;
+}
+
+void tracer_end(int kind, long begin, long arg) {
+	if (!tracer.started) return;
+	record(kind, begin, now_ns()-tracer.start-begin, arg);
+}
+
+void tracer_instant(int kind, long arg) {
+	if (!tracer.started) return;
+	record(kind, now_ns()-tracer.start, -1, arg);
+}
+
+/**
+ * Write a time in nanoseconds
+ * as fractional microseconds
+ */
+static void write_time(long ns) {
+	fprintf(tracer.file, "%ld.%03ld", ns/1000, ns%1000);
+}
+
+/**
+ * Write the name and the spans of a buffer
+ */
+static void write_buffer(int tid, struct tracer_buffer *buffer) {
+	char default_name[32];
+	const char *name = buffer->name;
+	if (!name) {
+		snprintf(default_name, sizeof(default_name), "thread %d", tid);
+		name = default_name;
+	}
+	fprintf(tracer.file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"tid\":%d,\"args\":{\"name\":\"%s\"}}", tid, name);
+	
+	unsigned long begin = buffer->count > TRACER_BUFFER_SIZE?
+		buffer->count-TRACER_BUFFER_SIZE: 0;
+	for (unsigned long i = begin; i < buffer->count; ++i) {
+		struct span *span = buffer->spans+i%TRACER_BUFFER_SIZE;
+		fprintf(tracer.file, ",\n{\"name\":\"%s\",\"cat\":\"kerpad\",\"pid\":1,"
+				"\"tid\":%d,\"ts\":", kind_names[span->kind], tid);
+		write_time(span->begin);
+		if (span->duration < 0) {
+			fprintf(tracer.file, ",\"ph\":\"i\",\"s\":\"t\"");
+		} else {
+			fprintf(tracer.file, ",\"ph\":\"X\",\"dur\":");
+			write_time(span->duration);
+		}
+		fprintf(tracer.file, ",\"args\":{\"arg\":%ld}}", span->arg);
+	}
+}
+
+void tracer_clean() {
+	if (!tracer.started) return;
+	tracer.started = false;
+	
+	int n_buffers = atomic_load(&tracer.n_buffers);
+	if (n_buffers > TRACER_MAX_THREADS) n_buffers = TRACER_MAX_THREADS;
+	unsigned long written = 0;
+	unsigned long overwritten = 0;
+	fprintf(tracer.file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	fprintf(tracer.file, "\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"args\":{\"name\":\"kerpad\"}}");
+	for (int i = 0; i < n_buffers; ++i) {
+		struct tracer_buffer *buffer = tracer.buffers+i;
+		write_buffer(i, buffer);
+		if (buffer->count > TRACER_BUFFER_SIZE) {
+			written += TRACER_BUFFER_SIZE;
+			overwritten += buffer->count-TRACER_BUFFER_SIZE;
+		} else {
+			written += buffer->count;
+		}
+	}
+	fprintf(tracer.file, "\n]}\n");
+	if (tracer.file != stdout) fclose(tracer.file);
+	else fflush(stdout);
+	
+	fprintf(stderr, "trace: %lu spans written to %s", written, tracer.path);
+	if (overwritten) fprintf(stderr, ", %lu older spans overwritten", overwritten);
+	fprintf(stderr, "\n");
+	for (int i = 0; i < TRACER_MAX_THREADS; ++i) free(tracer.buffers[i].spans);
+}
@@ -0,0 +1,73 @@
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#include "clock.h"
+
+// read of touchpad events, arg: number of events
+#define TRACE_READ 0
+// touchpad frame applied, arg: device
+#define TRACE_APPLY 1
+// wait for a touchpad event, arg: event
+#define TRACE_WAIT 2
+// wake up of the threads waiting for an event, arg: event
+#define TRACE_WAKE 3
+// edge motion tick, arg: moved pixels
+#define TRACE_MOTION 4
+// edge scrolling tick, arg: device
+#define TRACE_SCROLL 5
+// write of a mouse frame, arg: number of events
+#define TRACE_WRITE 6
+#define TRACE_N_KINDS 7
+
+// number of spans kept per thread,
+// the oldest ones are overwritten
+#define TRACER_BUFFER_SIZE 65536
+
+/**
+ * Init the tracer, the spans will be written
+ * in path by tracer_clean as Chrome trace JSON,
+ * which can be loaded in Perfetto or chrome://tracing
+ *
+ * The buffers of all threads are allocated
+ * and touched here, so recording a span
+ * does not allocate nor fault a page
+ *
+ * clock: gives the time of the spans
+ */
+void tracer_init(kclock_t *clock, const char *path);
+
+/**
+ * Name the calling thread in the trace
+ * Does nothing if the tracer is not started
+ */
+void tracer_thread(const char *name);
+
+/**
+ * Return the current time for tracer_end,
+ * 0 if the tracer is not started
+ */
+long tracer_begin();
+
+/**
+ * Record a span of the calling thread that
+ * started at begin, returned by tracer_begin
+ *
+ * This function does not lock, allocate nor do any syscall
+ * Does nothing if the tracer is not started
+ */
+void tracer_end(int kind, long begin, long arg);
+
+/**
+ * Record an instant event of the calling thread
+ * Does nothing if the tracer is not started
+ */
+void tracer_instant(int kind, long arg);
+
+/**
+ * Write the trace and free the buffers,
+ * the threads must not record spans anymore
+ * Does nothing if the tracer is not started
+ */
+void tracer_clean();
+
+#endif // !__TRACER_H__
@@ -0,0 +1,251 @@
+/*
+ * This file is responsible for the io_uring I/O backend,
+ * used with raw system calls so kerpad does not depend on liburing
+ *
+ * Without io_uring headers at build time (HAVE_IO_URING
+ * not defined), uring_init always fails and the
+ * plain system calls are used
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "util.h"
+
+int uring_parse(const char *backend) {
+	if (!strcmp(backend, "blocking")) return IO_BLOCKING;
+	if (!strcmp(backend, "uring")) return IO_URING;
+	return -1;
+}
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	
+	// submission queue, shared with the kernel
+	atomic_uint *sq_head;
+	atomic_uint *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	// queued requests not submitted yet
+	unsigned to_submit;
+	
+	// completion queue, shared with the kernel
+	atomic_uint *cq_head;
+	atomic_uint *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+	
+	void *ring;
+	size_t ring_size;
+	size_t sqes_size;
+};
+
+uring_t *uring_init(unsigned entries) {
+	struct io_uring_params params = {};
+	int fd = syscall(SYS_io_uring_setup, entries, &params);
+	if (fd == -1) return NULL;
+	if (!(params.features&IORING_FEAT_SINGLE_MMAP)) {
+		// kernels older than 5.4 are not supported
+		close(fd);
+		errno = ENOSYS;
+		return NULL;
+	}
+	
+	uring_t *uring = malloc(sizeof(*uring));
+	exitif(uring == NULL, "cannot allocate the io_uring");
+	uring->fd = fd;
+	uring->to_submit = 0;
+	
+	size_t sq_size = params.sq_off.array+params.sq_entries*sizeof(unsigned);
+	size_t cq_size = params.cq_off.cqes+params.cq_entries*sizeof(struct io_uring_cqe);
+	uring->ring_size = sq_size > cq_size? sq_size: cq_size;
+	uring->ring = mmap(NULL, uring->ring_size, PROT_READ|PROT_WRITE,
+					   MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	uring->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+	uring->sqes = uring->ring == MAP_FAILED? MAP_FAILED:
+		mmap(NULL, uring->sqes_size, PROT_READ|PROT_WRITE,
+			 MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		// the caller falls back to plain system calls
+		int err = errno;
+		if (uring->ring != MAP_FAILED) munmap(uring->ring, uring->ring_size);
+		close(fd);
+		free(uring);
+		errno = err;
+		return NULL;
+	}
+	
+	char *ring = uring->ring;
+	uring->sq_head = (atomic_uint *)(ring+params.sq_off.head);
+	uring->sq_tail = (atomic_uint *)(ring+params.sq_off.tail);
+	uring->sq_mask = *(unsigned *)(ring+params.sq_off.ring_mask);
+	uring->sq_array = (unsigned *)(ring+params.sq_off.array);
+	uring->cq_head = (atomic_uint *)(ring+params.cq_off.head);
+	uring->cq_tail = (atomic_uint *)(ring+params.cq_off.tail);
+	uring->cq_mask = *(unsigned *)(ring+params.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *)(ring+params.cq_off.cqes);
+	return uring;
+}
+
+int uring_register_files(uring_t *uring, const int *fds, int count) {
+	return syscall(SYS_io_uring_register, uring->fd,
+				   IORING_REGISTER_FILES, fds, count) == -1? -1: 0;
+}
+
+int uring_register_buffers(uring_t *uring, const struct iovec *buffers, int count) {
+	return syscall(SYS_io_uring_register, uring->fd,
+				   IORING_REGISTER_BUFFERS, buffers, count) == -1? -1: 0;
+}
+
+/**
+ * Return the next free submission entry
+ */
+static struct io_uring_sqe *next_sqe(uring_t *uring) {
+	unsigned tail = atomic_load_explicit(uring->sq_tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(uring->sq_head, memory_order_acquire);
+	exitif(tail-head > uring->sq_mask, "io_uring submission queue full");
+	unsigned index = tail&uring->sq_mask;
+	uring->sq_array[index] = index;
+	struct io_uring_sqe *sqe = uring->sqes+index;
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/**
+ * Make the last entry given by next_sqe visible to the kernel
+ */
+static void queue_sqe(uring_t *uring) {
+	atomic_fetch_add_explicit(uring->sq_tail, 1, memory_order_release);
+	++uring->to_submit;
+}
+
+void uring_read(uring_t *uring, int file, void *buf, unsigned len,
+				int buffer, unsigned long data) {
+	struct io_uring_sqe *sqe = next_sqe(uring);
+	sqe->opcode = buffer < 0? IORING_OP_READ: IORING_OP_READ_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->fd = file;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	// current position, evdev files are not seekable
+	sqe->off = -1;
+	if (buffer >= 0) sqe->buf_index = buffer;
+	sqe->user_data = data;
+	queue_sqe(uring);
+}
+
+void uring_write(uring_t *uring, int file, const void *buf, unsigned len,
+				 int buffer, bool link, unsigned long data) {
+	struct io_uring_sqe *sqe = next_sqe(uring);
+	sqe->opcode = buffer < 0? IORING_OP_WRITE: IORING_OP_WRITE_FIXED;
+	sqe->flags = IOSQE_FIXED_FILE|(link? IOSQE_IO_LINK: 0);
+	sqe->fd = file;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = -1;
+	if (buffer >= 0) sqe->buf_index = buffer;
+	sqe->user_data = data;
+	queue_sqe(uring);
+}
+
+/**
+ * Move the available completions to completions
+ *
+ * Return their number
+ */
+static int reap(uring_t *uring, uring_completion_t *completions, int max) {
+	unsigned head = atomic_load_explicit(uring->cq_head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(uring->cq_tail, memory_order_acquire);
+	int count = 0;
+	for (; head != tail && count < max; ++head) {
+		struct io_uring_cqe *cqe = uring->cqes+(head&uring->cq_mask);
+		completions[count++] = (uring_completion_t) {
+			.data = cqe->user_data,
+			.res = cqe->res,
+		};
+	}
+	atomic_store_explicit(uring->cq_head, head, memory_order_release);
+	return count;
+}
+
+int uring_wait(uring_t *uring, int min, uring_completion_t *completions, int max) {
+	int count = reap(uring, completions, max);
+	if (count >= min && !uring->to_submit) return count;
+	
+	// a single system call submits and waits
+	int submitted = syscall(SYS_io_uring_enter, uring->fd, uring->to_submit,
+							count >= min? 0: min-count, IORING_ENTER_GETEVENTS,
+							NULL, 0);
+	if (submitted == -1 && errno == EINTR) return count? count: -1;
+	exitif(submitted == -1, "cannot submit io_uring requests");
+	uring->to_submit -= submitted;
+	return count+reap(uring, completions+count, max-count);
+}
+
+bool uring_has_completions(uring_t *uring) {
+	return atomic_load(uring->cq_head) != atomic_load(uring->cq_tail);
+}
+
+void uring_clean(uring_t *uring) {
+	munmap(uring->sqes, uring->sqes_size);
+	munmap(uring->ring, uring->ring_size);
+	close(uring->fd);
+	free(uring);
+}
+
+#else // !HAVE_IO_URING
+
+uring_t *uring_init(unsigned entries) {
+	(void)entries;
+	errno = ENOSYS;
+	return NULL;
+}
+
+int uring_register_files(uring_t *uring, const int *fds, int count) {
+	(void)uring; (void)fds; (void)count;
+	return -1;
+}
+
+int uring_register_buffers(uring_t *uring, const struct iovec *buffers, int count) {
+	(void)uring; (void)buffers; (void)count;
+	return -1;
+}
+
+void uring_read(uring_t *uring, int file, void *buf, unsigned len,
+				int buffer, unsigned long data) {
+	(void)uring; (void)file; (void)buf; (void)len; (void)buffer; (void)data;
+}
+
+void uring_write(uring_t *uring, int file, const void *buf, unsigned len,
+				 int buffer, bool link, unsigned long data) {
+	(void)uring; (void)file; (void)buf; (void)len;
+	(void)buffer; (void)link; (void)data;
+}
+
+int uring_wait(uring_t *uring, int min, uring_completion_t *completions, int max) {
+	(void)uring; (void)min; (void)completions; (void)max;
+	errno = ENOSYS;
+	return -1;
+}
+
+bool uring_has_completions(uring_t *uring) {
+	(void)uring;
+	return false;
+}
+
+void uring_clean(uring_t *uring) {
+	(void)uring;
+}
+
+#endif // HAVE_IO_URING
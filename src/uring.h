@@ -0,0 +1,103 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdbool.h>
+#include <sys/uio.h>
+
+// I/O backends of the touchpad and of the output
+// plain read and write system calls
+#define IO_BLOCKING 0
+// io_uring, if supported by the kernel and
+// by the headers kerpad was built with
+#define IO_URING    1
+
+typedef struct uring uring_t;
+
+struct uring_completion {
+	// value given when the request was queued
+	unsigned long data;
+	// result of the request, as returned
+	// by read or write, or -errno
+	int res;
+};
+typedef struct uring_completion uring_completion_t;
+
+/**
+ * Parse an I/O backend: blocking or uring
+ *
+ * Return IO_BLOCKING or IO_URING,
+ * and -1 if the backend is invalid
+ */
+int uring_parse(const char *backend);
+
+/**
+ * Init an io_uring with at least entries
+ * submission entries
+ *
+ * Return NULL and set errno if io_uring is not
+ * supported or its rings cannot be mapped,
+ * the caller should then use plain system calls
+ */
+uring_t *uring_init(unsigned entries);
+
+/**
+ * Register count files, they are then given
+ * to uring_read and uring_write by their index
+ *
+ * Return 0 on success and -1 on error
+ */
+int uring_register_files(uring_t *uring, const int *fds, int count);
+
+/**
+ * Register count buffers, a request on a
+ * registered buffer gives its index to uring_read
+ * or uring_write
+ *
+ * Return 0 on success and -1 on error
+ */
+int uring_register_buffers(uring_t *uring, const struct iovec *buffers, int count);
+
+/**
+ * Queue a read of len bytes from the registered file
+ * at the current position of the file
+ *
+ * buffer: index of the registered buffer that contains buf,
+ *         or -1 if buf is not registered
+ * data: given back by the completion
+ */
+void uring_read(uring_t *uring, int file, void *buf, unsigned len,
+				int buffer, unsigned long data);
+
+/**
+ * Queue a write of len bytes to the registered file
+ *
+ * buffer: index of the registered buffer that contains buf,
+ *         or -1 if buf is not registered
+ * link: if true, the next queued request starts
+ *       once this one is complete
+ * data: given back by the completion
+ */
+void uring_write(uring_t *uring, int file, const void *buf, unsigned len,
+				 int buffer, bool link, unsigned long data);
+
+/**
+ * Submit the queued requests and wait for at least
+ * min completions, which are written in completions
+ *
+ * Return the number of completions (at most max),
+ * or -1 if interrupted by a signal
+ */
+int uring_wait(uring_t *uring, int min, uring_completion_t *completions, int max);
+
+/**
+ * Return true if completions were not given by uring_wait yet
+ * Can be called by another thread than the one that waits
+ */
+bool uring_has_completions(uring_t *uring);
+
+/**
+ * Clean the io_uring
+ */
+void uring_clean(uring_t *uring);
+
+#endif // !__URING_H__
@@ -3,6 +3,9 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "util.h"
 
@@ -12,7 +15,8 @@
 	char formated_msg[255] = PROG_NAME": ";\
 	va_list argptr;\
 	va_start(argptr, msg);\
-	vsprintf(formated_msg+strlen(formated_msg), msg, argptr);\
+	vsnprintf(formated_msg+strlen(formated_msg),\
+			  sizeof(formated_msg)-strlen(formated_msg), msg, argptr);\
 	va_end(argptr);
 
 void error_message(const char *message, ...) {
@@ -20,14 +24,22 @@ void error_message(const char *message, ...) {
 	fprintf(stderr, "%s\n", formated_message);
 }
 
+/**
+ * Print formated_prefix, followed by
+ * the description of errno if errno != 0
+ */
+static void print_message(const char *formated_prefix) {
+	if (errno != 0) {
+		perror(formated_prefix);
+	} else {
+		fprintf(stderr, "%s\n", formated_prefix);
+	}
+}
+
 bool msgif(bool condition, const char *prefix, ...) {
 	if (condition) {
 		FORMAT_MSG(prefix, formated_prefix);
-		if (errno != 0) {
-			perror(formated_prefix);
-		} else {
-			fprintf(stderr, "%s\n", formated_prefix);
-		}
+		print_message(formated_prefix);
 	}
 	return condition;
 }
@@ -35,7 +47,29 @@ bool msgif(bool condition, const char *prefix, ...) {
 void exitif(bool condition, const char *prefix, ...) {
 	if (condition) {
 		FORMAT_MSG(prefix, formated_prefix);
-		msgif(condition, formated_prefix);
+		print_message(formated_prefix);
 		exit(EXIT_FAILURE);
 	}
 }
+
+void futex_wait(atomic_int *addr, int val) {
+	int err = syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+	exitif(err == -1 && errno != EAGAIN && errno != EINTR, "futex wait");
+}
+
+void futex_wait_until(atomic_int *addr, int val, long time) {
+	struct timespec ts = {
+		.tv_sec = time/1000000,
+		.tv_nsec = time%1000000*1000,
+	};
+	// with FUTEX_WAIT_BITSET, the timeout is an absolute monotonic time
+	int err = syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, &ts, NULL,
+					  FUTEX_BITSET_MATCH_ANY);
+	exitif(err == -1 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT,
+		   "futex wait");
+}
+
+void futex_wake(atomic_int *addr, int count) {
+	exitif(syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0) == -1,
+		   "futex wake");
+}
@@ -2,6 +2,7 @@
 #define __UTIL_H__
 
 #include <stdbool.h>
+#include <stdatomic.h>
 
 /**
  * Print an error message with the format
@@ -23,4 +24,22 @@ bool msgif(bool condition, const char *prefix, ...);
  */
 void exitif(bool condition, const char *prefix, ...);
 
+/**
+ * Wait until *addr is no longer equal to val
+ * May return spuriously
+ */
+void futex_wait(atomic_int *addr, int val);
+
+/**
+ * Wait until *addr is no longer equal to val, or until
+ * CLOCK_MONOTONIC reaches time (in microseconds)
+ * May return spuriously
+ */
+void futex_wait_until(atomic_int *addr, int val, long time);
+
+/**
+ * Wake up to count threads waiting on addr
+ */
+void futex_wake(atomic_int *addr, int count);
+
 #endif // !__UTIL_H__